@@ -0,0 +1,80 @@
+#include "budget.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+
+void bytesemaphore::take(size_t n) {
+  used += n;
+  if( used > peak ){
+    peak = used;
+    STATS_PEAK(BUDGET_PEAK_BYTES, peak);
+  }
+}
+
+void bytesemaphore::acquire(size_t n) {
+  std::unique_lock lk(mtx);
+  cv.wait(lk, [this, n]() { return fits(n); });
+  take(n);
+}
+
+bool bytesemaphore::try_acquire(size_t n) {
+  std::lock_guard lk(mtx);
+  if( !fits(n) ) return false;
+  take(n);
+  return true;
+}
+
+void bytesemaphore::force(size_t n) {
+  std::lock_guard lk(mtx);
+  take(n);
+}
+
+void bytesemaphore::release(size_t n) {
+  {
+    std::lock_guard lk(mtx);
+    used -= std::min(n, used);
+  }
+  cv.notify_all();
+}
+
+static std::unique_ptr<bytesemaphore> budget;
+
+/**
+ * @brief Set the memory budget. Call before anything is read.
+ *
+ * @param bytes The budget, or 0 for no limit
+ */
+void memory_budget_set(size_t bytes) {
+  budget = bytes ? std::make_unique<bytesemaphore>(bytes) : nullptr;
+}
+
+bytesemaphore* memory_budget() {
+  return budget.get();
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M or G (powers of 1024) suffix
+ *
+ * @returns Nothing if the string isn't a size
+ */
+std::optional<size_t> parse_size(std::string_view str) {
+  size_t n;
+  auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), n);
+  if( ec != std::errc() || end == str.data() )
+    return std::nullopt;
+
+  std::string_view suffix(end, str.data() + str.size() - end);
+  int shift;
+  if( suffix.empty() ) shift = 0;
+  else if( suffix == "K" || suffix == "k" ) shift = 10;
+  else if( suffix == "M" || suffix == "m" ) shift = 20;
+  else if( suffix == "G" || suffix == "g" ) shift = 30;
+  else return std::nullopt;
+
+  if( n > (SIZE_MAX >> shift) )
+    return std::nullopt;
+  return n << shift;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief A counting semaphore of bytes
+ *
+ * Holders take the bytes they are about to use and give them back when done. A request that
+ * doesn't fit waits for other holders, except when nothing is held, so an item bigger than
+ * the whole budget still gets through on its own instead of waiting forever.
+ */
+class bytesemaphore {
+  mutable std::mutex mtx;
+  std::condition_variable cv;
+  const size_t capacity;
+  size_t used = 0;
+  size_t peak = 0;
+
+  bool fits(size_t n) const {
+    return used == 0 || used + n <= capacity;
+  }
+
+  void take(size_t n);
+
+  public:
+    explicit bytesemaphore(size_t capacity) : capacity(capacity) {}
+
+    // Take bytes, waiting until they fit in the budget
+    void acquire(size_t);
+
+    // Take bytes if they fit in the budget right now
+    bool try_acquire(size_t);
+
+    // Take bytes without waiting, even over the budget. For memory that is already committed.
+    void force(size_t);
+
+    void release(size_t);
+
+    size_t size() const {
+      return capacity;
+    }
+
+    size_t inUse() const {
+      std::lock_guard lk(mtx);
+      return used;
+    }
+
+    size_t peakUse() const {
+      std::lock_guard lk(mtx);
+      return peak;
+    }
+};
+
+// Limit the memory of documents being read and parsed to a number of bytes
+void memory_budget_set(size_t bytes);
+
+// The memory budget, or nullptr if there is no limit
+bytesemaphore* memory_budget();
+
+// Parse a size such as "1500000", "512K", "1536M" or "2G"
+std::optional<size_t> parse_size(std::string_view);
@@ -0,0 +1,347 @@
+#include "distscan.hpp"
+#include "graph.hpp"
+#include "hash.hpp"
+#include "naming.hpp"
+#include "trace.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'D', 'O', 'C', 'M', 'N', 'G', 'W', '2'};
+static constexpr uint32_t END = 0xFFFFFFFF;
+
+// Files a worker parses at once before sending them back
+static constexpr size_t WORKER_BATCH = 256;
+
+// Most references, and bytes of their text, one record may hold. Anything claiming more is
+// taken for a broken stream instead of being allocated.
+static constexpr uint32_t MAX_RECORD_REFS = 1 << 20;
+static constexpr uint32_t MAX_RECORD_TEXT = 64 << 20;
+
+enum : uint8_t {
+  PARSED = 1,
+  HASHED = 2,
+};
+
+static void put32(string& out, uint32_t v) {
+  for( int i = 0; i < 4; i++ )
+    out += char(v >> (8 * i));
+}
+
+static void put64(string& out, uint64_t v) {
+  for( int i = 0; i < 8; i++ )
+    out += char(v >> (8 * i));
+}
+
+static uint32_t get32(const char* p) {
+  uint32_t v = 0;
+  for( int i = 0; i < 4; i++ )
+    v |= uint32_t((unsigned char)p[i]) << (8 * i);
+  return v;
+}
+
+static uint64_t get64(const char* p) {
+  uint64_t v = 0;
+  for( int i = 0; i < 8; i++ )
+    v |= uint64_t((unsigned char)p[i]) << (8 * i);
+  return v;
+}
+
+// Write all of a buffer, false if the other side went away
+static bool writeAll(int fd, std::string_view buf) {
+  while( !buf.empty() ){
+    ssize_t n = send(fd, buf.data(), buf.size(), MSG_NOSIGNAL);
+    if( n < 0 && errno == ENOTSOCK )
+      n = write(fd, buf.data(), buf.size());
+    if( n < 0 && errno == EINTR ) continue;
+    if( n <= 0 ) return false;
+    buf.remove_prefix(n);
+  }
+  return true;
+}
+
+// Read exactly len bytes, false on end of file or error
+static bool readAll(int fd, char* buf, size_t len) {
+  while( len > 0 ){
+    ssize_t n = read(fd, buf, len);
+    if( n < 0 && errno == EINTR ) continue;
+    if( n <= 0 ) return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read32(int fd, uint32_t& v) {
+  char b[4];
+  if( !readAll(fd, b, 4) ) return false;
+  v = get32(b);
+  return true;
+}
+
+string scanworker_local_command() {
+  char exe[PATH_MAX];
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if( n <= 0 )
+    throw std::runtime_error(string("Unable to find this program to start workers: ") + strerror(errno));
+
+  // Quoted for the shell the command is run with
+  string cmd = "'";
+  for( char c : std::string_view(exe, n) )
+    cmd += c == '\'' ? string("'\\''") : string(1, c);
+  return cmd + "' --worker";
+}
+
+/**
+ * @brief Serve one shard as a worker
+ *
+ * The shard's files are parsed a batch at a time, and each batch is sent back as soon as it's
+ * done, so the coordinator merges results while the rest of the shard is being parsed.
+ *
+ * @param in Where the shard is read from
+ * @param out Where the results are written to
+ * @returns 0 if the whole shard was sent back, else 1
+ */
+int scanworker_run(int in, int out) {
+  char magic[sizeof(MAGIC)];
+  if( !writeAll(out, std::string_view(MAGIC, sizeof(MAGIC))) || !readAll(in, magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ){
+    std::cerr << "Worker: not talking to a coordinator" << std::endl;
+    return 1;
+  }
+
+  // The coordinator's naming schemes, so the worker makes the same documents of the files
+  uint32_t count;
+  if( !read32(in, count) ) return 1;
+  vector<string> patterns;
+  for( uint32_t i = 0; i < count; i++ ){
+    uint32_t len;
+    if( !read32(in, len) || len > MAX_RECORD_TEXT ) return 1;
+    string p(len, '\0');
+    if( !readAll(in, p.data(), len) ) return 1;
+    patterns.push_back(std::move(p));
+  }
+  try {
+    naming_set(patterns);
+  } catch( std::exception& e ){
+    std::cerr << "Worker: " << e.what() << std::endl;
+    return 1;
+  }
+
+  if( !read32(in, count) ) return 1;
+  vector<path> files;
+  for( uint32_t i = 0; i < count; i++ ){
+    uint32_t len;
+    if( !read32(in, len) || len > MAX_RECORD_TEXT ) return 1;
+    string p(len, '\0');
+    if( !readAll(in, p.data(), len) ) return 1;
+    files.emplace_back(std::move(p));
+  }
+
+  TRACE_SCOPE("scan_worker");
+  docgraph graph;
+  string buf;
+  for( size_t first = 0; first < files.size(); first += WORKER_BATCH ){
+    size_t last = std::min(files.size(), first + WORKER_BATCH);
+    size_t added = graph.size();
+    graph.add_files(vector<path>(files.begin() + first, files.begin() + last));
+    graph.parseDocuments();
+
+    // A file whose name didn't match has no document and is left for the coordinator
+    buf.clear();
+    for( size_t i = first; added < graph.size(); added++ ){
+      const document& doc = graph.getChild(added);
+      while( files[i] != doc.filepath() )
+        i++;
+      reflist refs = doc.getParsedReferences();
+      if( refs.size() > MAX_RECORD_REFS || refs.buffer().size() > MAX_RECORD_TEXT )
+        continue;
+      put32(buf, i);
+      buf += char((doc.isParsed() ? PARSED : 0) | (doc.contentHash() ? HASHED : 0));
+      put64(buf, doc.contentHash().value_or(0));
+      put32(buf, refs.size());
+      put32(buf, refs.buffer().size());
+      for( uint32_t end : refs.offsets() )
+        put32(buf, end);
+      buf += refs.buffer();
+    }
+    if( !writeAll(out, buf) ) return 1;
+  }
+
+  buf.clear();
+  put32(buf, END);
+  return writeAll(out, buf) ? 0 : 1;
+}
+
+// A worker process, and the files of the graph it was given
+struct scanworker {
+  string command;
+  pid_t pid = -1;
+  int fd = -1;
+  vector<dochandle> shard;
+  size_t received = 0;
+  bool ok = false;
+};
+
+// Start a command with a socket as its standard input and output
+static bool spawn(scanworker& w) {
+  int sv[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0 ){
+    std::cerr << "Unable to make a socket for worker \"" << w.command << "\": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  pid_t pid = fork();
+  if( pid < 0 ){
+    std::cerr << "Unable to start worker \"" << w.command << "\": " << strerror(errno) << std::endl;
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  if( pid == 0 ){
+    dup2(sv[1], STDIN_FILENO);
+    dup2(sv[1], STDOUT_FILENO);
+    execl("/bin/sh", "sh", "-c", w.command.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+
+  close(sv[1]);
+  w.pid = pid;
+  w.fd = sv[0];
+  return true;
+}
+
+/**
+ * @brief Send a worker its shard and merge what it sends back into the graph
+ *
+ * @param apply Called with the records, under a lock shared with the other workers
+ */
+static void serve(scanworker& w, std::mutex& mtx, const docgraph& graph, std::function<void(dochandle, uint8_t, uint64_t, reflist)> apply) {
+  string out(MAGIC, sizeof(MAGIC));
+  put32(out, naming_schemes().size());
+  for( const namingscheme& scheme : naming_schemes() ){
+    put32(out, scheme.pattern().size());
+    out += scheme.pattern();
+  }
+  put32(out, w.shard.size());
+  for( dochandle h : w.shard ){
+    const string& p = graph.get(h).filepath().native();
+    put32(out, p.size());
+    out += p;
+  }
+
+  char magic[sizeof(MAGIC)];
+  if( !writeAll(w.fd, out) || !readAll(w.fd, magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ){
+    std::cerr << "Worker \"" << w.command << "\" didn't answer as a worker" << std::endl;
+    return;
+  }
+
+  while( true ){
+    char head[4 + 1 + 8 + 4 + 4];
+    if( !readAll(w.fd, head, 4) ) break;
+    uint32_t idx = get32(head);
+    if( idx == END ){
+      w.ok = true;
+      break;
+    }
+    if( idx >= w.shard.size() || !readAll(w.fd, head + 4, sizeof(head) - 4) ) break;
+
+    uint8_t flags = head[4];
+    uint64_t hash = get64(head + 5);
+    uint32_t count = get32(head + 13), len = get32(head + 17);
+    if( count > MAX_RECORD_REFS || len > MAX_RECORD_TEXT ){
+      std::cerr << "Worker \"" << w.command << "\" sent a record of " << count << " references and " << len << " bytes, more than allowed" << std::endl;
+      break;
+    }
+
+    string ends_buf(size_t(count) * 4, '\0');
+    string text(len, '\0');
+    if( !readAll(w.fd, ends_buf.data(), ends_buf.size()) || !readAll(w.fd, text.data(), len) ) break;
+
+    vector<uint32_t> ends(count);
+    bool valid = true;
+    for( uint32_t i = 0; i < count; i++ ){
+      ends[i] = get32(ends_buf.data() + 4 * i);
+      valid &= ends[i] <= len && (i == 0 || ends[i] >= ends[i - 1]);
+    }
+    if( !valid ) break;
+
+    std::lock_guard lk(mtx);
+    apply(w.shard[idx], flags, hash, reflist(std::move(text), std::move(ends)));
+    w.received++;
+  }
+
+  if( !w.ok )
+    std::cerr << "Worker \"" << w.command << "\" stopped after " << w.received << " of " << w.shard.size() << " documents" << std::endl;
+}
+
+/**
+ * @brief Add every document under a directory, parsed by worker processes
+ *
+ * The files are split into one shard per worker by the XXH64 of their paths, so a file always
+ * goes to the same worker. Each worker is started with its command, run by /bin/sh with a
+ * socket as its standard input and output, and speaks the protocol in distscan.hpp. Documents
+ * of a worker that fails are left unparsed, for parseDocuments() to finish locally.
+ *
+ * @param dir The directory to scan, as scan_dir()
+ * @param commands The command starting each worker, such as scanworker_local_command(), or
+ *                 "ssh host docmng --worker" for a worker on another host
+ * @returns The number of documents parsed by the workers
+ */
+size_t docgraph::scan_distributed(const path& dir, const vector<string>& commands) {
+  TRACE_SCOPE("scan_distributed", dir.native());
+
+  const size_t first = docs.slots();
+  add_files(list_dir(dir), false);
+  if( commands.empty() ) return 0;
+
+  vector<scanworker> workers(commands.size());
+  for( size_t i = 0; i < commands.size(); i++ )
+    workers[i].command = commands[i];
+
+  for( size_t i = first; i < docs.slots(); i++ ){
+    const string& p = getChild(i).filepath().native();
+    xxh64 h;
+    h.update(p.data(), p.size());
+    workers[h.digest() % workers.size()].shard.push_back(handle(i));
+  }
+
+  std::mutex mtx;
+  size_t parsed = 0;
+  auto apply = [this, &parsed](dochandle h, uint8_t flags, uint64_t hash, reflist refs) {
+    document& doc = docs[h];
+    if( flags & HASHED )
+      doc.content_hash = hash;
+    if( flags & PARSED ){
+      doc.setParsedReferences(std::move(refs));
+      doc.parsed = true;
+      parsed++;
+    }
+  };
+
+  vector<std::thread> threads;
+  for( auto& w : workers ){
+    if( w.shard.empty() || !spawn(w) ) continue;
+    threads.emplace_back(serve, std::ref(w), std::ref(mtx), std::cref(*this), apply);
+  }
+  for( auto& t : threads )
+    t.join();
+
+  for( auto& w : workers ){
+    if( w.fd >= 0 ) close(w.fd);
+    if( w.pid < 0 ) continue;
+    int status;
+    while( waitpid(w.pid, &status, 0) < 0 && errno == EINTR )
+      ;
+    if( w.ok && !(WIFEXITED(status) && WEXITSTATUS(status) == 0) )
+      std::cerr << "Worker \"" << w.command << "\" exited abnormally" << std::endl;
+  }
+
+  return parsed;
+}
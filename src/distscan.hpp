@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * Distributed scanning: a coordinator splits a directory's files into shards by the hash of
+ * their paths, and worker processes parse a shard each and stream the references back.
+ *
+ * A worker talks to the coordinator over its standard input and output, so it can be a local
+ * process or one on another host, started over ssh or anything else that forwards a byte
+ * stream. Paths are sent as the coordinator sees them, so a remote host needs the documents
+ * mounted at the same place. Integers are little-endian on the wire.
+ *
+ * Both sides first send the 8 byte magic "DOCMNGW2". Then:
+ *
+ *   Coordinator to worker: u32 naming scheme count, then for each scheme a u32 length and the
+ *   pattern, see naming.hpp. Then u32 file count, and for each file a u32 length and the path.
+ *
+ *   Worker to coordinator, one record per file of the shard, in any order, leaving out any the
+ *   worker couldn't make a document of:
+ *     u32 index of the file in the shard
+ *     u8  flags: 1 if parsing was attempted, 2 if the file was hashed
+ *     u64 XXH64 of the file's contents
+ *     u32 number of references n, u32 length of their text t
+ *     n x u32 end of each reference in the text, then t bytes of text
+ *   and finally u32 0xFFFFFFFF.
+ *
+ * A record holds at most 2^20 references and 64 MiB of their text, and a path or pattern at most
+ * 64 MiB. A worker leaves out a file whose references don't fit, for the coordinator to parse.
+ */
+
+// Command that starts a local worker: this program with --worker
+string scanworker_local_command();
+
+// Serve one shard as a worker, over the given file descriptors. Returns the exit status.
+int scanworker_run(int in, int out);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/**
+ * @brief A 32 bit handle to a document in a docstore
+ *
+ * The low 24 bits are the document's slot and the high 8 bits the slot's generation when the
+ * handle was made. A slot's generation changes whenever its document is removed, so a handle
+ * kept after that no longer finds anything instead of finding whatever took the slot. Handles
+ * are plain values: copying one costs nothing, and edges made of them never keep a document
+ * alive.
+ */
+class dochandle {
+  uint32_t bits = UINT32_MAX;
+
+  public:
+    static constexpr unsigned INDEX_BITS = 24;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t MAX_INDEX = INDEX_MASK - 1; // All ones is the null handle
+
+    // The null handle, which refers to no document
+    constexpr dochandle() = default;
+
+    constexpr dochandle(uint32_t index, uint8_t generation)
+      : bits((uint32_t)generation << INDEX_BITS | (index & INDEX_MASK)) {}
+
+    constexpr uint32_t index() const {
+      return bits & INDEX_MASK;
+    }
+
+    constexpr uint8_t generation() const {
+      return bits >> INDEX_BITS;
+    }
+
+    constexpr uint32_t raw() const {
+      return bits;
+    }
+
+    constexpr explicit operator bool() const {
+      return bits != UINT32_MAX;
+    }
+
+    constexpr bool operator==(const dochandle& other) const { return bits == other.bits; }
+    constexpr bool operator!=(const dochandle& other) const { return bits != other.bits; }
+    constexpr bool operator<(const dochandle& other) const { return bits < other.bits; }
+};
+
+template<>
+struct std::hash<dochandle> {
+  size_t operator()(const dochandle& h) const noexcept {
+    return std::hash<uint32_t>()(h.raw());
+  }
+};
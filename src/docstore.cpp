@@ -0,0 +1,59 @@
+#include "docstore.hpp"
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Move a document into the store
+ *
+ * @throws length_error if the store already holds as many documents as a handle can address
+ * @returns The document's handle
+ */
+dochandle docstore::insert(document&& doc) {
+  size_t idx;
+  if( !free_slots.empty() ){
+    idx = free_slots.back();
+    free_slots.pop_back();
+  }else{
+    if( used > dochandle::MAX_INDEX )
+      throw std::length_error("Document store is full: " + std::to_string(used) + " documents");
+    if( used == slabs.size() * SLAB )
+      slabs.emplace_back(new slot[SLAB]);
+    idx = used++;
+  }
+
+  slot& s = at(idx);
+  s.doc.emplace(std::move(doc));
+  live++;
+  return dochandle(idx, s.generation);
+}
+
+void docstore::erase(dochandle h) {
+  if( !find(h) ) return;
+
+  slot& s = at(h.index());
+  s.doc.reset();
+  s.generation++;
+  free_slots.push_back(h.index());
+  live--;
+}
+
+void docstore::clear() {
+  for( size_t i = 0; i < used; i++ ){
+    slot& s = at(i);
+    if( s.doc ){
+      s.doc.reset();
+      s.generation++;
+    }
+  }
+  free_slots.clear();
+  used = 0;
+  live = 0;
+}
+
+document& docstore::operator[](dochandle h) {
+  document* doc = find(h);
+  if( !doc )
+    throw std::out_of_range("Stale document handle: slot " + std::to_string(h.index()) + ", generation " + std::to_string(h.generation()));
+  return *doc;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "dochandle.hpp"
+#include "document.hpp"
+
+using std::vector;
+
+/**
+ * @brief Owns documents in fixed-size slabs, handing out generational handles to them
+ *
+ * Documents live side by side in slabs of SLAB slots, and never move once added, so a
+ * reference to one stays good until it's removed. Slots are handed out in order, and a removed
+ * document's slot is reused by the next one added, under a new generation. Documents refer to
+ * each other by handle, so cycles between them are freed along with the store.
+ *
+ * Looking documents up from many threads at once is safe, as long as none are being added or
+ * removed at the time.
+ */
+class docstore {
+  struct slot {
+    std::optional<document> doc;
+    uint8_t generation = 0;
+  };
+
+  static constexpr size_t SLAB = 1024;
+
+  vector<std::unique_ptr<slot[]>> slabs;
+  vector<uint32_t> free_slots;
+  size_t used = 0; // Slots handed out so far
+  size_t live = 0; // Documents in the store
+
+  slot& at(size_t idx) {
+    return slabs[idx / SLAB][idx % SLAB];
+  }
+  const slot& at(size_t idx) const {
+    return slabs[idx / SLAB][idx % SLAB];
+  }
+
+  public:
+    template<bool Const>
+    class _iterator {
+      using Store = std::conditional_t<Const, const docstore, docstore>;
+      Store* store;
+      size_t idx;
+
+      void skip() {
+        while( idx < store->used && !store->at(idx).doc )
+          idx++;
+      }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = document;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const document&, document&>;
+        using pointer = std::conditional_t<Const, const document*, document*>;
+
+        _iterator(Store* store, size_t idx) : store(store), idx(idx) { skip(); }
+
+        reference operator*() const { return *store->at(idx).doc; }
+        pointer operator->() const { return &*store->at(idx).doc; }
+
+        // The handle of the document the iterator is on
+        dochandle handle() const { return store->handle(idx); }
+
+        _iterator& operator++() { idx++; skip(); return *this; }
+        _iterator operator++(int) { _iterator tmp = *this; ++*this; return tmp; }
+
+        bool operator==(const _iterator& other) const { return idx == other.idx; }
+        bool operator!=(const _iterator& other) const { return idx != other.idx; }
+    };
+
+    using iterator = _iterator<false>;
+    using const_iterator = _iterator<true>;
+
+    docstore() = default;
+    docstore(docstore&&) = default;
+    docstore& operator=(docstore&&) = default;
+    docstore(const docstore&) = delete;
+    docstore& operator=(const docstore&) = delete;
+
+    dochandle insert(document&&);
+
+    // Remove a document. Its handle, and every copy of it, no longer finds anything.
+    void erase(dochandle);
+
+    // Remove every document. Slots are handed out from the first one again.
+    void clear();
+
+    // The document a handle refers to, or null if it was removed
+    document* find(dochandle h) {
+      if( h.index() >= used ) return nullptr;
+      slot& s = at(h.index());
+      return s.doc && s.generation == h.generation() ? &*s.doc : nullptr;
+    }
+    const document* find(dochandle h) const {
+      return const_cast<docstore*>(this)->find(h);
+    }
+
+    bool contains(dochandle h) const {
+      return find(h) != nullptr;
+    }
+
+    // @throws out_of_range if the handle's document was removed
+    document& operator[](dochandle);
+    const document& operator[](dochandle h) const {
+      return (*const_cast<docstore*>(this))[h];
+    }
+
+    // The handle of the document in a slot, or the null handle if the slot is empty
+    dochandle handle(size_t idx) const {
+      if( idx >= used || !at(idx).doc ) return dochandle();
+      return dochandle(idx, at(idx).generation);
+    }
+
+    size_t size() const {
+      return live;
+    }
+
+    bool empty() const {
+      return live == 0;
+    }
+
+    // The number of slots handed out, one past the highest slot index in use
+    size_t slots() const {
+      return used;
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, used); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, used); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+};
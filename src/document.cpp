@@ -1,32 +1,33 @@
 #include "document.hpp"
+#include "graph.hpp"
 #include <algorithm>
 #include <bits/types/FILE.h>
 #include <cctype>
 #include <filesystem>
 #include <memory>
-#include <regex>
 #include <stdexcept>
 #include <string_view>
 
 /**
  * @brief Constructor for a document from a file and a list of possible references
  *
- * @throws invalid_argument given path is only valid if it's a regular file.
+ * @throws invalid_argument given path is only valid if it's a regular file whose name matches
+ *         one of the naming schemes, see naming_set().
  *
  * @author Gaultier Delbarre
  * @date 9/15/2022
  *
  * @param file The path to the requested file
- * @param references A vector of share_ptrs to documents that the document references.    
- */                                                                                       
-document::document(path file, vector<shared_ptr<document>> references)                 
+ * @param references Handles to the documents that the document references.
+ */
+document::document(path file, vector<dochandle> references)
   : references(references), file(file) {                                                  
   if( !std::filesystem::is_regular_file(file) )                                            
     throw std::invalid_argument("File path for document must be a regular file!: "+file.string());     
 
   if( !getFileNameInfo() ){
     std::cerr << "Given file name: " << file.filename() << std::endl;
-    throw std::invalid_argument("File name has invalid format. Valid format is: \"REGS-{subsystem number}-R{revision number}-{file name}\"");
+    throw std::invalid_argument("File name has invalid format. Valid format is: \"" + naming_schemes().front().pattern() + "\"");
   }
 
 }
@@ -37,16 +38,16 @@ document::document(path file, vector<shared_ptr<document>> references)
  * @author Gaultier Delbarre
  * @date 9/15/2022
  */
-void document::printInfo() const {
-      std::cout << "Document name: " << docname() << std::endl;
-      std::cout << "Subsystem: " << to_string(subsys) << std::endl;
-      std::cout << "Revision No.: " << revision << std::endl;
+void document::printInfo(const docgraph& graph) const {
+      std::cout << "Document name: " << docname() << '\n';
+      std::cout << "Subsystem: " << to_string(subsys) << '\n';
+      std::cout << "Revision No.: " << revision << '\n';
 
       std::cout << "References: ";
-      for( auto doc : references ){
-        std::cout << doc->filename() << ",";
+      for( auto& doc : references ){
+        std::cout << graph.get(doc).filename() << ",";
       }
-      std::cout << std::endl;
+      std::cout << '\n';
 }
 
 /**
@@ -58,54 +59,18 @@ void document::printInfo() const {
  * @returns True if the file has a valid name, false otherwise.
  */
 bool document::getFileNameInfo() {
-  const std::regex FINFO("REGS-(\\d+)-R(\\d+)-(.+)$");
-  std::smatch m;
-  string fname = file.filename();
-  
-  if( !std::regex_match(fname, m, FINFO ) ){
+  std::string_view fname = filenameView();
+  string why;
+  auto info = naming_match(fname, why);
+  if( !info ){
+    std::cerr << why << " for file \"" << fname << "\"" << std::endl;
     return false;
-  }else{
-    document_name = m[3];
-    int sys = std::stoi(m[1]);
-    if( sys > (int)SUBSYSTEMS::ATC ) {
-      std::cerr << "Invalid system number for file \""<< fname << "\": " << sys << std::endl;
-      return false;  
-    }
-    subsys = SUBSYSTEMS(sys);
-    revision = std::stoi(m[2]);
-    return true;
   }
-  
-}
-
-/**
- * @brief Add a reference to a document, if it's not already there.
- *
- * Removes the reference from unfound_references if it's there.
- * References are directional. The reference being added does not 
- * refer to *this.
- *
- * @author Gaultier Delbarre
- * @date 9/15/2022
- *
- * @returns True if the reference was added, or false. 
- */
-bool document::addReference(shared_ptr<document> doc) {
-  if( !hasReference(doc) ) {
-    references.push_back(doc);
-    string lower_docname = doc->docname();
-    std::transform(lower_docname.begin(), lower_docname.end(), lower_docname.begin(), ::tolower);
-    for(auto it = unfound_references.begin(); it != unfound_references.end(); ++it){
-      if( doc->docname() == *it ){
-        unfound_references.erase(it);
-        break;
-      }
 
-    }
-    
-    return true;
-  }
-  return false;
+  document_name = info->name;
+  subsys = info->subsys;
+  revision = info->revision;
+  return true;
 }
 
 /**
@@ -117,18 +82,11 @@ bool document::addReference(shared_ptr<document> doc) {
  * @author Gaultier Delbarre
  * @date 9/16/2022
  *
- * @param doc The document pointer to look for
+ * @param doc The handle of the document to look for
  * @returns True if the document is in the references
  */
-bool document::hasReference(shared_ptr<document> doc) const {
-  return hasReference(doc.get());
-}
-bool document::hasReference(const document* doc) const {
-  for( auto ref : references )
-    if( ref.get() == doc )
-      return true;
-
-  return false;
+bool document::hasReference(dochandle doc) const {
+  return std::find(references.begin(), references.end(), doc) != references.end();
 }
 
 /**
@@ -137,37 +95,41 @@ bool document::hasReference(const document* doc) const {
  * @author Gaultier Delbarre
  * @date 9/16/2022
  */
-bool document::hasUnfoundReference(string doc) const {
-  std::transform(doc.begin(), doc.end(), doc.begin(), [](char c){return std::tolower(c);});
-  for( auto ref : unfound_references )
-    if( ref == doc )
-      return true;
-
-  return false;
+bool document::hasUnfoundReference(std::string_view doc) const {
+  auto id = ref_find(doc);
+  return id && std::find(unfound_references.begin(), unfound_references.end(), *id) != unfound_references.end();
 }
 
 /**
- * @brief Parse the document and save to internal memory. Do nothing if extension/parser pair
- * unknown.
+ * @brief Parse the document and save to internal memory. Do nothing if no parser handles the
+ * document's format.
  *
  * @author Gaultier Delbarre
  * @date 9/28/2022
  */
 void document::parseReferences() {
-  string ext = file.extension();
-
-  DOCTYPE dtype = INVALID;
-
-  if( ext == ".docx" )
-    dtype = WORD_XML;
+  setParsedReferences(readReferences());
+  parsed = true;
+}
 
-  switch(dtype) {
-    case WORD_XML:
-      parsed_references = parseReferences<WORD_XML>();
-      break;
-    case INVALID:
-    default:
-      break;
+/**
+ * @brief Keep a document's parsed references
+ *
+ * When a spill file is enabled the references are written to it and only where they went is
+ * kept in memory.
+ */
+void document::setParsedReferences(reflist refs) {
+  if( spillstore* spill = spill_store() ){
+    spilled_references = spill->write(refs);
+    parsed_references = reflist();
+  }else{
+    spilled_references.reset();
+    parsed_references = std::move(refs);
   }
+}
 
+reflist document::getParsedReferences() const {
+  if( spilled_references )
+    return spill_store()->read(*spilled_references);
+  return parsed_references.clone();
 }
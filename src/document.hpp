@@ -1,13 +1,22 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <filesystem>
+#include <functional>
 #include <sys/types.h>
 #include <vector>
 #include <algorithm>
 #include <iostream>
 
+#include "dochandle.hpp"
+#include "naming.hpp"
+#include "reflist.hpp"
+#include "spill.hpp"
+#include "subsystems.hpp"
 
 using std::shared_ptr;
 using std::string;
@@ -17,40 +26,6 @@ using std::filesystem::path;
 // Declare graph here. 
 class docgraph;
 
-/**
- * @brief List of all subsystems in REGS
- *
- * @author Gaultier Delbarre
- * @date 9/15/2022
- */
-enum class SUBSYSTEMS {
-  SYSTEMS,
-  GOES,
-  QFH,
-  YAGI,
-  ADSB,
-  ATC
-};
-
-inline string to_string(SUBSYSTEMS sys) {
-  switch(sys) {
-    case SUBSYSTEMS::SYSTEMS:
-      return "Systems";
-    case SUBSYSTEMS::GOES:
-      return "GOES";
-    case SUBSYSTEMS::QFH:
-      return "QFH";
-    case SUBSYSTEMS::YAGI:
-      return "Yagi";
-    case SUBSYSTEMS::ADSB:
-      return "ADS-B";
-    case SUBSYSTEMS::ATC:
-      return "ATC";
-    default:
-      return "INVALID SUBSYSTEM";
-  }
-}
-
 /**
  * @brief Type of documents which can be parsed
  *
@@ -58,35 +33,56 @@ inline string to_string(SUBSYSTEMS sys) {
  * @date 9/15/2022
  */
 enum DOCTYPE { 
-  WORD_XML, ///< .docx documents
-  INVALID,  /// All unparseable documents
+  WORD_XML,          ///< .docx documents
+  EXCEL_XML,         ///< .xlsx workbooks
+  POWERPOINT_XML,    ///< .pptx presentations
+  OPENDOCUMENT_TEXT, ///< .odt documents
+  INVALID,           /// All unparseable documents
 };
 
+// Called with the text of each paragraph of a document as it's parsed
+using paragraphfn = std::function<void(std::string_view)>;
+
 class document {
-  vector<shared_ptr<document>> references;
-  vector<string> unfound_references;
-  vector<string> parsed_references;
+  vector<dochandle> references;
+  vector<refid> unfound_references;
+  reflist parsed_references;
+  std::optional<spillref> spilled_references; // Where parsed_references went, if spilled
   path file;
   SUBSYSTEMS subsys;
   unsigned revision;
   string document_name;
+  std::optional<uint64_t> content_hash;
+  bool parsed = false; // Whether parsing the references was attempted
 
   friend class docgraph;
+
+  // Keep the parsed references, in the spill file if there is one
+  void setParsedReferences(reflist);
+
+  // Used to restore documents from a graph snapshot, whose files may no longer exist
+  document(path file, SUBSYSTEMS subsys, unsigned revision, string name)
+    : file(file), subsys(subsys), revision(revision), document_name(name), visited(false) {}
+
+  // Used by the graph for files whose names it has already matched
+  document(path file, const namefields& fields)
+    : file(std::move(file)), subsys(fields.subsys), revision(fields.revision), document_name(fields.name), visited(false) {}
+
   public:
     
     // Used for DFS/BFS algorithms
     bool visited;
     
-    document(path, vector<shared_ptr<document>> = {});
+    document(path, vector<dochandle> = {});
 
-    document(const document&) = default;
+    document(const document&) = delete;
     document(document&&) = default;
-    document& operator=(const document&) = default;
+    document& operator=(const document&) = delete;
     document& operator=(document&&) = default;
 
     bool getFileNameInfo();
 
-    string docname() const {
+    const string& docname() const {
       return document_name;
     }
 
@@ -94,27 +90,63 @@ class document {
       return file.filename();
     }
 
-    template<DOCTYPE T>
-    vector<string> parseReferences() const;
+    // The file name, without copying it out of the path
+    std::string_view filenameView() const {
+      std::string_view p = file.native();
+      return p.substr(p.rfind('/') + 1);
+    }
+
+    const path& filepath() const {
+      return file;
+    }
+
+    SUBSYSTEMS subsystem() const {
+      return subsys;
+    }
+
+    unsigned getRevision() const {
+      return revision;
+    }
+
+    // XXH64 of the file's contents, if it was hashed when the directory was scanned
+    std::optional<uint64_t> contentHash() const {
+      return content_hash;
+    }
+
+    // Handles to the referenced documents, in the graph the document belongs to
+    const vector<dochandle>& getReferences() const {
+      return references;
+    }
+
+    // Lowercased names of the references with no document, see ref_name()
+    const vector<refid>& getUnfoundReferences() const {
+      return unfound_references;
+    }
+
+    // Parse the references with the parser registered for the document's format, passing the
+    // text of every paragraph to the callback if there is one
+    reflist readReferences(const paragraphfn& = {}) const;
+
+    // The references found in the document, as a copy in one buffer, read back if spilled
+    reflist getParsedReferences() const;
 
-    const vector<string>& getParsedReferences() const {
-      return parsed_references;
+    // Whether the references have been parsed, even if the document couldn't be read
+    bool isParsed() const {
+      return parsed;
     }
 
     void parseReferences();
 
-    void printInfo() const;
+    void printInfo(const docgraph&) const;
 
-    bool addReference(shared_ptr<document> doc);
-    void addReference(string ref){
-      std::transform(ref.begin(), ref.end(), ref.begin(), ::tolower);
-      unfound_references.push_back(ref);
+    // Resolved references are added through docgraph::addReference()
+    void addReference(std::string_view ref){
+      unfound_references.push_back(ref_intern(ref));
     }
 
-    bool hasReference(shared_ptr<document>) const;
-    bool hasReference(const document*) const;
+    bool hasReference(dochandle) const;
 
-    bool hasUnfoundReference(string) const;
+    bool hasUnfoundReference(std::string_view) const;
 
     bool operator==(const document& other) const {
       return other.docname() == docname() && other.revision == revision;
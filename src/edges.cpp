@@ -0,0 +1,211 @@
+#include "edges.hpp"
+#include "graph.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief Hand the edges added so far to the graph, to be merged by its next commit
+ *
+ * Never blocks: the edges are pushed onto the graph's list of pending batches with a
+ * compare-and-swap.
+ */
+void edgewriter::flush() {
+  if( buf.empty() ) return;
+  graph->pushEdges(std::move(buf));
+  buf = vector<docedge>();
+}
+
+void docgraph::pushEdges(vector<docedge>&& edges) {
+  edgebatch* batch = new edgebatch{std::move(edges), pending_edges.load(std::memory_order_relaxed)};
+  while( !pending_edges.compare_exchange_weak(batch->next, batch, std::memory_order_release, std::memory_order_relaxed) )
+    ;
+}
+
+docgraph::~docgraph() {
+  edgebatch* batch = pending_edges.exchange(nullptr, std::memory_order_acquire);
+  while( batch ){
+    edgebatch* next = batch->next;
+    delete batch;
+    batch = next;
+  }
+}
+
+/**
+ * @brief Merge the edges handed over by writers into the documents, and publish a new view
+ *
+ * The edges are sorted and deduplicated first, so the result doesn't depend on which thread
+ * found what. Edges already in the graph, and edges to or from documents which are no longer
+ * in it, are dropped. A reference that's resolved is taken off its document's unfound
+ * references.
+ *
+ * Writers may keep flushing while a commit runs; what they hand over late goes in the next
+ * epoch. Readers of earlier views are unaffected. Only one thread at a time may change the
+ * documents themselves, by committing or otherwise.
+ *
+ * @returns The number of references added
+ */
+size_t docgraph::commitEdges() {
+  TRACE_SCOPE("commit_edges");
+  std::lock_guard lk(commit_mtx);
+
+  vector<docedge> edges;
+  for( edgebatch* batch = pending_edges.exchange(nullptr, std::memory_order_acquire); batch; ){
+    edges.insert(edges.end(), batch->edges.begin(), batch->edges.end());
+    edgebatch* next = batch->next;
+    delete batch;
+    batch = next;
+  }
+
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  size_t added = 0;
+  for( auto [from, to] : edges ){
+    if( !docs.contains(from) || !docs.contains(to) ) continue;
+    added += addReference(from, to);
+  }
+
+  // Lay the references out by slot, for readers to share until the next commit
+  auto view = std::make_shared<edgeview>(++edge_epoch);
+  view->offsets.reserve(docs.slots() + 1);
+  for( size_t i = 0; i < docs.slots(); i++ ){
+    if( const document* doc = docs.find(docs.handle(i)) )
+      view->targets.insert(view->targets.end(), doc->references.begin(), doc->references.end());
+    view->offsets.push_back(view->targets.size());
+  }
+  published_edges.store(std::move(view), std::memory_order_release);
+
+  return added;
+}
+
+/**
+ * @brief Resolve every parsed reference which names exactly one document
+ *
+ * A reference matches a document if it's the document's file name, with or without its
+ * extension, ignoring case. References whose name is shared by more than one document, or that
+ * name the document they're in, are left to be resolved by hand. The documents are split
+ * between the threads, each with its own edgewriter, and the edges are committed at the end.
+ *
+ * @param threads The number of threads to use, or 0 for one per core
+ * @returns The number of references added
+ */
+size_t docgraph::resolveExact(unsigned threads) {
+  TRACE_SCOPE("resolve_exact");
+
+  // Every document by its name, without the extension. A name shared by several is ambiguous.
+  std::unordered_map<refid, dochandle> named;
+  for( auto it = docs.begin(); it != docs.end(); ++it ){
+    std::string_view name = it->filenameView();
+    name = name.substr(0, name.rfind('.'));
+    auto [pos, added] = named.emplace(ref_intern(name), it.handle());
+    if( !added )
+      pos->second = dochandle();
+  }
+
+  auto match = [&named](std::string_view ref) -> dochandle {
+    for( int pass = 0; pass < 2; pass++ ){
+      if( auto id = ref_find(ref) ){
+        auto it = named.find(*id);
+        if( it != named.end() )
+          return it->second;
+      }
+      size_t dot = ref.rfind('.');
+      if( dot == std::string_view::npos ) break;
+      ref = ref.substr(0, dot);
+    }
+    return dochandle();
+  };
+
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    edgewriter out(*this);
+    for( size_t i = next++; i < docs.slots(); i = next++ ){
+      dochandle from = docs.handle(i);
+      if( !from ) continue;
+      for( std::string_view ref : docs[from].getParsedReferences() ){
+        dochandle to = match(ref);
+        if( to && to != from )
+          out.link(from, to);
+      }
+    }
+  };
+
+  if( threads == 0 )
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, std::max<size_t>(docs.slots(), 1));
+
+  vector<std::thread> pool;
+  for( unsigned i = 1; i < threads; i++ )
+    pool.emplace_back(worker);
+  worker();
+  for( auto& t : pool )
+    t.join();
+
+  return commitEdges();
+}
+
+/**
+ * @brief Find the resolved references to a revision older than the latest of their document
+ *
+ * Documents with the same name are revisions of one document. The latest revision of each is
+ * found in one pass, then the documents' references in the published view are checked on many
+ * threads at once, each keeping what it finds to itself until the end.
+ *
+ * @param threads How many threads to check on, all cores if 0
+ * @returns The stale references, ordered by the referencing document
+ */
+vector<staleref> docgraph::staleReferences(unsigned threads) const {
+  TRACE_SCOPE("stale_references");
+  auto edges = view();
+  const size_t n = edges->size();
+
+  // The latest revision of each slot's document
+  vector<dochandle> latest(n);
+  std::unordered_map<std::string_view, dochandle> byname;
+  for( size_t i = 0; i < n; i++ ){
+    const document& doc = getChild(i);
+    auto [pos, added] = byname.emplace(doc.docname(), handle(i));
+    if( !added && docs[pos->second].getRevision() < doc.getRevision() )
+      pos->second = handle(i);
+  }
+  for( size_t i = 0; i < n; i++ )
+    latest[i] = byname.find(getChild(i).docname())->second;
+
+  std::atomic<size_t> next = 0;
+  std::mutex mtx;
+  vector<staleref> stale;
+  auto worker = [&]() {
+    vector<staleref> found;
+    for( size_t i = next++; i < n; i = next++ ){
+      for( dochandle to : edges->references(i) ){
+        dochandle newest = latest[to.index()];
+        if( docs[to].getRevision() < docs[newest].getRevision() )
+          found.push_back({handle(i), to, newest});
+      }
+    }
+    std::lock_guard lk(mtx);
+    stale.insert(stale.end(), found.begin(), found.end());
+  };
+
+  if( threads == 0 )
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, std::max<size_t>(n, 1));
+
+  vector<std::thread> pool;
+  for( unsigned i = 1; i < threads; i++ )
+    pool.emplace_back(worker);
+  worker();
+  for( auto& t : pool )
+    t.join();
+
+  std::sort(stale.begin(), stale.end(), [](const staleref& a, const staleref& b) {
+    return std::pair(a.from.index(), a.to.index()) < std::pair(b.from.index(), b.to.index());
+  });
+  return stale;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "dochandle.hpp"
+
+using std::vector;
+
+class docgraph;
+
+// A resolved reference, from a document to the one it refers to
+using docedge = std::pair<dochandle, dochandle>;
+
+// A resolved reference to a revision older than the latest one of the same document
+struct staleref {
+  dochandle from;   ///< The referencing document
+  dochandle to;     ///< The older revision it refers to
+  dochandle latest; ///< The latest revision of the document
+};
+
+/**
+ * @brief The resolved references of a graph as of one epoch, never changed once published
+ *
+ * The references of the document in slot i are targets[offsets[i]] to targets[offsets[i + 1]],
+ * in the order they were resolved in. A reader holding a view keeps seeing the same graph
+ * while edges are merged into the documents behind it.
+ */
+class edgeview {
+  uint64_t ep;
+  vector<uint32_t> offsets;
+  vector<dochandle> targets;
+
+  friend class docgraph;
+
+  public:
+    edgeview(uint64_t epoch) : ep(epoch), offsets{0} {}
+
+    // The number of commits made to the graph before this view was published
+    uint64_t epoch() const {
+      return ep;
+    }
+
+    // The number of document slots the view covers
+    size_t size() const {
+      return offsets.size() - 1;
+    }
+
+    // The total number of references
+    size_t edges() const {
+      return targets.size();
+    }
+
+    // The references of the document in a slot
+    std::span<const dochandle> references(size_t idx) const {
+      if( idx >= size() ) return {};
+      return std::span<const dochandle>(targets.data() + offsets[idx], offsets[idx + 1] - offsets[idx]);
+    }
+};
+
+/**
+ * @brief Collects resolved references on one thread, to be merged into a graph later
+ *
+ * Each thread resolving references uses its own writer, so adding an edge never touches shared
+ * state. flush() hands the edges to the graph without locking, and docgraph::commitEdges()
+ * merges everything handed over so far. Writers flush when destroyed.
+ */
+class edgewriter {
+  docgraph* graph;
+  vector<docedge> buf;
+
+  public:
+    explicit edgewriter(docgraph& graph) : graph(&graph) {}
+    ~edgewriter() { flush(); }
+
+    edgewriter(const edgewriter&) = delete;
+    edgewriter& operator=(const edgewriter&) = delete;
+
+    void link(dochandle from, dochandle to) {
+      buf.emplace_back(from, to);
+    }
+
+    // The edges added since the last flush
+    size_t pending() const {
+      return buf.size();
+    }
+
+    void flush();
+};
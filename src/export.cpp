@@ -0,0 +1,276 @@
+#include "export.hpp"
+#include "utils.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+bufwriter::bufwriter(const path& file) {
+  if( file == "-" ){
+    fd = STDOUT_FILENO;
+    owned = false;
+  }else{
+    fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    owned = true;
+    if( fd < 0 ){
+      std::cerr << "Unable to open " << file << " for writing: " << strerror(errno) << std::endl;
+      failed = true;
+    }
+  }
+}
+
+bufwriter::~bufwriter() {
+  flush();
+  if( owned && fd >= 0 )
+    close(fd);
+}
+
+bool bufwriter::flush() {
+  const char* p = buf;
+  while( used > 0 && !failed ){
+    ssize_t res = write(fd, p, used);
+    if( res < 0 && errno == EINTR ) continue;
+    if( res <= 0 ){
+      std::cerr << "Write failed: " << strerror(errno) << std::endl;
+      failed = true;
+      break;
+    }
+    p += res;
+    used -= res;
+  }
+  used = 0;
+  return !failed;
+}
+
+bufwriter& bufwriter::operator<<(std::string_view s) {
+  while( !s.empty() ){
+    if( used == BUFSIZE ) flush();
+    size_t n = std::min(s.size(), BUFSIZE - used);
+    memcpy(buf + used, s.data(), n);
+    used += n;
+    s.remove_prefix(n);
+  }
+  return *this;
+}
+
+bufwriter& bufwriter::operator<<(char c) {
+  if( used == BUFSIZE ) flush();
+  buf[used++] = c;
+  return *this;
+}
+
+bufwriter& bufwriter::operator<<(uint64_t n) {
+  char num[24];
+  auto res = std::to_chars(num, num + sizeof(num), n);
+  return *this << std::string_view(num, res.ptr - num);
+}
+
+/**
+ * @brief Write a string escaped for XML text and attribute values
+ */
+static void xml_string(bufwriter& out, std::string_view s) {
+  for( char c : s ){
+    switch( c ){
+      case '&': out << "&amp;"; break;
+      case '<': out << "&lt;"; break;
+      case '>': out << "&gt;"; break;
+      case '"': out << "&quot;"; break;
+      case '\'': out << "&apos;"; break;
+      default: out << c;
+    }
+  }
+}
+
+/**
+ * @brief Write a string escaped for use inside a quoted DOT ID
+ */
+static void dot_escape(bufwriter& out, std::string_view s) {
+  for( char c : s ){
+    if( c == '"' || c == '\\' ) out << '\\';
+    if( c == '\n' ) out << "\\n";
+    else out << c;
+  }
+}
+
+/**
+ * @brief Write a string as a quoted DOT ID
+ */
+static void dot_string(bufwriter& out, std::string_view s) {
+  out << '"';
+  dot_escape(out, s);
+  out << '"';
+}
+
+static void export_json(const docgraph& graph, bufwriter& out) {
+  string tmp;
+  auto json_string = [&](std::string_view s) {
+    tmp.clear();
+    append_json_string(tmp, s);
+    out << tmp;
+  };
+
+  out << "{\"documents\":[";
+  for( size_t i = 0; i < graph.size(); i++ ){
+    const document& doc = graph.getChild(i);
+    if( i ) out << ',';
+
+    out << "\n{\"id\":" << uint64_t(i) << ",\"file\":";
+    json_string(doc.filepath().string());
+    out << ",\"name\":";
+    json_string(doc.docname());
+    out << ",\"subsystem\":";
+    json_string(to_string(doc.subsystem()));
+    out << ",\"subsystem_number\":" << uint64_t(doc.subsystem());
+    out << ",\"revision\":" << uint64_t(doc.getRevision());
+
+    out << ",\"references\":[";
+    bool first = true;
+    for( auto& ref : doc.getReferences() ){
+      if( !first ) out << ',';
+      out << uint64_t(graph.indexOf(ref));
+      first = false;
+    }
+
+    out << "],\"unfound_references\":[";
+    first = true;
+    for( auto& ref : doc.getUnfoundReferences() ){
+      if( !first ) out << ',';
+      json_string(ref_name(ref));
+      first = false;
+    }
+    out << "]}";
+  }
+  out << "\n]}\n";
+}
+
+static void export_graphml(const docgraph& graph, bufwriter& out) {
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+         "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+         "<key id=\"file\" for=\"node\" attr.name=\"file\" attr.type=\"string\"/>\n"
+         "<key id=\"name\" for=\"node\" attr.name=\"name\" attr.type=\"string\"/>\n"
+         "<key id=\"subsystem\" for=\"node\" attr.name=\"subsystem\" attr.type=\"string\"/>\n"
+         "<key id=\"revision\" for=\"node\" attr.name=\"revision\" attr.type=\"int\"/>\n"
+         "<key id=\"unfound\" for=\"node\" attr.name=\"unfound_references\" attr.type=\"string\"/>\n"
+         "<graph id=\"docgraph\" edgedefault=\"directed\">\n";
+
+  for( size_t i = 0; i < graph.size(); i++ ){
+    const document& doc = graph.getChild(i);
+    out << "<node id=\"n" << uint64_t(i) << "\">";
+    out << "<data key=\"file\">";
+    xml_string(out, doc.filepath().string());
+    out << "</data><data key=\"name\">";
+    xml_string(out, doc.docname());
+    out << "</data><data key=\"subsystem\">";
+    xml_string(out, to_string(doc.subsystem()));
+    out << "</data><data key=\"revision\">" << uint64_t(doc.getRevision()) << "</data>";
+
+    // GraphML has no list type, unfound references are kept one per line
+    if( !doc.getUnfoundReferences().empty() ){
+      out << "<data key=\"unfound\">";
+      bool first = true;
+      for( auto& ref : doc.getUnfoundReferences() ){
+        if( !first ) out << "&#10;";
+        xml_string(out, ref_name(ref));
+        first = false;
+      }
+      out << "</data>";
+    }
+    out << "</node>\n";
+  }
+
+  for( size_t i = 0; i < graph.size(); i++ ){
+    for( auto& ref : graph.getChild(i).getReferences() )
+      out << "<edge source=\"n" << uint64_t(i) << "\" target=\"n" << uint64_t(graph.indexOf(ref)) << "\"/>\n";
+  }
+
+  out << "</graph>\n</graphml>\n";
+}
+
+static void export_dot(const docgraph& graph, bufwriter& out) {
+  out << "digraph docgraph {\n  node [shape=box];\n";
+
+  // One cluster per subsystem
+  for( size_t sys = 0; sys < SUBSYSTEM_COUNT; sys++ ){
+    bool open = false;
+    for( size_t i = 0; i < graph.size(); i++ ){
+      const document& doc = graph.getChild(i);
+      if( (size_t)doc.subsystem() != sys ) continue;
+
+      if( !open ){
+        out << "  subgraph cluster_" << uint64_t(sys) << " {\n    label=";
+        dot_string(out, to_string(SUBSYSTEMS(sys)));
+        out << ";\n";
+        open = true;
+      }
+
+      out << "    n" << uint64_t(i) << " [label=\"";
+      dot_escape(out, doc.docname());
+      out << "\\nR" << uint64_t(doc.getRevision()) << "\", revision=" << uint64_t(doc.getRevision()) << ", file=";
+      dot_string(out, doc.filepath().string());
+      out << "];\n";
+    }
+    if( open ) out << "  }\n";
+  }
+
+  // Unfound references are dashed nodes of their own
+  uint64_t unfound = 0;
+  for( size_t i = 0; i < graph.size(); i++ ){
+    const document& doc = graph.getChild(i);
+    for( auto& ref : doc.getReferences() )
+      out << "  n" << uint64_t(i) << " -> n" << uint64_t(graph.indexOf(ref)) << ";\n";
+
+    for( auto& ref : doc.getUnfoundReferences() ){
+      out << "  u" << unfound << " [label=";
+      dot_string(out, ref_name(ref));
+      out << ", style=dashed];\n";
+      out << "  n" << uint64_t(i) << " -> u" << unfound << " [style=dashed];\n";
+      unfound++;
+    }
+  }
+
+  out << "}\n";
+}
+
+/**
+ * @brief Get an export format from its name
+ *
+ * @returns Nothing if the name isn't a known format
+ */
+std::optional<exportformat> exportformat_from_string(std::string_view name) {
+  if( name == "json" ) return exportformat::JSON;
+  if( name == "graphml" ) return exportformat::GRAPHML;
+  if( name == "dot" ) return exportformat::DOT;
+  return std::nullopt;
+}
+
+/**
+ * @brief Export the graph with its subsystems, revisions and unfound references
+ *
+ * The output is streamed through a buffered writer, so it is never built up in memory.
+ *
+ * @param graph The graph to export
+ * @param fmt The format to write
+ * @param file The file to write to, or "-" for stdout
+ * @returns True if the whole export was written
+ */
+bool export_graph(const docgraph& graph, exportformat fmt, const path& file) {
+  bufwriter out(file);
+  if( !out.ok() ) return false;
+
+  switch( fmt ){
+    case exportformat::JSON:
+      export_json(graph, out);
+      break;
+    case exportformat::GRAPHML:
+      export_graphml(graph, out);
+      break;
+    case exportformat::DOT:
+      export_dot(graph, out);
+      break;
+  }
+
+  return out.flush();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "graph.hpp"
+
+using std::filesystem::path;
+using std::string;
+
+/**
+ * @brief A buffered writer to a file or stdout
+ *
+ * Output is collected in a fixed size buffer and written out whenever it fills up, so nothing
+ * but the buffer is ever held in memory and there is no flush per line.
+ */
+class bufwriter {
+  static constexpr size_t BUFSIZE = 1 << 16;
+
+  int fd;
+  bool owned;
+  bool failed = false;
+  size_t used = 0;
+  char buf[BUFSIZE];
+
+  public:
+    // Write to a file, or to stdout if the path is "-"
+    explicit bufwriter(const path&);
+    ~bufwriter();
+
+    bufwriter(const bufwriter&) = delete;
+    bufwriter& operator=(const bufwriter&) = delete;
+
+    bufwriter& operator<<(std::string_view);
+    bufwriter& operator<<(char);
+    bufwriter& operator<<(uint64_t);
+
+    // Write out the buffer. Returns false if any write has failed.
+    bool flush();
+
+    bool ok() const {
+      return !failed;
+    }
+};
+
+/**
+ * @brief Formats the graph can be exported to
+ */
+enum class exportformat {
+  JSON,    ///< One object per document
+  GRAPHML, ///< GraphML, readable by most graph tools
+  DOT,     ///< Graphviz DOT, clustered by subsystem
+};
+
+// Get an export format from its name: "json", "graphml" or "dot"
+std::optional<exportformat> exportformat_from_string(std::string_view);
+
+// Write the graph to a file ("-" for stdout) in the given format
+bool export_graph(const docgraph&, exportformat, const path&);
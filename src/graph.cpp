@@ -1,22 +1,271 @@
 #include "graph.hpp"
 #include "document.hpp"
+#include "trace.hpp"
+#include "textindex.hpp"
+#include "parsers.hpp"
+#include "hash.hpp"
+#include <atomic>
 #include <functional>
+#include <map>
+#include <thread>
+#include <unordered_map>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
 #include <algorithm>
 
+/**
+ * @brief Add every document under a directory to the graph
+ *
+ * Each new document's contents are hashed, on a few threads at once, so that identical copies
+ * are only parsed once. See duplicates().
+ *
+ * @param dir The directory to scan recursively. Hidden files are skipped.
+ */
 void docgraph::scan_dir(path dir) {
+  TRACE_SCOPE("scan_dir", dir.native());
+  add_files(list_dir(dir));
+}
+
+/**
+ * @brief List the files under a directory that scan_dir() would add, in directory order
+ *
+ * @param dir The directory to list recursively. Hidden files are skipped.
+ */
+vector<path> docgraph::list_dir(const path& dir) {
+  vector<path> files;
   for(const std::filesystem::directory_entry &ent : std::filesystem::recursive_directory_iterator(dir) ){
     if( ent.is_regular_file() ){
       path p = ent.path();
       // Dont allow hidden files. 
       if( p.filename().string()[0] == '.' ) continue;
-      docs.push_back(shared_ptr<document>(new document(p)));
+      files.push_back(std::move(p));
+    }
+  }
+  return files;
+}
+
+/**
+ * @brief Add documents to the graph
+ *
+ * The file names are matched against the naming schemes, and the matching files hashed, on a
+ * few threads at once. Files whose names don't match are left out and kept as diagnostics
+ * instead of stopping the scan, see nameDiagnostics().
+ *
+ * @param files The documents' files
+ * @param hash Whether to hash the new documents' contents
+ */
+void docgraph::add_files(const vector<path>& files, bool hash) {
+  struct matched {
+    std::optional<namefields> fields;
+    std::optional<uint64_t> hash;
+    string why;
+  };
+  vector<matched> results(files.size());
+
+  std::atomic<size_t> next = 0;
+  auto matcher = [&]() {
+    for( size_t i = next++; i < files.size(); i = next++ ){
+      std::string_view p = files[i].native();
+      matched& r = results[i];
+      r.fields = naming_match(p.substr(p.rfind('/') + 1), r.why);
+      if( !r.fields || !hash ) continue;
+      r.hash = hash_file(files[i]);
+      if( r.hash ){
+        [[maybe_unused]] std::error_code ec;
+        STATS_ADD(BYTES_HASHED, std::filesystem::file_size(files[i], ec));
+      }
+    }
+  };
+
+  const size_t count = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()), 8, files.size()});
+  vector<std::thread> threads;
+  for( size_t i = 1; i < count; i++ )
+    threads.emplace_back(matcher);
+  if( count > 0 )
+    matcher();
+  for( auto& t : threads )
+    t.join();
+
+  // Inserted in order, so the documents keep the order of their files
+  for( size_t i = 0; i < files.size(); i++ ){
+    if( !results[i].fields ){
+      diagnostics.push_back({files[i], std::move(results[i].why)});
+      continue;
     }
+    document doc(files[i], *results[i].fields);
+    doc.content_hash = results[i].hash;
+    docs.insert(std::move(doc));
   }
 
+  commitEdges();
+}
+
+/**
+ * @brief Move the documents down over the gaps removed ones left in the store
+ *
+ * The documents keep their order, and their references are moved to the new handles. Every
+ * other handle into the graph stops finding anything.
+ *
+ * @returns The new handle of each document, by the slot it was in. Null for empty slots.
+ */
+vector<dochandle> docgraph::compact() {
+  vector<dochandle> old;
+  vector<document> moved;
+  old.reserve(docs.size());
+  moved.reserve(docs.size());
+  for( auto it = docs.begin(); it != docs.end(); ++it ){
+    old.push_back(it.handle());
+    moved.push_back(std::move(*it));
+  }
+
+  // The review goes on from the first document left at or after the one it was on
+  review.first = std::lower_bound(old.begin(), old.end(), review.first, [](dochandle h, size_t idx) {
+    return h.index() < idx;
+  }) - old.begin();
+
+  vector<dochandle> remap(docs.slots());
+  docs.clear();
+  for( size_t i = 0; i < moved.size(); i++ )
+    remap[old[i].index()] = docs.insert(std::move(moved[i]));
+
+  for( auto& doc : docs )
+    for( dochandle& ref : doc.references )
+      ref = remap[ref.index()];
+  return remap;
+}
+
+/**
+ * @brief Bring a graph loaded from a snapshot up to date with its directory
+ *
+ * Files the snapshot doesn't have are added, and documents whose file is gone are removed
+ * along with the references to them. Documents whose contents no longer have the hash they
+ * were parsed with lose their references and are marked unparsed for parseDocuments() to pick
+ * up again, and the review goes back to the first of them. The files are hashed on a few
+ * threads at once.
+ *
+ * Handles into the graph from before stop finding anything if a document was removed.
+ *
+ * @param dir The directory the graph was scanned from
+ * @returns The number of documents added, removed or marked unparsed
+ */
+size_t docgraph::refresh(const path& dir) {
+  TRACE_SCOPE("refresh", dir.native());
+
+  std::unordered_map<string, dochandle> known;
+  for( auto it = docs.begin(); it != docs.end(); ++it )
+    known.emplace(it->file.native(), it.handle());
+
+  vector<path> added;
+  vector<dochandle> existing;
+  for( path& p : list_dir(dir) ){
+    auto it = known.find(p.native());
+    if( it == known.end() ){
+      added.push_back(std::move(p));
+    }else{
+      existing.push_back(it->second);
+      known.erase(it);
+    }
+  }
+
+  // What's left in known has no file anymore
+  for( auto& [p, h] : known )
+    docs.erase(h);
+  if( !known.empty() )
+    for( auto& doc : docs )
+      std::erase_if(doc.references, [this](dochandle ref) { return !docs.contains(ref); });
+
+  vector<std::optional<uint64_t>> hashes(existing.size());
+  std::atomic<size_t> next = 0;
+  auto hasher = [&]() {
+    for( size_t i = next++; i < existing.size(); i = next++ )
+      hashes[i] = hash_file(docs[existing[i]].file);
+  };
+
+  const size_t count = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()), 8, existing.size()});
+  vector<std::thread> threads;
+  for( size_t i = 1; i < count; i++ )
+    threads.emplace_back(hasher);
+  if( count > 0 )
+    hasher();
+  for( auto& t : threads )
+    t.join();
+
+  // A changed document's references are found again, so the ones resolved from the old
+  // contents go, and it's reviewed again
+  vector<dochandle> changed;
+  for( size_t i = 0; i < existing.size(); i++ ){
+    document& doc = docs[existing[i]];
+    if( doc.content_hash == hashes[i] ) continue;
+    doc.content_hash = hashes[i];
+    if( !doc.parsed ) continue;
+    doc.parsed = false;
+    doc.parsed_references = reflist();
+    doc.spilled_references.reset();
+    doc.references.clear();
+    doc.unfound_references.clear();
+    changed.push_back(existing[i]);
+  }
+
+  if( !known.empty() ){
+    vector<dochandle> remap = compact();
+    for( dochandle& h : changed )
+      h = remap[h.index()];
+  }
+  for( dochandle h : changed )
+    review = std::min(review, std::pair<size_t, size_t>(h.index(), 0));
+
+  const size_t before = docs.size();
+  add_files(added);
+  if( !known.empty() || !changed.empty() )
+    commitEdges();
+  return known.size() + changed.size() + docs.size() - before;
+}
+
+/**
+ * @brief Group documents by a key, keeping the groups with more than one document
+ */
+template<typename Key, typename Fn>
+static vector<vector<dochandle>> groupDocs(const docstore& docs, Fn key) {
+  std::map<Key, vector<dochandle>> groups;
+  for( auto it = docs.begin(); it != docs.end(); ++it )
+    if( std::optional<Key> k = key(*it) )
+      groups[*k].push_back(it.handle());
+
+  vector<vector<dochandle>> ret;
+  for( auto& [k, group] : groups ){
+    if( group.size() < 2 ) continue;
+    std::sort(group.begin(), group.end(), [&docs](dochandle a, dochandle b) { return docs[a].filepath().native() < docs[b].filepath().native(); });
+    ret.push_back(std::move(group));
+  }
+  return ret;
+}
+
+/**
+ * @brief Find the documents which are byte-identical copies of each other
+ *
+ * @returns Each group of identical documents, sorted by path. Documents which couldn't be hashed
+ *          are never duplicates.
+ */
+vector<vector<dochandle>> docgraph::duplicates() const {
+  return groupDocs<uint64_t>(docs, [](const document& doc) { return doc.content_hash; });
+}
+
+/**
+ * @brief Find the copies of a document which have drifted apart
+ *
+ * @returns Each group of documents which share a file name but not their contents, sorted by
+ *          path. Identical copies within a group are all listed.
+ */
+vector<vector<dochandle>> docgraph::drifted() const {
+  vector<vector<dochandle>> ret;
+  for( auto& group : groupDocs<string>(docs, [](const document& doc) { return std::optional<string>(doc.filename()); }) ){
+    auto differs = [&](dochandle doc) { return docs[doc].contentHash() != docs[group.front()].contentHash(); };
+    if( std::any_of(group.begin(), group.end(), differs) )
+      ret.push_back(std::move(group));
+  }
+  return ret;
 }
 
 /**
@@ -25,36 +274,174 @@ void docgraph::scan_dir(path dir) {
  * @author Gaultier Delbarre
  * @date 9/15/2022
  *
+ * File names are matched in place and only the matching documents are collected, so scoring
+ * a large corpus doesn't copy names.
+ *
  * @param docname Part or all of the name of the document
  * @param minmatch The minimum number of matched letters to be returned
- * @returns All documents which have that name, in sorted order from best match to worst match
+ * @returns All documents which have that name, in sorted order from best match to worst match.
+ *          Equally good matches keep the graph's order.
  */
-vector<shared_ptr<document>> docgraph::getDoc(string docname, decltype(string::npos) minmatch) {
-  using Tsort = std::pair<shared_ptr<document>, int>;
+vector<dochandle> docgraph::getDoc(std::string_view docname, decltype(string::npos) minmatch) const {
+  using Tsort = std::pair<size_t, int>;
   vector<Tsort> sorted;
 
-  for(auto doc : docs ){
-    string name = doc->filename();
-    int pos = substr_in(name, docname, minmatch).value_or(0);
-    sorted.push_back(std::make_pair(doc, pos));
+  TRACE_SCOPE("resolve_reference", docname);
+  STATS_ADD(GETDOC_CANDIDATES, docs.size());
+
+  for( size_t i = 0; i < docs.slots(); i++ ){
+    int pos = substr_in(getChild(i).filenameView(), docname, minmatch).value_or(0);
+    if( pos != 0 )
+      sorted.push_back(std::make_pair(i, pos));
   }
   
-  sort(sorted.begin(), sorted.end(),
+  std::stable_sort(sorted.begin(), sorted.end(),
       [](const Tsort &a, const Tsort &b)->bool{return a.second > b.second; });
-  
-  auto it = std::partition(sorted.begin(), sorted.end(), [](const Tsort &doc){return doc.second != 0; });
-  sorted.erase(it, sorted.end());
 
-  vector<shared_ptr<document>> ret;
+  vector<dochandle> ret;
+  ret.reserve(sorted.size());
   for( Tsort& doc : sorted ){
-    ret.push_back(doc.first);
+    ret.push_back(handle(doc.first));
   } 
 
   return ret;
 }
 
-const shared_ptr<document> docgraph::getChild(size_t c) const {
-  return docs.at(c);
+/**
+ * @brief Parse the references of every document, keeping many archive reads in flight
+ *
+ * Each document is parsed by the parser registered for its format. Only the parts of each
+ * archive needed for parsing are read, all formats in the same pass, and parsing happens as the
+ * reads complete. Documents which can't be parsed are skipped. Identical copies of a document
+ * are only read and parsed once, and share the result.
+ *
+ * Documents parsed before, such as the ones in a checkpoint of an interrupted parse, are left
+ * as they are, so calling this again resumes where a stopped parse left off.
+ *
+ * @param progress Called with the number of documents done after each document, counting the
+ *                 ones parsed before
+ * @param depth The maximum number of documents read at once
+ * @param text If set, the text of every parsed document is added to it
+ * @param stop Once requested, the documents being read are finished and the rest are left
+ */
+void docgraph::parseDocuments(std::function<void(size_t)> progress, unsigned depth, textindexbuilder* text, std::stop_token stop) {
+  TRACE_SCOPE("parse_documents");
+
+  vector<document*> parseable;
+  vector<vector<document*>> copies;
+  vector<const docparser*> parsers;
+  vector<path> files;
+  vector<string> entries;
+  std::unordered_map<uint64_t, size_t> by_hash;
+  size_t count = parsedCount();
+
+  for( document& d : docs ){
+    document* doc = &d;
+    if( doc->parsed ) continue;
+
+    if( const docparser* parser = find_parser(doc->file) ){
+      if( doc->content_hash ){
+        auto [it, added] = by_hash.emplace(*doc->content_hash, parseable.size());
+        if( !added ){
+          copies[it->second].push_back(doc);
+          STATS_ADD(DUPLICATES_SKIPPED, 1);
+          continue;
+        }
+      }
+      parseable.push_back(doc);
+      copies.emplace_back();
+      parsers.push_back(parser);
+      files.push_back(doc->file);
+      entries.push_back(parser->entry);
+    }else{
+      doc->parsed = true;
+      if( progress )
+        progress(++count);
+    }
+  }
+
+  read_zip_entries(files, entries, [&](size_t idx, std::optional<string> contents) {
+    document* doc = parseable[idx];
+    const docparser* parser = parsers[idx];
+    if( contents && text ){
+      // The copies have the same text, so it's kept to index them too
+      vector<string> paragraphs;
+      text->beginDocument(doc->file);
+      doc->setParsedReferences(parser->parse(doc->file, *contents, [&](std::string_view p) {
+        text->addParagraph(p);
+        if( !copies[idx].empty() )
+          paragraphs.emplace_back(p);
+      }));
+      text->endDocument();
+
+      for( auto& copy : copies[idx] ){
+        text->beginDocument(copy->file);
+        for( auto& p : paragraphs )
+          text->addParagraph(p);
+        text->endDocument();
+      }
+    }else if( contents )
+      doc->setParsedReferences(parser->parse(doc->file, *contents, {}));
+    else
+      std::cerr << "Unable to unzip " << parser->name << " file " << doc->filename() << std::endl;
+
+    doc->parsed = true;
+    for( auto& copy : copies[idx] ){
+      copy->parsed_references = doc->parsed_references.clone();
+      copy->spilled_references = doc->spilled_references;
+      copy->parsed = true;
+    }
+
+    if( progress ){
+      count += copies[idx].size();
+      progress(++count);
+    }
+  }, depth, stop);
+}
+
+size_t docgraph::parsedCount() const {
+  return std::count_if(docs.begin(), docs.end(), [](const document& doc) { return doc.parsed; });
+}
+
+document& docgraph::getChild(size_t c) {
+  return docs[handle(c)];
+}
+
+const document& docgraph::getChild(size_t c) const {
+  return docs[handle(c)];
+}
+
+dochandle docgraph::handle(size_t c) const {
+  dochandle h = docs.handle(c);
+  if( !h )
+    throw std::out_of_range("No document at position " + std::to_string(c) + " of the graph");
+  return h;
+}
+
+/**
+ * @brief Add a reference from one document to another, if it's not already there
+ *
+ * Removes the reference from the document's unfound references if it's there.
+ * References are directional. The document being referenced does not refer back. The
+ * document is changed right away, and view() shows the reference after the next commitEdges().
+ *
+ * @param from The document with the reference
+ * @param to The document it refers to
+ * @returns True if the reference was added, or false.
+ */
+bool docgraph::addReference(dochandle from, dochandle to) {
+  document& doc = docs[from];
+  const document& target = docs[to];
+  if( doc.hasReference(to) )
+    return false;
+
+  doc.references.push_back(to);
+  if( auto id = ref_find(target.docname()) ){
+    auto it = std::find(doc.unfound_references.begin(), doc.unfound_references.end(), *id);
+    if( it != doc.unfound_references.end() )
+      doc.unfound_references.erase(it);
+  }
+  return true;
 }
 
 
@@ -62,19 +449,14 @@ const shared_ptr<document> docgraph::getChild(size_t c) const {
  * @brief Parse All Document's References And Connect Those References
  */
 void docgraph::parseAndConnect() {
-  for( auto doc : docs ){
-    auto ext = doc->file.extension();
-    vector<string> refs;
-    if( ext == ".docx" )
-      refs = doc->parseReferences<WORD_XML>();
-    else
-      std::cerr << "Error: " << doc->filename() << " is not a parseable document" << std::endl; 
-    std::cout << doc->filename() << std::endl;
-    for( auto ref : refs ) {
+  for( auto& doc : docs ){
+    reflist refs = doc.readReferences();
+    std::cout << doc.filename() << std::endl;
+    for( std::string_view ref : refs ) {
       std::cout << '\t' << ref << std::endl; 
       auto poss = getDoc(ref, 5);
       for( auto r : poss ){
-        std::cout << "\t\tMaybe: " << r->docname() << std::endl;
+        std::cout << "\t\tMaybe: " << get(r).docname() << std::endl;
       }
     }
   }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <filesystem>
 #include <iterator>
 #include <memory>
@@ -10,19 +11,52 @@
 #include <stack>
 #include <iterator>
 #include <type_traits>
-#include <set>
+#include <stop_token>
+#include <atomic>
+#include <mutex>
 
 #include "document.hpp"
+#include "docstore.hpp"
+#include "edges.hpp"
 #include "utils.hpp"
+#include "stats.hpp"
 
 using std::filesystem::path;
 using std::string;
 
+class textindexbuilder;
+
 class docgraph {
   private:
     friend class document;
 
-    vector<shared_ptr<document>> docs; 
+    // The graph only ever adds documents, or replaces all of them, so a document's slot in the
+    // store is also its position in the graph
+    docstore docs;
+
+    // Files left out of the graph because their names match no naming scheme
+    vector<namediagnostic> diagnostics;
+
+    // Where the reference resolver got to: a document, and a reference of it
+    std::pair<size_t, size_t> review = {0, 0};
+
+    // Edges flushed by writers, waiting for the next commit
+    struct edgebatch {
+      vector<docedge> edges;
+      edgebatch* next;
+    };
+    std::atomic<edgebatch*> pending_edges = nullptr;
+    std::atomic<std::shared_ptr<const edgeview>> published_edges = std::make_shared<const edgeview>(0);
+    uint64_t edge_epoch = 0;
+    std::mutex commit_mtx;
+
+    friend class edgewriter;
+    void pushEdges(vector<docedge>&&);
+
+    // Close the gaps removed documents left in the store, so slots are positions again.
+    // Returns the new handle of every document by its old slot.
+    vector<dochandle> compact();
+
     enum iter_type {
       DFS, BFS
     };
@@ -31,111 +65,86 @@ class docgraph {
     class _iterator {
       public:
       using iterator_category = std::forward_iterator_tag;
-      using value_type = shared_ptr<document>;
-      using Container = std::conditional_t<TYPE == BFS, std::queue<value_type>, std::stack<value_type>>;
+      using value_type = dochandle;
+      using Container = std::conditional_t<TYPE == BFS, std::queue<dochandle>, std::stack<dochandle>>;
+      using Store = std::conditional_t<Const, const docstore, docstore>;
       using reference = std::conditional_t<Const, const document&, document&>;
-      using pointer = std::conditional_t<Const, const value_type, value_type>;
+      using pointer = std::conditional_t<Const, const document*, document*>;
       private:
-      std::set<value_type> visited;
+      Store* store;
+      vector<bool> visited; // By slot
       Container cont;
-      shared_ptr<document> cur;
+      dochandle cur;
 
       template<bool isBFS = (TYPE == BFS)>
-      std::enable_if_t<isBFS, value_type>
+      std::enable_if_t<isBFS, dochandle>
       pop() {
-        value_type tmp = cont.front();
+        dochandle tmp = cont.front();
         cont.pop();
         return tmp;
       }
 
       template<bool isBFS = (TYPE == BFS)>
-      std::enable_if_t<!isBFS, value_type>
+      std::enable_if_t<!isBFS, dochandle>
       pop() {
-        value_type tmp = cont.top();
+        dochandle tmp = cont.top();
         cont.pop();
         return tmp;
       }
 
-      public:
-
-      explicit _iterator(value_type root) : cur(root) {
-        if( !root.get() )
-          return;
-        
-        visited.insert(root);
-
-        for( auto ref : root->references ){
-          if( visited.find(ref) == visited.end() ){
+      // Documents are marked when queued so that cycles and shared references are only visited once
+      void push(const document& doc) {
+        for( dochandle ref : doc.references ){
+          if( store->contains(ref) && !visited[ref.index()] ){
+            visited[ref.index()] = true;
             cont.push(ref);
           }
         }
-        //if( !root->references.empty() ){
-        //  cont.insert(cont.begin(), root->references.begin(), root->references.end());
-        //}
       }
 
-      _iterator() = delete;
-      _iterator(const _iterator&) = default;
-      _iterator(const _iterator&& rhs) : visited(std::move(rhs.visited)), cont(std::move(rhs.cont)), cur(std::move(rhs.cur)) {}
-      _iterator& operator=(const _iterator&) = default;
-      _iterator& operator=(const _iterator&& rhs) {
-        visited = std::move(rhs.visited);
-        cont = std::move(rhs.cont);
-        cur = std::move(rhs.cur);
-        return *this;
-      }
-
-      template<bool wasConst, class = std::enable_if<Const && ! wasConst>>
-      _iterator(const _iterator<wasConst, TYPE> &rhs) : cont(rhs.cont), cur(rhs.cur) {}
+      public:
 
-      template<bool wasConst, class = std::enable_if<Const && ! wasConst>>
-      _iterator(const _iterator<wasConst, TYPE> &&rhs) : cont(std::move(rhs.cont)), cur(std::move(rhs.cur)) {}
+      _iterator(Store* store, dochandle root) : store(store), cur(root) {
+        if( !store->contains(root) ){
+          cur = dochandle();
+          return;
+        }
 
-      template<bool wasConst, class =  std::enable_if<Const && !wasConst>>
-      _iterator& operator=(const _iterator<wasConst, TYPE>& rhs) {
-        visited = rhs.visited;
-        cont = rhs.cont;
-        cur = rhs.cur;
-        return *this;
-      }
-      
-      template<bool wasConst, class =  std::enable_if<Const && !wasConst>>
-      _iterator& operator=(const _iterator<wasConst, TYPE>&& rhs) {
-        visited = std::move(rhs.visited);
-        cont = std::move(rhs.cont);
-        cur = std::move(rhs.cur);
-        return *this;
+        visited.assign(store->slots(), false);
+        visited[root.index()] = true;
+        STATS_ADD(TRAVERSAL_NODES, 1);
+        push((*store)[root]);
       }
 
+      // The end of a traversal
+      explicit _iterator(Store* store) : store(store) {}
+
+      template<bool wasConst, class = std::enable_if_t<Const && !wasConst>>
+      _iterator(const _iterator<wasConst, TYPE>& rhs) : store(rhs.store), visited(rhs.visited), cont(rhs.cont), cur(rhs.cur) {}
+
       friend class _iterator<!Const, TYPE>;
 
-      pointer operator->() { return cur; }
-      reference operator*() { return *cur; }
+      pointer operator->() const { return &(*store)[cur]; }
+      reference operator*() const { return (*store)[cur]; }
+
+      // The handle of the document the traversal is on
+      dochandle handle() const { return cur; }
 
-      bool operator==(const _iterator &other) const { return cur.get() == other.cur.get(); }
-      bool operator!=(const _iterator &other) const { return cur.get() != other.cur.get(); }
+      bool operator==(const _iterator &other) const { return cur == other.cur; }
+      bool operator!=(const _iterator &other) const { return cur != other.cur; }
 
       _iterator& operator++() {
-        if( cont.empty() ) { cur = nullptr; return *this; }
+        if( cont.empty() ) { cur = dochandle(); return *this; }
 
         cur = pop();
-
-        for( auto ref : cur->references ) {
-          if( visited.find(ref) == visited.end() )
-            cont.push(ref);
-        }
+        STATS_ADD(TRAVERSAL_NODES, 1);
+        push((*store)[cur]);
         return *this;
       }
 
       _iterator operator++(int) {
         _iterator result(*this);
-        if( cont.empty() ) { cur = nullptr; return result; }
-        
-        cur = pop();
-
-        for( auto ref : cur->references )
-          if( visited.find(ref) == visited.end() )
-            cont.push(ref);
+        ++*this;
         return result;
       }
 
@@ -149,44 +158,74 @@ class docgraph {
 
 
     docgraph() = default;
+    ~docgraph();
+
+    docgraph(const docgraph&) = delete;
+    docgraph& operator=(const docgraph&) = delete;
 
     void scan_dir(path);
 
+    // The Files scan_dir() Would Add, And Adding Files Directly
+    static vector<path> list_dir(const path&);
+    void add_files(const vector<path>&, bool hash = true);
+
+    // The Files The Scans So Far Left Out, And Why
+    const vector<namediagnostic>& nameDiagnostics() const {
+      return diagnostics;
+    }
+
+    // Scan A Directory With Worker Processes Parsing Shards Of It, See distscan.hpp
+    size_t scan_distributed(const path&, const vector<string>& commands);
+
     /** Print information on all docs in the graph.
      */
     void printDocs() const {
       for( auto& doc : docs ){
-        doc->printInfo();
-        std::cout << std::endl;
+        doc.printInfo(*this);
+        std::cout << '\n';
       }
+      std::cout.flush();
     }
 
+    // Save The Graph To A Snapshot File
+    bool save(const path&) const;
+
+    // Replace The Graph With A Snapshot File's Contents
+    void load(const path&);
+
+    // Add The Files A Loaded Snapshot Doesn't Have, Remove The Gone Ones And Mark Changed Ones Unparsed
+    size_t refresh(const path&);
+
+    // Parse The References Of Each Document Not Parsed Yet, Reading Many Documents At Once.
+    // Their Text Is Added To The Full-Text Index If One Is Given. Stops Early On Request.
+    void parseDocuments(std::function<void(size_t)> = {}, unsigned = 64, textindexbuilder* = nullptr, std::stop_token = {});
+
+    // Number Of Documents Whose References Have Been Parsed
+    size_t parsedCount() const;
+
     // Parse Each Document's References And Connect Them To Each Other
     void parseAndConnect();
 
     // Standard Iterators Over All Documents
-    decltype(docs)::iterator begin() { return docs.begin(); }
-    decltype(docs)::iterator end() { return docs.end(); }
-    decltype(docs)::const_iterator cbegin() { return docs.cbegin(); }
-    decltype(docs)::const_iterator cend() { return docs.cend(); }
-    
-    decltype(docs)::reverse_iterator rbegin() { return docs.rbegin(); }
-    decltype(docs)::reverse_iterator rend() { return docs.rend(); }
-    decltype(docs)::const_reverse_iterator crbegin() { return docs.crbegin(); }
-    decltype(docs)::const_reverse_iterator crend() { return docs.crend(); }
+    docstore::iterator begin() { return docs.begin(); }
+    docstore::iterator end() { return docs.end(); }
+    docstore::const_iterator begin() const { return docs.begin(); }
+    docstore::const_iterator end() const { return docs.end(); }
+    docstore::const_iterator cbegin() const { return docs.cbegin(); }
+    docstore::const_iterator cend() const { return docs.cend(); }
 
     // DFS And BFS Iterators
-    DFSiterator dfsbegin(size_t idx) { return DFSiterator(docs.at(idx)); }
-    DFSiterator dfsend() { return DFSiterator(nullptr); }
-    constDFSiterator cdfsbegin(size_t idx) const { return constDFSiterator(docs.at(idx)); }
-    constDFSiterator cdfsend() const { return constDFSiterator(nullptr); }
-
-    BFSiterator bfsbegin(size_t idx) { return BFSiterator(docs.at(idx)); }
-    BFSiterator bfsend() { return BFSiterator(nullptr); }
-    constBFSiterator cbfsbegin(size_t idx) const { return constBFSiterator(docs.at(idx)); }
-    constBFSiterator cbfsend() const { return constBFSiterator(nullptr); }
+    DFSiterator dfsbegin(size_t idx) { return DFSiterator(&docs, handle(idx)); }
+    DFSiterator dfsend() { return DFSiterator(&docs); }
+    constDFSiterator cdfsbegin(size_t idx) const { return constDFSiterator(&docs, handle(idx)); }
+    constDFSiterator cdfsend() const { return constDFSiterator(&docs); }
+
+    BFSiterator bfsbegin(size_t idx) { return BFSiterator(&docs, handle(idx)); }
+    BFSiterator bfsend() { return BFSiterator(&docs); }
+    constBFSiterator cbfsbegin(size_t idx) const { return constBFSiterator(&docs, handle(idx)); }
+    constBFSiterator cbfsend() const { return constBFSiterator(&docs); }
     
-    vector<shared_ptr<document>> getDoc(string, decltype(string::npos)=3); 
+    vector<dochandle> getDoc(std::string_view, decltype(string::npos)=3) const;
 
     size_t size() const {
       return docs.size();
@@ -196,7 +235,65 @@ class docgraph {
       return docs.empty();
     }
 
-    const shared_ptr<document> getChild(size_t) const;
+    // The document at a position in the graph
+    document& getChild(size_t);
+    const document& getChild(size_t) const;
+
+    // The handle of the document at a position in the graph
+    // @throws out_of_range if there's no document there
+    dochandle handle(size_t) const;
+
+    // The position of a document in the graph
+    size_t indexOf(dochandle h) const {
+      return h.index();
+    }
+
+    // The document a handle refers to
+    // @throws out_of_range if the handle is from a graph that has since been replaced
+    document& get(dochandle h) {
+      return docs[h];
+    }
+    const document& get(dochandle h) const {
+      return docs[h];
+    }
+
+    // Whether a handle still refers to a document of the graph
+    bool contains(dochandle h) const {
+      return docs.contains(h);
+    }
+
+    // Resolve a reference of a document to another document, if it's not already there
+    bool addReference(dochandle, dochandle);
+
+    // Merge The Edges Flushed By edgewriters Into The Documents, And Publish A New View
+    size_t commitEdges();
+
+    // The Resolved References As Of The Last Commit, Safe To Read From Any Thread. Never Null,
+    // A Graph Starts Out With An Empty View At Epoch 0.
+    std::shared_ptr<const edgeview> view() const {
+      return published_edges.load(std::memory_order_acquire);
+    }
+
+    // Resolve The References Naming Exactly One Document, On Many Threads
+    size_t resolveExact(unsigned threads = 0);
+
+    // Where The Reference Resolver Got To, Saved With The Graph
+    std::pair<size_t, size_t> reviewPosition() const {
+      return review;
+    }
+
+    void setReviewPosition(size_t doc, size_t ref) {
+      review = {doc, ref};
+    }
+
+    // Groups Of Documents Whose Contents Are Identical
+    vector<vector<dochandle>> duplicates() const;
+
+    // Groups Of Documents With The Same File Name Whose Contents Differ
+    vector<vector<dochandle>> drifted() const;
+
+    // Resolved References To An Older Revision Than The Latest Of Their Document, On Many Threads
+    vector<staleref> staleReferences(unsigned threads = 0) const;
 
 };
 
@@ -0,0 +1,160 @@
+#include "graphdiff.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+
+// A graph reduced to its sorted keys and sorted edges between them
+struct canonicalgraph {
+  vector<dockey> keys;                         // Sorted, without repeats
+  vector<std::pair<uint32_t, uint32_t>> edges; // Between positions in keys, sorted, without repeats
+};
+
+/**
+ * @brief Reduce a graph to its canonical form
+ *
+ * The edges are the ones of the graph's published view, so the graph may be read this way while
+ * references are being resolved into it.
+ */
+static canonicalgraph canonicalize(const docgraph& graph) {
+  auto view = graph.view();
+  const size_t n = view->size();
+
+  vector<dockey> slotkeys(n);
+  for( size_t i = 0; i < n; i++ ){
+    const document& doc = graph.getChild(i);
+    slotkeys[i] = {doc.docname(), doc.getRevision()};
+  }
+
+  vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return slotkeys[a] < slotkeys[b]; });
+
+  canonicalgraph out;
+  vector<uint32_t> id(n);
+  for( uint32_t slot : order ){
+    if( out.keys.empty() || out.keys.back() != slotkeys[slot] )
+      out.keys.push_back(std::move(slotkeys[slot]));
+    id[slot] = out.keys.size() - 1;
+  }
+
+  out.edges.reserve(view->edges());
+  for( size_t i = 0; i < n; i++ )
+    for( dochandle to : view->references(i) )
+      out.edges.emplace_back(id[i], id[to.index()]);
+  std::sort(out.edges.begin(), out.edges.end());
+  out.edges.erase(std::unique(out.edges.begin(), out.edges.end()), out.edges.end());
+  return out;
+}
+
+/**
+ * @brief Compare a graph to an earlier one
+ *
+ * Both graphs are reduced to their keys and edges, sorted, and then merged in one pass each.
+ * The keys of both are merged into one sorted table, and since a graph's own keys keep their
+ * order in it, its edges stay sorted when renumbered, so the edges are merged without sorting
+ * again.
+ *
+ * @param before The earlier graph, such as the last release's
+ * @param after The graph to compare to it
+ */
+graphdiff diff_graphs(const docgraph& before, const docgraph& after) {
+  TRACE_SCOPE("diff_graphs");
+  canonicalgraph a = canonicalize(before), b = canonicalize(after);
+
+  graphdiff diff;
+  vector<uint32_t> aid(a.keys.size()), bid(b.keys.size());
+  vector<bool> in_a, in_b;
+  size_t i = 0, j = 0;
+  while( i < a.keys.size() || j < b.keys.size() ){
+    bool take_a = j == b.keys.size() || (i < a.keys.size() && a.keys[i] <= b.keys[j]);
+    bool take_b = i == a.keys.size() || (j < b.keys.size() && b.keys[j] <= a.keys[i]);
+    uint32_t id = diff.all_keys.size();
+    diff.all_keys.push_back(take_a ? a.keys[i] : b.keys[j]);
+    in_a.push_back(take_a);
+    in_b.push_back(take_b);
+    if( take_a ) aid[i++] = id;
+    if( take_b ) bid[j++] = id;
+    if( !take_b ) diff.removed_docs.push_back(id);
+    if( !take_a ) diff.added_docs.push_back(id);
+  }
+
+  for( auto& e : a.edges ) e = {aid[e.first], aid[e.second]};
+  for( auto& e : b.edges ) e = {bid[e.first], bid[e.second]};
+  std::set_difference(a.edges.begin(), a.edges.end(), b.edges.begin(), b.edges.end(), std::back_inserter(diff.removed_edges));
+  std::set_difference(b.edges.begin(), b.edges.end(), a.edges.begin(), a.edges.end(), std::back_inserter(diff.added_edges));
+
+  // Keys with the same name are next to each other, oldest revision first. A name whose
+  // latest revision went up makes references to its older revisions in the new graph stale.
+  const size_t nkeys = diff.all_keys.size();
+  vector<int32_t> bumped(nkeys, -1);
+  for( size_t first = 0, last; first < nkeys; first = last ){
+    std::optional<unsigned> latest_a, latest_b;
+    for( last = first; last < nkeys && diff.all_keys[last].name == diff.all_keys[first].name; last++ ){
+      if( in_a[last] ) latest_a = diff.all_keys[last].revision;
+      if( in_b[last] ) latest_b = diff.all_keys[last].revision;
+    }
+    if( !latest_a || !latest_b || *latest_b <= *latest_a ) continue;
+
+    for( size_t k = first; k < last && diff.all_keys[k].revision < *latest_b; k++ )
+      bumped[k] = diff.bumps.size();
+    diff.bumps.push_back({diff.all_keys[first].name, *latest_a, *latest_b, {}});
+  }
+
+  for( auto& e : b.edges )
+    if( bumped[e.second] >= 0 )
+      diff.bumps[bumped[e.second]].stale.push_back(e);
+
+  return diff;
+}
+
+/**
+ * @brief Compare two graph snapshots
+ *
+ * @throws as docgraph::load() if either snapshot can't be read
+ */
+graphdiff diff_snapshots(const path& before, const path& after) {
+  docgraph a, b;
+  a.load(before);
+  b.load(after);
+  return diff_graphs(a, b);
+}
+
+static std::ostream& operator<<(std::ostream& os, const dockey& key) {
+  return os << key.name << " R" << key.revision;
+}
+
+/**
+ * @brief Write a diff as a readable report, one line per change
+ */
+void print_diff(std::ostream& os, const graphdiff& diff) {
+  auto edge = [&](const char* change, const graphdiff::keyedge& e) {
+    os << change << diff.key(e.first) << " -> " << diff.key(e.second) << '\n';
+  };
+
+  os << diff.added_docs.size() << " documents added\n";
+  for( uint32_t id : diff.added_docs )
+    os << "  + " << diff.key(id) << '\n';
+  os << diff.removed_docs.size() << " documents removed\n";
+  for( uint32_t id : diff.removed_docs )
+    os << "  - " << diff.key(id) << '\n';
+
+  os << diff.added_edges.size() << " references added\n";
+  for( auto& e : diff.added_edges )
+    edge("  + ", e);
+  os << diff.removed_edges.size() << " references removed\n";
+  for( auto& e : diff.removed_edges )
+    edge("  - ", e);
+
+  os << diff.bumps.size() << " documents with new revisions\n";
+  for( auto& bump : diff.bumps ){
+    os << "  " << bump.name << " R" << bump.from << " -> R" << bump.to;
+    if( !bump.stale.empty() )
+      os << ", still referenced at older revisions by:";
+    os << '\n';
+    for( auto& e : bump.stale )
+      os << "    " << diff.key(e.first) << " (cites R" << diff.key(e.second).revision << ")\n";
+  }
+  os.flush();
+}
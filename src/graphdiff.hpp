@@ -0,0 +1,72 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+
+using std::filesystem::path;
+using std::string;
+using std::vector;
+
+// What a document is compared by between graphs, whatever file it was read from
+struct dockey {
+  string name;
+  unsigned revision;
+
+  auto operator<=>(const dockey&) const = default;
+};
+
+/**
+ * @brief The differences between two graphs, compared by document name and revision
+ *
+ * Documents and edges refer to keys by their position in keys(), which holds every key of both
+ * graphs in sorted order. Copies of a document with the same name and revision count as one.
+ */
+class graphdiff {
+  vector<dockey> all_keys;
+
+  friend graphdiff diff_graphs(const docgraph&, const docgraph&);
+
+  public:
+    // A reference, from a key to the key it refers to
+    using keyedge = std::pair<uint32_t, uint32_t>;
+
+    // A document whose latest revision went up, and the references still to older revisions
+    struct revisionbump {
+      string name;
+      unsigned from, to;
+      vector<keyedge> stale; ///< References in the new graph to a revision before to
+    };
+
+    vector<uint32_t> added_docs, removed_docs;
+    vector<keyedge> added_edges, removed_edges;
+    vector<revisionbump> bumps;
+
+    const vector<dockey>& keys() const {
+      return all_keys;
+    }
+
+    const dockey& key(uint32_t id) const {
+      return all_keys[id];
+    }
+
+    bool empty() const {
+      return added_docs.empty() && removed_docs.empty() && added_edges.empty() && removed_edges.empty() && bumps.empty();
+    }
+};
+
+// Compare a graph to an earlier one
+graphdiff diff_graphs(const docgraph& before, const docgraph& after);
+
+// Compare two graph snapshots, see docgraph::save()
+// @throws as docgraph::load() if either snapshot can't be read
+graphdiff diff_snapshots(const path& before, const path& after);
+
+// Write a diff as a readable report
+void print_diff(std::ostream&, const graphdiff&);
@@ -3,50 +3,97 @@
 // ImGui
 #include "graph.hpp"
 #include "imgui.h"
+#include "stats.hpp"
+#include "layout.hpp"
+#include "search.hpp"
+#include "textindex.hpp"
+#include "scanjob.hpp"
+#include "trace.hpp"
 
 // C++ Includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 // using std::cout, std::endl;
 
+// Whether the reference graph window is open
+static bool show_graph = false;
+
+// Whether the search window is open
+static bool show_search = false;
+
+// Whether the full-text search window is open
+static bool show_text_search = false;
+
+// Whether the stale references window is open
+static bool show_stale = false;
+
+// Document picked in the search window for the reference resolver to go to, if any
+static std::optional<size_t> jump_doc;
+
+// Parses the documents behind the loading screen
+static std::unique_ptr<scanjob> parse_job;
+
+// How often the parsed and resolved references are saved while working
+static constexpr auto CHECKPOINT_INTERVAL = std::chrono::seconds(30);
+
 /**
  * @brief Display a progress bar as we parse through the documents 
  *
+ * Documents are parsed on a worker thread so that many of them can be read at once while
+ * the window stays responsive. The parsed documents are checkpointed as they go, so a parse
+ * that is closed or crashes picks up where it stopped the next time.
+ *
+ * @param graph The graph to parse
+ * @param checkpoint The graph snapshot to checkpoint to
  * @returns False until the documents are parsed.
  */
-bool parseDocs(docgraph& graph) {
+bool parseDocs(docgraph& graph, const path& checkpoint) {
 
   static ImGuiWindowFlags flags = ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoDecoration;
 
+  if( !parse_job ){
+    parse_job = std::make_unique<scanjob>(graph, checkpoint, CHECKPOINT_INTERVAL);
+    parse_job->start();
+  }
+
+  if( parse_job->done() ){
+    parse_job.reset();
+    return true;
+  }
+
   // Set Next Window Size
   const ImGuiViewport* viewport = ImGui::GetMainViewport();
   ImGui::SetNextWindowPos(viewport->WorkPos);
   ImGui::SetNextWindowSize(viewport->WorkSize);
   
-  static unsigned idx = 0;
-  if( idx >= graph.size() ) return true;
-
   ImGui::Begin("Loading Screen", nullptr, flags);
 
+  size_t cur = parse_job->progress();
   std::stringstream progstr;
-  progstr << idx << "/" << graph.size(); 
-  float progress = float(idx) / float(graph.size());
+  progstr << cur << "/" << graph.size(); 
+  float progress = graph.empty() ? 1.f : float(cur) / float(graph.size());
 
   ImGui::Text("Parsing Documents... Please Wait");
 
   ImGui::ProgressBar(progress, ImVec2(0.f,0.f), progstr.str().c_str()); 
    
-  graph.getChild(idx)->parseReferences();
-  idx++;
-  
   ImGui::End();
   
-  if( idx >= graph.size() ) return true;
-
   return false;
 }
 
@@ -59,6 +106,7 @@ bool menuBar() {
 
   // static bool help_selected = false;
   static bool ref_res = false; // Request ReferenceResolver Help
+  static bool show_stats = false; // Show The Statistics Window
   
   if( ImGui::BeginMainMenuBar() ){
     if( ImGui::BeginMenu("DocManager") ){
@@ -69,6 +117,16 @@ bool menuBar() {
 
       ImGui::EndMenu();
     }
+    if( ImGui::BeginMenu("View") ){
+
+      ImGui::MenuItem("Search", nullptr, &show_search);
+      ImGui::MenuItem("Full-Text Search", nullptr, &show_text_search);
+      ImGui::MenuItem("Reference Graph", nullptr, &show_graph);
+      ImGui::MenuItem("Stale References", nullptr, &show_stale);
+      ImGui::MenuItem("Statistics", nullptr, &show_stats);
+
+      ImGui::EndMenu();
+    }
     if( ImGui::BeginMenu("Help") ){
 
 
@@ -88,9 +146,90 @@ bool menuBar() {
     }
   }
 
+  if( show_stats ){
+    if( statsWindow() ) {
+      show_stats = false;
+    }
+  }
+
   return close;
 }
 
+/**
+ * @brief Display the live hot path counters and stage timings
+ *
+ * @returns True when the user has closed the window. Else false
+ */
+bool statsWindow() {
+  bool open = true;
+
+  ImGui::SetNextWindowSize(ImVec2(520, 300), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Statistics", &open);
+
+  if( !STATS_ENABLED ){
+    ImGui::TextDisabled("Statistics were compiled out (DOCMNG_NO_STATS)");
+    ImGui::End();
+    return !open;
+  }
+
+  // Summing every thread's counters is cheap, so do it every frame
+  const statsnapshot snap = stats_collect();
+
+  if( ImGui::BeginTable("counters", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg) ){
+    ImGui::TableSetupColumn("Counter");
+    ImGui::TableSetupColumn("Value");
+    ImGui::TableHeadersRow();
+    for( size_t c = 0; c < STAT_COUNTERS; c++ ){
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(to_string(statcounter(c)));
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)snap.counters[c]);
+    }
+    for( size_t g = 0; g < STAT_GAUGES; g++ ){
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(to_string(statgauge(g)));
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)snap.gauges[g]);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::Spacing();
+
+  if( ImGui::BeginTable("timers", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg) ){
+    ImGui::TableSetupColumn("Stage");
+    ImGui::TableSetupColumn("Count");
+    ImGui::TableSetupColumn("Total ms");
+    ImGui::TableSetupColumn("p50 us");
+    ImGui::TableSetupColumn("p99 us");
+    ImGui::TableSetupColumn("Max us");
+    ImGui::TableHeadersRow();
+    for( size_t t = 0; t < STAT_TIMERS; t++ ){
+      const stathistogram& h = snap.timers[t];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(to_string(stattimer(t)));
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)h.count);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", h.total_ns / 1e6);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", h.quantile(0.5) / 1e3);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", h.quantile(0.99) / 1e3);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", h.max_ns / 1e3);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+
+  return !open;
+}
+
 /**
  * @brief Display the help dialogue for the Reference Resolver
  *
@@ -178,7 +317,7 @@ bool helpRefResolve() {
  * @param selection The choice selected by the user
  * @returns True when the user responds to the popup, false otherwise
  */
-bool correctDocPopUp(std::shared_ptr<document> doc, string ref, bool& selection) {
+bool correctDocPopUp(const document& doc, std::string_view ref, bool& selection) {
   // Set Flags Such that the window cannot be moved, collapsed, nor resized
   static ImGuiWindowFlags flags = ImGuiWindowFlags_NoResize | 
                                   ImGuiWindowFlags_NoMove | 
@@ -200,8 +339,8 @@ bool correctDocPopUp(std::shared_ptr<document> doc, string ref, bool& selection)
 
     ImGui::Text("Please Confirm That The Given Reference And Document Match:");
     ImGui::Separator();
-    ImGui::Text("Reference: %s", ref.c_str());
-    ImGui::Text("Chosen Document: %s", doc->filename().c_str());
+    ImGui::Text("Reference: %.*s", (int)ref.size(), ref.data());
+    ImGui::Text("Chosen Document: %s", doc.filename().c_str());
 
     if( ImGui::Button("Correct") ){
       selection = true;
@@ -222,26 +361,695 @@ bool correctDocPopUp(std::shared_ptr<document> doc, string ref, bool& selection)
   return response;
 }
 
+// Colour of each subsystem's nodes in the reference graph, from subsystems.def
+static ImU32 subsystemColor(SUBSYSTEMS sys) {
+  size_t i = (size_t)sys;
+  if( i >= SUBSYSTEM_COUNT ) return IM_COL32(128, 128, 128, 255);
+  uint32_t rgb = SUBSYSTEM_TABLE[i].color;
+  return IM_COL32(rgb >> 16 & 0xFF, rgb >> 8 & 0xFF, rgb & 0xFF, 255);
+}
+
 /**
  * @brief Display The Reference Heirarchies
+ *
+ * Documents are laid out by a force directed layout running on a worker thread, and each frame
+ * draws its latest positions. Drag to pan and scroll to zoom. Only the nodes and edges that are
+ * on screen are drawn, and names are only drawn when zoomed in enough to read them.
+ *
+ * @returns False, the graph window never closes the program
  */
 bool graphWindow(docgraph &graph) {
-  (void)graph; 
+  static std::unique_ptr<forcelayout> layout;
+  static vector<string> names;
+  static vector<SUBSYSTEMS> subsystems;
+  static vector<forcelayout::edge> edges;
+  static ImVec2 pan(0.f, 0.f);
+  static float zoom = 1.f;
+
+  if( !show_graph )
+    return false;
+
+  // Take a copy of the graph's last published view to lay out. Done again on request, as
+  // references get resolved.
+  auto rebuild = [&graph]() {
+    names.clear();
+    subsystems.clear();
+    edges.clear();
+    for( auto& doc : graph ){
+      names.push_back(doc.filename());
+      subsystems.push_back(doc.subsystem());
+    }
+    auto view = graph.view();
+    for( size_t i = 0; i < view->size(); i++ ){
+      for( dochandle ref : view->references(i) ){
+        if( graph.contains(ref) )
+          edges.push_back({(uint32_t)i, (uint32_t)graph.indexOf(ref)});
+      }
+    }
+    layout.reset(); // Stop the old worker before starting the new one
+    layout = std::make_unique<forcelayout>(names.size(), edges);
+  };
+
+  if( !layout || names.size() != graph.size() )
+    rebuild();
+
+  ImGui::SetNextWindowSize(ImVec2(600, 600), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Reference Graph", &show_graph);
+
+  if( ImGui::Button("Relayout") )
+    rebuild();
+  ImGui::SameLine();
+  if( ImGui::Button("Reset View") ){
+    pan = ImVec2(0.f, 0.f);
+    zoom = 1.f;
+  }
+  ImGui::SameLine();
+  ImGui::Text("%zu documents, %zu references, %s", names.size(), edges.size(),
+              layout->settled() ? "settled" : "laying out...");
+
+  // Legend
+  for( size_t sys = 0; sys < SUBSYSTEM_COUNT; sys++ ){
+    ImU32 col = subsystemColor(SUBSYSTEMS(sys));
+    ImGui::TextColored(ImVec4((col & 0xff) / 255.f, (col >> 8 & 0xff) / 255.f, (col >> 16 & 0xff) / 255.f, 1.f),
+                       "%s", to_string(SUBSYSTEMS(sys)).c_str());
+    if( sys + 1 != SUBSYSTEM_COUNT ) ImGui::SameLine();
+  }
+
+  // Canvas
+  ImVec2 p0 = ImGui::GetCursorScreenPos();
+  ImVec2 size = ImGui::GetContentRegionAvail();
+  size.x = std::max(size.x, 50.f);
+  size.y = std::max(size.y, 50.f);
+  ImVec2 p1(p0.x + size.x, p0.y + size.y);
+
+  ImGui::InvisibleButton("canvas", size);
+  bool hovered = ImGui::IsItemHovered();
+  ImGuiIO& io = ImGui::GetIO();
+
+  if( ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left) ){
+    pan.x += io.MouseDelta.x;
+    pan.y += io.MouseDelta.y;
+  }
+
+  ImVec2 center(p0.x + size.x / 2 + pan.x, p0.y + size.y / 2 + pan.y);
+
+  // Zoom around the mouse, keeping the point under it in place
+  if( hovered && io.MouseWheel != 0.f ){
+    float wx = (io.MousePos.x - center.x) / zoom, wy = (io.MousePos.y - center.y) / zoom;
+    zoom = std::clamp(zoom * std::pow(1.2f, io.MouseWheel), 0.01f, 50.f);
+    pan.x = io.MousePos.x - (p0.x + size.x / 2) - wx * zoom;
+    pan.y = io.MousePos.y - (p0.y + size.y / 2) - wy * zoom;
+    center = ImVec2(p0.x + size.x / 2 + pan.x, p0.y + size.y / 2 + pan.y);
+  }
+
+  auto pos = layout->positions();
+  auto screen = [&](uint32_t i) {
+    return ImVec2(center.x + (*pos)[i].x * zoom, center.y + (*pos)[i].y * zoom);
+  };
+
+  ImDrawList* draw = ImGui::GetWindowDrawList();
+  draw->AddRectFilled(p0, p1, IM_COL32(30, 30, 30, 255));
+  draw->PushClipRect(p0, p1, true);
+
+  // Edges whose ends are both past the same side of the canvas can't cross it
+  for( auto [a, b] : edges ){
+    ImVec2 sa = screen(a), sb = screen(b);
+    if( (sa.x < p0.x && sb.x < p0.x) || (sa.x > p1.x && sb.x > p1.x) ||
+        (sa.y < p0.y && sb.y < p0.y) || (sa.y > p1.y && sb.y > p1.y) )
+      continue;
+    draw->AddLine(sa, sb, IM_COL32(150, 150, 150, 90));
+  }
+
+  float radius = std::clamp(4.f * zoom, 2.f, 12.f);
+  bool labels = zoom >= 1.5f;
+  int hovered_node = -1;
+  for( uint32_t i = 0; i < names.size(); i++ ){
+    ImVec2 s = screen(i);
+    if( s.x < p0.x - radius || s.x > p1.x + radius || s.y < p0.y - radius || s.y > p1.y + radius )
+      continue;
+
+    draw->AddCircleFilled(s, radius, subsystemColor(subsystems[i]));
+    if( labels )
+      draw->AddText(ImVec2(s.x + radius + 2, s.y - radius), IM_COL32(220, 220, 220, 255), names[i].c_str());
+
+    float dx = io.MousePos.x - s.x, dy = io.MousePos.y - s.y;
+    if( hovered && dx * dx + dy * dy <= (radius + 2) * (radius + 2) )
+      hovered_node = i;
+  }
+
+  draw->PopClipRect();
+
+  if( hovered_node >= 0 )
+    ImGui::SetTooltip("%s (%s)", names[hovered_node].c_str(), to_string(subsystems[hovered_node]).c_str());
+
+  ImGui::End();
+
+  return false;
+}
+
+/**
+ * @brief Search documents by name, subsystem, revision and references as the user types
+ *
+ * The index is built once when the window is first opened, and again on request. Each
+ * keystroke runs one query with a frame sized budget; clicking a result opens that document
+ * in the reference resolver.
+ *
+ * @returns False, the search window never closes the program
+ */
+bool searchWindow(docgraph& graph) {
+  static std::shared_ptr<const searchindex> index;
+  static std::optional<searchsession> session;
+  static char query[256] = "";
+  static searchsession::results results;
+
+  if( !show_search )
+    return false;
+
+  auto rebuild = [&graph]() {
+    index = std::make_shared<const searchindex>(graph);
+    session.emplace(index);
+    results = session->query(query);
+  };
+
+  if( !index || index->size() != graph.size() )
+    rebuild();
+
+  ImGui::SetNextWindowSize(ImVec2(500, 400), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Search", &show_search);
+
+  if( ImGui::InputTextWithHint("##query", "Name, subsystem, revision or reference...", query, sizeof(query)) )
+    results = session->query(query);
+  ImGui::SameLine();
+  if( ImGui::Button("Reindex") )
+    rebuild();
+
+  ImGui::Text("%zu matches%s", results.matches, results.complete ? "" : " (keep typing to narrow down)");
+
+  if( ImGui::BeginTable("results", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY) ){
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Document");
+    ImGui::TableSetupColumn("Subsystem");
+    ImGui::TableSetupColumn("Rev");
+    ImGui::TableHeadersRow();
+
+    ImGuiListClipper clipper;
+    clipper.Begin((int)results.top.size());
+    while( clipper.Step() ){
+      for( int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++ ){
+        uint32_t id = results.top[n].doc;
+        const document& doc = graph.get(index->doc(id));
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::PushID(n);
+        if( ImGui::Selectable(index->name(id).c_str(), false, ImGuiSelectableFlags_SpanAllColumns) )
+          jump_doc = id;
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(to_string(doc.subsystem()).c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%u", doc.getRevision());
+      }
+    }
+    clipper.End();
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+
+  return false;
+}
+
+/**
+ * @brief Checks the graph for stale references on a worker thread
+ *
+ * The check goes over every reference in the graph, too long to do inside a frame on large
+ * corpora, so the window asks for it when the graph's edges change and polls for the result on
+ * later frames. Only the latest request is answered, older ones are dropped.
+ */
+class staleFinder {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::thread worker;
+
+  const docgraph* graph = nullptr;
+  uint64_t requested = 0; // Generation of the latest request
+  uint64_t answered = 0;  // Generation the result is for
+  bool fresh = false;     // Whether the result hasn't been taken yet
+  vector<staleref> result;
+  bool stop = false;
+
+  void run() {
+    std::unique_lock lk(mtx);
+    while( true ){
+      cv.wait(lk, [this]() { return stop || requested != answered; });
+      if( stop ) return;
+
+      uint64_t gen = requested;
+      const docgraph* g = graph;
+      lk.unlock();
+      auto found = g->staleReferences();
+      lk.lock();
+
+      // The graph changed again while checking, check that one instead
+      if( gen != requested ) continue;
+      result = std::move(found);
+      answered = gen;
+      fresh = true;
+    }
+  }
+
+  public:
+    staleFinder() = default;
+
+    ~staleFinder() {
+      shutdown();
+    }
+
+    // Stop the worker, waiting for a check in flight. The graph may be destroyed afterwards.
+    void shutdown() {
+      {
+        std::lock_guard lk(mtx);
+        stop = true;
+      }
+      cv.notify_one();
+      if( worker.joinable() ) worker.join();
+    }
+
+    // Start checking a graph. Returns the request's generation.
+    uint64_t request(const docgraph& g) {
+      std::lock_guard lk(mtx);
+      if( !worker.joinable() && !stop )
+        worker = std::thread(&staleFinder::run, this);
+      graph = &g;
+      cv.notify_one();
+      return ++requested;
+    }
+
+    // Take the stale references of a request if they have been found
+    bool poll(uint64_t gen, vector<staleref>& out) {
+      std::lock_guard lk(mtx);
+      if( answered != gen || !fresh ) return false;
+      out = std::move(result);
+      fresh = false;
+      return true;
+    }
+};
+
+// Checks for the stale references listed
+static staleFinder staleness;
+
+/**
+ * @brief List the resolved references to an older revision than the latest of their document
+ *
+ * The check is run again on a worker whenever new references are committed to the graph, and
+ * the last list is shown until it's done, so the list is always as of a recent commit. Clicking
+ * a reference opens the referencing document in the reference resolver.
+ *
+ * @returns False, the window never closes the program
+ */
+bool staleWindow(docgraph& graph) {
+  static vector<staleref> stale;
+  static std::optional<uint64_t> epoch;
+  static uint64_t checking = 0; // Generation of the check not yet taken, 0 if none
+
+  if( !show_stale )
+    return false;
+
+  uint64_t current = graph.view()->epoch();
+  if( epoch != current ){
+    checking = staleness.request(graph);
+    epoch = current;
+  }
+  if( checking && staleness.poll(checking, stale) )
+    checking = 0;
+
+  ImGui::SetNextWindowSize(ImVec2(600, 400), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Stale References", &show_stale);
+
+  ImGui::Text("%zu references to outdated revisions%s", stale.size(), checking ? " (checking...)" : "");
+
+  if( ImGui::BeginTable("stale", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY) ){
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Document");
+    ImGui::TableSetupColumn("Refers To");
+    ImGui::TableSetupColumn("Latest");
+    ImGui::TableHeadersRow();
+
+    ImGuiListClipper clipper;
+    clipper.Begin((int)stale.size());
+    while( clipper.Step() ){
+      for( int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++ ){
+        const staleref& s = stale[n];
+        if( !graph.contains(s.from) || !graph.contains(s.to) || !graph.contains(s.latest) ) continue;
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::PushID(n);
+        if( ImGui::Selectable(graph.get(s.from).filename().c_str(), false, ImGuiSelectableFlags_SpanAllColumns) )
+          jump_doc = graph.indexOf(s.from);
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(graph.get(s.to).filename().c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("R%u", graph.get(s.latest).getRevision());
+      }
+    }
+    clipper.End();
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+
   return false;
 }
 
+/**
+ * @brief Query the full-text index built with --index-text
+ *
+ * The index is mapped when the window is first opened, and queries run as the user types.
+ *
+ * @param file The full-text index file
+ * @returns False, the window never closes the program
+ */
+bool textSearchWindow(const path& file) {
+  static std::unique_ptr<textindex> index;
+  static string error;
+  static char query[256] = "";
+  static textindex::docset results;
+  static vector<string> paths;
+  static double took_ms = 0;
+
+  if( !show_text_search )
+    return false;
+
+  auto run = [&]() {
+    results.clear();
+    paths.clear();
+    error.clear();
+    if( !index || query[0] == '\0' ) return;
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+      results = index->query(query);
+    } catch( std::exception& e ){
+      error = e.what();
+    }
+    took_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    paths.reserve(results.size());
+    for( uint32_t doc : results )
+      paths.emplace_back(index->docpath(doc));
+  };
+
+  auto reload = [&]() {
+    index.reset();
+    try {
+      index = std::make_unique<textindex>(file);
+      run();
+    } catch( std::exception& e ){
+      error = e.what();
+    }
+  };
+
+  if( !index && error.empty() )
+    reload();
+
+  ImGui::SetNextWindowSize(ImVec2(500, 400), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Full-Text Search", &show_text_search);
+
+  if( ImGui::InputTextWithHint("##textquery", "words \"a phrase\" OR -excluded", query, sizeof(query)) )
+    run();
+  ImGui::SameLine();
+  if( ImGui::Button("Reload") )
+    reload();
+
+  if( !index ){
+    ImGui::TextWrapped("No full-text index: %s. Build one with --index-text.", error.c_str());
+  }else if( !error.empty() ){
+    ImGui::TextWrapped("%s", error.c_str());
+  }else{
+    ImGui::Text("%zu of %zu documents match (%.2f ms)", results.size(), index->size(), took_ms);
+  }
+
+  if( ImGui::BeginListBox("##textresults", ImVec2(-1.f, -1.f)) ){
+    ImGuiListClipper clipper;
+    clipper.Begin((int)paths.size());
+    while( clipper.Step() )
+      for( int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++ )
+        ImGui::TextUnformatted(paths[n].c_str());
+    clipper.End();
+    ImGui::EndListBox();
+  }
+
+  ImGui::End();
+
+  return false;
+}
+
+/**
+ * @brief Finds the candidate documents of a reference on a worker thread
+ *
+ * Searching the whole graph takes too long to do inside a frame on large corpora, so the
+ * window asks for the candidates of a reference and polls for them on later frames. Only the
+ * latest request is answered, older ones are dropped.
+ */
+class candidateFinder {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::thread worker;
+
+  const docgraph* graph = nullptr;
+  string query;
+  uint64_t requested = 0; // Generation of the latest request
+  uint64_t answered = 0;  // Generation the result is for
+  bool fresh = false;     // Whether the result hasn't been taken yet
+  vector<dochandle> result;
+  bool stop = false;
+
+  void run() {
+    std::unique_lock lk(mtx);
+    while( true ){
+      cv.wait(lk, [this]() { return stop || requested != answered; });
+      if( stop ) return;
+
+      uint64_t gen = requested;
+      string ref = query;
+      lk.unlock();
+      auto found = graph->getDoc(ref, 5);
+      lk.lock();
+
+      // A newer request came in while searching, answer that one instead
+      if( gen != requested ) continue;
+      result = std::move(found);
+      answered = gen;
+      fresh = true;
+    }
+  }
+
+  public:
+    candidateFinder() = default;
+
+    ~candidateFinder() {
+      shutdown();
+    }
+
+    // Stop the worker, waiting for a search in flight. The graph may be destroyed afterwards.
+    void shutdown() {
+      {
+        std::lock_guard lk(mtx);
+        stop = true;
+      }
+      cv.notify_one();
+      if( worker.joinable() ) worker.join();
+    }
+
+    // Start searching for a reference's candidates. Returns the request's generation.
+    uint64_t request(const docgraph& g, std::string_view ref) {
+      std::lock_guard lk(mtx);
+      if( !worker.joinable() && !stop )
+        worker = std::thread(&candidateFinder::run, this);
+      graph = &g;
+      query = ref;
+      cv.notify_one();
+      return ++requested;
+    }
+
+    // Take the candidates of a request if they have been found
+    bool poll(uint64_t gen, vector<dochandle>& out) {
+      std::lock_guard lk(mtx);
+      if( answered != gen || !fresh ) return false;
+      out = std::move(result);
+      fresh = false;
+      return true;
+    }
+};
+
+// Finds the candidates of the reference being resolved
+static candidateFinder finder;
+
+/**
+ * @brief Saves the graph to the review checkpoint on a worker thread
+ *
+ * Writing out a large graph takes too long to do inside a frame, so the window asks for a
+ * checkpoint and carries on. The worker holds the edit lock while it saves, and the window
+ * changes the graph only while holding it too, so a checkpoint never has half of a change.
+ */
+class checkpointWriter {
+  std::mutex mtx;
+  std::mutex edit_mtx; // Held while the graph is saved or changed
+  std::condition_variable cv;
+  std::thread worker;
+
+  const docgraph* graph = nullptr;
+  path file;
+  bool pending = false; // Whether a checkpoint was asked for and not started yet
+  bool stop = false;
+
+  void run() {
+    std::unique_lock lk(mtx);
+    while( true ){
+      cv.wait(lk, [this]() { return stop || pending; });
+      if( stop ) return;
+
+      pending = false;
+      const docgraph* g = graph;
+      path to = file;
+      lk.unlock();
+      {
+        std::lock_guard edit(edit_mtx);
+        TRACE_SCOPE("checkpoint", to.native());
+        g->save(to);
+      }
+      lk.lock();
+    }
+  }
+
+  public:
+    checkpointWriter() = default;
+
+    ~checkpointWriter() {
+      shutdown();
+    }
+
+    // Stop the worker, waiting for a save in flight. One asked for and not started is dropped.
+    void shutdown() {
+      {
+        std::lock_guard lk(mtx);
+        stop = true;
+      }
+      cv.notify_one();
+      if( worker.joinable() ) worker.join();
+    }
+
+    // Save a graph to a snapshot file on the worker. Asking again before it starts saves once.
+    void request(const docgraph& g, const path& to) {
+      std::lock_guard lk(mtx);
+      if( !worker.joinable() && !stop )
+        worker = std::thread(&checkpointWriter::run, this);
+      graph = &g;
+      file = to;
+      pending = true;
+      cv.notify_one();
+    }
+
+    // Hold while changing the graph, so it isn't saved halfway through the change
+    std::unique_lock<std::mutex> edit() {
+      return std::unique_lock(edit_mtx);
+    }
+};
+
+// Saves the review checkpoints
+static checkpointWriter checkpoints;
+
+/**
+ * @brief Stop the GUI's background work. Call before the graph is destroyed.
+ *
+ * A parse in progress is stopped and checkpointed. A review checkpoint being written is
+ * finished, the caller saves the graph once more afterwards.
+ */
+void guiShutdown() {
+  finder.shutdown();
+  staleness.shutdown();
+  checkpoints.shutdown();
+  parse_job.reset();
+}
+
 /**
  * @brief Display Reference Resolver window
  *
+ * Everything shown per document or candidate is turned into a display string once, when it
+ * changes, and the lists only draw the rows that are visible. Candidates are searched for off
+ * the frame, so the window stays responsive with any number of documents.
+ *
+ * Review starts where the graph's last session left off. The resolved references and the
+ * position are saved to the checkpoint every so often while they change.
+ *
  * @param graph The graph to resolve references for
+ * @param checkpoint The graph snapshot to checkpoint to
  * @returns True if the main program should exit. 
  */
-bool referenceWindow(docgraph& graph) {
-  static auto it = graph.begin();
-  static vector<string> refs;
+bool referenceWindow(docgraph& graph, const path& checkpoint) {
+  static size_t doc_idx = 0; // The document being reviewed
+  static reflist refs;
+  static int current_ref_idx = 0;
   bool close = false;
   static bool confirm_doc = false;
 
+  // Display names of every document, made once
+  static vector<string> docnames;
+  if( docnames.size() != graph.size() ){
+    docnames.clear();
+    docnames.reserve(graph.size());
+    for( auto& doc : graph )
+      docnames.push_back(doc.filename());
+  }
+
+  // Possible Documents That Match The Current Reference, And Their Display Names
+  static uint64_t search = 0;     // The search in flight, 0 if there is none
+  static bool searched = false;   // Whether poss_refs holds the current reference's candidates
+  static vector<dochandle> poss_refs;
+  static vector<string> poss_names;
+  static int poss_ref_idx = 0;
+
+  // Forget the current reference's candidates
+  auto resetCandidates = [&]() {
+    search = 0;
+    searched = false;
+    poss_refs.clear();
+    poss_names.clear();
+    poss_ref_idx = 0;
+  };
+
+  // Move on to a document
+  auto gotoDoc = [&](size_t idx) {
+    doc_idx = idx;
+    refs = reflist();
+    current_ref_idx = 0;
+    confirm_doc = false;
+    resetCandidates();
+  };
+
+  // Move on to the next reference, or the next document after the last one
+  auto nextRef = [&]() {
+    resetCandidates();
+    current_ref_idx++;
+    if( current_ref_idx == (int)refs.size() )
+      gotoDoc(doc_idx + 1);
+  };
+
+  // Pick up where the last session left off
+  static bool resumed = false;
+  if( !resumed ){
+    auto [doc, ref] = graph.reviewPosition();
+    doc_idx = std::min(doc, graph.size());
+    current_ref_idx = (int)ref;
+    resumed = true;
+  }
+
+  if( jump_doc ){
+    gotoDoc(*jump_doc);
+    jump_doc.reset();
+  }
+
   static ImGuiWindowFlags flags = ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoDecoration;
 
   // Set Next Window Size
@@ -251,147 +1059,163 @@ bool referenceWindow(docgraph& graph) {
     
   ImGui::Begin("My First Window", nullptr, flags);
 
-  float max = (float)std::distance(graph.begin(), graph.end());
-  float cur = (float)std::distance(it, graph.end());
-
-  float progress = (max - cur) / max; 
+  char progstr[64];
+  float max = (float)graph.size();
+  float progress = max == 0.f ? 1.f : (float)doc_idx / max;
+  snprintf(progstr, sizeof(progstr), "%zu/%zu", doc_idx, graph.size());
 
-  std::stringstream progstr;
-  progstr << std::setprecision(0) << max-cur << "/" << max;
-
-  ImGui::ProgressBar(progress, ImVec2(0.f, 0.f), progstr.str().c_str()); 
+  ImGui::ProgressBar(progress, ImVec2(0.f, 0.f), progstr); 
   ImGui::SameLine();
   ImGui::Text("Documents Reviewed");
 
+  // Document List, Only The Visible Rows Are Drawn
+  ImGui::BeginChild("Documents", ImVec2(250.f, -ImGui::GetFrameHeightWithSpacing()), true);
+  {
+    ImGuiListClipper clipper;
+    clipper.Begin((int)docnames.size());
+    while( clipper.Step() ){
+      for( int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++ ){
+        if( ImGui::Selectable(docnames[n].c_str(), (size_t)n == doc_idx) )
+          gotoDoc(n);
+      }
+    }
+    clipper.End();
+  }
+  ImGui::EndChild();
+
+  ImGui::SameLine();
+  ImGui::BeginChild("Review", ImVec2(0.f, -ImGui::GetFrameHeightWithSpacing()));
 
   // Check If We're At The last Document
-  if( it == graph.end() ){
+  if( doc_idx >= graph.size() ){
     ImGui::Text("No More Documents To Review");
   }else{ // Review This Document
+    dochandle handle = graph.handle(doc_idx);
+    document& doc = graph.get(handle);
 
     // Display Document Info
-    ImGui::Text("Document: %s", (*it)->filename().c_str()); 
-
-    // Static Data
-    static int current_ref_idx = 0;
+    ImGui::Text("Document: %s", docnames[doc_idx].c_str()); 
 
-    // Get References
-    if( refs.empty() )
-      refs = (*it)->getParsedReferences();
+    // Get References. A resumed position past the last one starts the document over.
+    if( refs.empty() ){
+      refs = doc.getParsedReferences();
+      if( current_ref_idx >= (int)refs.size() )
+        current_ref_idx = 0;
+    }
 
     // If References Don't Exist, Next Doc
     if( refs.empty() ){
       ImGui::Text("Document Has No References");
     }else{ // Document has references
       float progress = float(current_ref_idx) / float(refs.size()); 
-      progstr.str("");
-      progstr << current_ref_idx << "/" << refs.size();
-      ImGui::ProgressBar(progress, ImVec2(0.f, 0.f), progstr.str().c_str());
+      snprintf(progstr, sizeof(progstr), "%d/%zu", current_ref_idx, refs.size());
+      ImGui::ProgressBar(progress, ImVec2(0.f, 0.f), progstr);
       ImGui::SameLine();
       ImGui::Text("References Checked");
 
-      ImGui::Text("Looking For Document Matching Reference \"%s\"", refs[current_ref_idx].c_str());
+      std::string_view ref = refs[current_ref_idx];
+      ImGui::Text("Looking For Document Matching Reference \"%.*s\"", (int)ref.size(), ref.data());
     
-      // Possible Documents That Match The Reference
-      static vector<shared_ptr<document>> poss_refs;
-      static int poss_ref_idx = 0;
-
-      // Check If First Init Of Poss_Refs
-      if( poss_refs.empty() ){
-        // Fill
-        poss_refs = graph.getDoc(refs[current_ref_idx], 5);
+      // Search for the candidates once per reference, and pick them up when they're found
+      if( !searched && search == 0 )
+        search = finder.request(graph, refs[current_ref_idx]);
+      if( !searched && finder.poll(search, poss_refs) ){
+        search = 0;
+        searched = true;
+        poss_names.reserve(poss_refs.size());
+        for( dochandle poss : poss_refs )
+          poss_names.push_back(graph.get(poss).filename());
       }
-      // If No Possible References Exist, Continue
-      if( poss_refs.empty() ){
+
+      if( !searched ){
+        ImGui::Text("Searching For Matching Documents...");
+      }else if( poss_refs.empty() ){ // If No Possible References Exist, Continue
         ImGui::Text("No Documents Match The Reference");
 
         // Add the reference to unFound references
         if( ImGui::Button("Add To UnFound References") ){
-          (*it)->addReference(refs[current_ref_idx]);
-          current_ref_idx++;
-          poss_ref_idx = 0;
-          if( current_ref_idx == (int)refs.size() ){
-            refs.clear();
-            it++;
-            current_ref_idx = 0;
-          }
+          auto lock = checkpoints.edit();
+          doc.addReference(refs[current_ref_idx]);
+          nextRef();
         }
         if( ImGui::Button("Skip To Next Reference") ){
-          poss_ref_idx = 0;
-          current_ref_idx = 0;
-          refs.clear();
-          it++;
+          nextRef();
         }
       }else{ // Reference Has Possible Matching Documents
-        ImGui::Text("Reference Has %ld Possible Documents", poss_refs.size());
+        ImGui::Text("Reference Has %zu Possible Documents", poss_refs.size());
         ImGui::Separator();
         ImGui::TextWrapped("Select The Document That Matches The Reference:");
-        if( ImGui::BeginCombo("Pick One", poss_refs[poss_ref_idx]->filename().c_str()) ){
-          for( int n  = 0; n < (int)poss_refs.size(); n++ ){
-            if( ImGui::Selectable(poss_refs[n]->filename().c_str(), n == poss_ref_idx) )
-              poss_ref_idx = n;
-            if( n == current_ref_idx )
-              ImGui::SetItemDefaultFocus();
+
+        // Candidate List, Only The Visible Rows Are Drawn
+        if( ImGui::BeginListBox("##candidates", ImVec2(-1.f, 8 * ImGui::GetTextLineHeightWithSpacing())) ){
+          ImGuiListClipper clipper;
+          clipper.Begin((int)poss_names.size());
+          while( clipper.Step() ){
+            for( int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++ ){
+              if( ImGui::Selectable(poss_names[n].c_str(), n == poss_ref_idx) )
+                poss_ref_idx = n;
+            }
           }
-          ImGui::EndCombo();
+          clipper.End();
+          ImGui::EndListBox();
         }
+
         if( ImGui::Button("Select Reference Document")){
           confirm_doc = true;
         }
         
         if( confirm_doc ){
           bool selection;
-          if( correctDocPopUp(poss_refs[poss_ref_idx], refs[current_ref_idx], selection) ){
+          if( correctDocPopUp(graph.get(poss_refs[poss_ref_idx]), refs[current_ref_idx], selection) ){
+            confirm_doc = false;
             if( selection ){
-              (*it)->addReference(poss_refs[poss_ref_idx]);
-              poss_ref_idx = 0;
-              poss_refs.clear();
-              current_ref_idx++;
-              if( current_ref_idx == (int)refs.size() ){
-                refs.clear();
-                it++;
-                current_ref_idx = 0;
+              {
+                auto lock = checkpoints.edit();
+                graph.addReference(handle, poss_refs[poss_ref_idx]);
+                graph.commitEdges();
               }
+              nextRef();
             }
-            confirm_doc = false;
           }
         }
 
 
         ImGui::SameLine();
         if( ImGui::Button("No Reference Documents Match") ){
-          (*it)->addReference(refs[current_ref_idx]);
-          poss_ref_idx = 0;
-          poss_refs.clear();
-          current_ref_idx++;
-          if( current_ref_idx == (int)refs.size() ){
-            refs.clear();
-            it++;
-            current_ref_idx = 0;
-          }
+          auto lock = checkpoints.edit();
+          doc.addReference(refs[current_ref_idx]);
+          nextRef();
         }
       }
       
       
     }
-    string nexttxt = "Skip To Next Document";
-    if( refs.empty() )
-      nexttxt = "Next Document";
-    if( ImGui::Button(nexttxt.c_str()) ) {
-      if( !refs.empty() )
-        refs.clear();
-      it++;
+    if( ImGui::Button(refs.empty() ? "Next Document" : "Skip To Next Document") ) {
+      gotoDoc(doc_idx + 1);
     }
   }
 
-  ImGui::Separator();
+  ImGui::EndChild();
 
   if( ImGui::Button("Close Document Manager") )
     close = true;
   
   ImGui::End();
 
+  // Checkpoint the review now and then, if it has moved on. The resolved references change
+  // only along with the position. The save is written on the checkpoint worker.
+  static std::pair<size_t, size_t> saved = graph.reviewPosition();
+  static auto last_save = std::chrono::steady_clock::now();
+  if( graph.reviewPosition() != std::pair<size_t, size_t>(doc_idx, current_ref_idx) ){
+    auto lock = checkpoints.edit();
+    graph.setReviewPosition(doc_idx, current_ref_idx);
+  }
+  if( graph.reviewPosition() != saved && std::chrono::steady_clock::now() - last_save >= CHECKPOINT_INTERVAL ){
+    checkpoints.request(graph, checkpoint);
+    saved = graph.reviewPosition();
+    last_save = std::chrono::steady_clock::now();
+  }
+
   return close;
 
 }
-
@@ -13,13 +13,28 @@ bool menuBar();
 bool helpRefResolve();
 
 // Prompt User to tell if documents selected are correct
-bool correctDocPopUp(std::shared_ptr<document>, string, bool&);
+bool correctDocPopUp(const document&, std::string_view, bool&);
 
 // Display The Reference Graph Created
 bool graphWindow(docgraph&);
 
-// Go Through Resolving Reference Issues
-bool referenceWindow(docgraph&);
+// Search Documents As The User Types
+bool searchWindow(docgraph&);
 
-// Loading Screen While Parsing Docs
-bool parseDocs(docgraph&);
+// List The References To Outdated Revisions, As Of The Last Commit
+bool staleWindow(docgraph&);
+
+// Query The Full-Text Index Of The Documents' Body Text
+bool textSearchWindow(const path&);
+
+// Go Through Resolving Reference Issues, Checkpointing The Resolved References To A File
+bool referenceWindow(docgraph&, const path&);
+
+// Live Hot Path Counters And Stage Timings
+bool statsWindow();
+
+// Loading Screen While Parsing Docs, Checkpointing The Parsed Documents To A File
+bool parseDocs(docgraph&, const path&);
+
+// Stop Background Work Before The Graph Is Destroyed
+void guiShutdown();
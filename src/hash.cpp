@@ -0,0 +1,135 @@
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Little endian loads, whatever the host is
+static uint64_t le64(const unsigned char* p) {
+  uint64_t v = 0;
+  for( int i = 7; i >= 0; i-- ) v = v << 8 | p[i];
+  return v;
+}
+
+static uint32_t le32(const unsigned char* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t mix(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  acc = rotl(acc, 31);
+  return acc * P1;
+}
+
+static uint64_t merge(uint64_t acc, uint64_t val) {
+  acc ^= mix(0, val);
+  return acc * P1 + P4;
+}
+
+xxh64::xxh64(uint64_t seed) : seed(seed) {
+  acc[0] = seed + P1 + P2;
+  acc[1] = seed + P2;
+  acc[2] = seed;
+  acc[3] = seed - P1;
+}
+
+void xxh64::update(const void* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  total += len;
+
+  // Finish a stripe started by the last update
+  if( buflen > 0 ){
+    size_t n = std::min(len, sizeof(buf) - buflen);
+    memcpy(buf + buflen, p, n);
+    buflen += n;
+    p += n;
+    len -= n;
+    if( buflen < sizeof(buf) ) return;
+
+    for( int i = 0; i < 4; i++ )
+      acc[i] = mix(acc[i], le64(buf + 8 * i));
+    buflen = 0;
+  }
+
+  for( ; len >= 32; p += 32, len -= 32 )
+    for( int i = 0; i < 4; i++ )
+      acc[i] = mix(acc[i], le64(p + 8 * i));
+
+  memcpy(buf, p, len);
+  buflen = len;
+}
+
+uint64_t xxh64::digest() const {
+  uint64_t h;
+  if( total >= 32 ){
+    h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+    for( int i = 0; i < 4; i++ )
+      h = merge(h, acc[i]);
+  }else{
+    h = seed + P5;
+  }
+  h += total;
+
+  const unsigned char* p = buf;
+  size_t len = buflen;
+  for( ; len >= 8; p += 8, len -= 8 ){
+    h ^= mix(0, le64(p));
+    h = rotl(h, 27) * P1 + P4;
+  }
+  if( len >= 4 ){
+    h ^= uint64_t(le32(p)) * P1;
+    h = rotl(h, 23) * P2 + P3;
+    p += 4;
+    len -= 4;
+  }
+  for( ; len > 0; p++, len-- ){
+    h ^= *p * P5;
+    h = rotl(h, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+/**
+ * @brief Hash a file's contents with XXH64
+ *
+ * @param file The file to hash
+ * @returns Nothing if the file can't be opened or read
+ */
+std::optional<uint64_t> hash_file(const path& file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if( fd < 0 ) return std::nullopt;
+
+  xxh64 h;
+  unsigned char block[1 << 16];
+  while( true ){
+    ssize_t n = read(fd, block, sizeof(block));
+    if( n < 0 && errno == EINTR ) continue;
+    if( n < 0 ){
+      close(fd);
+      return std::nullopt;
+    }
+    if( n == 0 ) break;
+    h.update(block, n);
+  }
+
+  close(fd);
+  return h.digest();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+using std::filesystem::path;
+
+/**
+ * @brief Streaming XXH64, a fast non-cryptographic 64 bit hash
+ *
+ * Gives the same digests as the reference xxHash implementation. Good for telling identical
+ * files apart from different ones, not for anything security related.
+ */
+class xxh64 {
+  uint64_t acc[4];
+  uint64_t seed;
+  uint64_t total = 0;
+  unsigned char buf[32];
+  size_t buflen = 0;
+
+  public:
+    explicit xxh64(uint64_t seed = 0);
+
+    void update(const void*, size_t);
+
+    // The hash of everything passed to update() so far
+    uint64_t digest() const;
+};
+
+// Hash a file's contents, reading it in blocks. Nothing if it can't be read.
+std::optional<uint64_t> hash_file(const path&);
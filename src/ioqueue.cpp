@@ -0,0 +1,343 @@
+#include "ioqueue.hpp"
+
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+#ifndef DOCMNG_NO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * @brief A read as tracked by the queues. Advanced in place on short reads.
+ */
+struct ioreq {
+  int fd;
+  char* buf;
+  size_t len;
+  uint64_t offset;
+  uint64_t tag;
+  size_t done = 0;
+};
+
+#ifndef DOCMNG_NO_IO_URING
+
+/**
+ * @brief io_uring backend, driven through the raw syscalls so no liburing is needed
+ */
+class uringqueue : public ioqueue {
+  int ring = -1;
+  unsigned entries = 0;
+
+  // Submission ring
+  void* sq_ptr = MAP_FAILED;
+  size_t sq_size = 0;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+
+  // Completion ring
+  void* cq_ptr = MAP_FAILED;
+  size_t cq_size = 0;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  io_uring_cqe* cqes;
+
+  // Requests live in slots, the slot index is the sqe's user_data
+  vector<ioreq> slots;
+  vector<size_t> free_slots;
+  std::deque<size_t> pending; // Slots not yet handed to the kernel
+  unsigned inflight = 0;
+  bool failed = false; // Whether io_uring_enter failed, after which every read fails
+
+  void push_sqe(size_t slot) {
+    ioreq& r = slots[slot];
+    unsigned tail = *sq_tail;
+    unsigned idx = tail & *sq_mask;
+
+    io_uring_sqe* sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r.fd;
+    sqe->addr = (uint64_t)(r.buf + r.done);
+    sqe->len = r.len - r.done;
+    sqe->off = r.offset + r.done;
+    sqe->user_data = slot;
+
+    sq_array[idx] = idx;
+    std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+    inflight++;
+  }
+
+  // Take the completions off the ring. A short read is queued again for the rest, unless
+  // the ring failed, when it's failed along with the reads never submitted.
+  void reap(vector<ioresult>& results, bool retry) {
+    unsigned head = *cq_head;
+    while( head != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire) ){
+      io_uring_cqe* cqe = &cqes[head & *cq_mask];
+      size_t slot = cqe->user_data;
+      int res = cqe->res;
+      head++;
+      inflight--;
+
+      ioreq& r = slots[slot];
+      if( res > 0 && r.done + res < r.len ){
+        // Short read, queue the remainder
+        r.done += res;
+        if( retry ){
+          pending.push_back(slot);
+          continue;
+        }
+        res = -EIO;
+      }
+
+      results.push_back({r.tag, res < 0 ? (ssize_t)res : (ssize_t)(r.done + res)});
+      free_slots.push_back(slot);
+    }
+    std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+  }
+
+  // Take back the entries the kernel hasn't taken off the submission ring, and fail them
+  void unsubmit(vector<ioresult>& results) {
+    unsigned head = std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+    for( unsigned i = head; i != *sq_tail; i++ ){
+      size_t slot = sqes[sq_array[i & *sq_mask]].user_data;
+      results.push_back({slots[slot].tag, -EIO});
+      free_slots.push_back(slot);
+      inflight--;
+    }
+    std::atomic_ref<unsigned>(*sq_tail).store(head, std::memory_order_release);
+  }
+
+  // Fail every read not handed to the kernel, so callers don't wait for them
+  void fail_pending(vector<ioresult>& results) {
+    for( size_t slot : pending ){
+      results.push_back({slots[slot].tag, -EIO});
+      free_slots.push_back(slot);
+    }
+    pending.clear();
+  }
+
+  public:
+    explicit uringqueue(unsigned depth) {
+      io_uring_params p;
+      memset(&p, 0, sizeof(p));
+
+      ring = syscall(__NR_io_uring_setup, depth, &p);
+      if( ring < 0 ) return;
+      entries = p.sq_entries;
+
+      sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      if( p.features & IORING_FEAT_SINGLE_MMAP )
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+      sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+      if( sq_ptr == MAP_FAILED ) return;
+
+      if( p.features & IORING_FEAT_SINGLE_MMAP ){
+        cq_ptr = sq_ptr;
+      }else{
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        if( cq_ptr == MAP_FAILED ) return;
+      }
+
+      sqes = (io_uring_sqe*)mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+      if( sqes == MAP_FAILED ) return;
+
+      char* sq = (char*)sq_ptr;
+      sq_head = (unsigned*)(sq + p.sq_off.head);
+      sq_tail = (unsigned*)(sq + p.sq_off.tail);
+      sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+      sq_array = (unsigned*)(sq + p.sq_off.array);
+
+      char* cq = (char*)cq_ptr;
+      cq_head = (unsigned*)(cq + p.cq_off.head);
+      cq_tail = (unsigned*)(cq + p.cq_off.tail);
+      cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+      cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    }
+
+    ~uringqueue() {
+      if( sqes != MAP_FAILED ) munmap(sqes, entries * sizeof(io_uring_sqe));
+      if( cq_ptr != MAP_FAILED && cq_ptr != sq_ptr ) munmap(cq_ptr, cq_size);
+      if( sq_ptr != MAP_FAILED ) munmap(sq_ptr, sq_size);
+      if( ring >= 0 ) close(ring);
+    }
+
+    bool ok() const {
+      return ring >= 0 && sq_ptr != MAP_FAILED && cq_ptr != MAP_FAILED && sqes != MAP_FAILED;
+    }
+
+    void read(int fd, char* buf, size_t len, uint64_t offset, uint64_t tag) override {
+      size_t slot;
+      if( free_slots.empty() ){
+        slot = slots.size();
+        slots.push_back({fd, buf, len, offset, tag});
+      }else{
+        slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = {fd, buf, len, offset, tag};
+      }
+      pending.push_back(slot);
+    }
+
+    vector<ioresult> wait() override {
+      vector<ioresult> results;
+
+      // A ring that failed takes no more reads
+      if( failed ){
+        fail_pending(results);
+        return results;
+      }
+
+      while( results.empty() ){
+        // Keep at most one ring's worth in flight so the completion ring never overflows
+        while( !pending.empty() && inflight < entries ){
+          push_sqe(pending.front());
+          pending.pop_front();
+        }
+
+        if( inflight == 0 ) break;
+
+        // Entries the kernel hasn't taken yet, such as ones left by a busy ring, go again
+        unsigned to_submit = *sq_tail - std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+        int ret = syscall(__NR_io_uring_enter, ring, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if( ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY ){
+          std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+          failed = true;
+
+          // The kernel may still be reading into the callers' buffers, so every read it took is
+          // waited for before any is failed and its buffer can be given back
+          unsubmit(results);
+          while( inflight > 0 ){
+            reap(results, false);
+            if( inflight > 0 && syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 )
+              usleep(1000);
+          }
+          fail_pending(results);
+          break;
+        }
+
+        reap(results, true);
+      }
+
+      return results;
+    }
+
+    const char* backend() const override {
+      return "io_uring";
+    }
+};
+
+#endif
+
+/**
+ * @brief Fallback backend: a pool of threads doing blocking pread()s
+ */
+class poolqueue : public ioqueue {
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::deque<ioreq> work;
+  vector<ioresult> done;
+  size_t outstanding = 0; // Reads queued but not yet returned by wait()
+  bool stop = false;
+  vector<std::thread> threads;
+
+  void worker() {
+    std::unique_lock lk(mtx);
+    while( true ){
+      work_cv.wait(lk, [this]{ return stop || !work.empty(); });
+      if( stop ) return;
+
+      ioreq r = work.front();
+      work.pop_front();
+      lk.unlock();
+
+      ssize_t res = 0;
+      while( r.done < r.len ){
+        res = pread(r.fd, r.buf + r.done, r.len - r.done, r.offset + r.done);
+        if( res < 0 && errno == EINTR ) continue;
+        if( res <= 0 ) break;
+        r.done += res;
+      }
+      if( res >= 0 ) res = r.done;
+      else res = -errno;
+
+      lk.lock();
+      done.push_back({r.tag, res});
+      done_cv.notify_one();
+    }
+  }
+
+  public:
+    explicit poolqueue(unsigned depth) {
+      for( unsigned i = 0; i < depth; i++ )
+        threads.emplace_back(&poolqueue::worker, this);
+    }
+
+    ~poolqueue() {
+      {
+        std::lock_guard lk(mtx);
+        stop = true;
+      }
+      work_cv.notify_all();
+      for( auto& t : threads )
+        t.join();
+    }
+
+    void read(int fd, char* buf, size_t len, uint64_t offset, uint64_t tag) override {
+      {
+        std::lock_guard lk(mtx);
+        work.push_back({fd, buf, len, offset, tag});
+        outstanding++;
+      }
+      work_cv.notify_one();
+    }
+
+    vector<ioresult> wait() override {
+      std::unique_lock lk(mtx);
+      if( outstanding == 0 ) return {};
+
+      done_cv.wait(lk, [this]{ return !done.empty(); });
+      vector<ioresult> results;
+      results.swap(done);
+      outstanding -= results.size();
+      return results;
+    }
+
+    const char* backend() const override {
+      return "pread thread pool";
+    }
+};
+
+/**
+ * @brief Create the best queue available on this system
+ *
+ * @param depth The number of reads to keep in flight
+ */
+std::unique_ptr<ioqueue> ioqueue::create(unsigned depth) {
+  depth = std::max(depth, 1u);
+
+#ifndef DOCMNG_NO_IO_URING
+  auto uring = std::make_unique<uringqueue>(depth);
+  if( uring->ok() )
+    return uring;
+#endif
+
+  // Blocking reads need one thread per read in flight, within reason
+  return std::make_unique<poolqueue>(std::min(depth, 64u));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+using std::vector;
+
+/**
+ * @brief The result of one positioned read
+ */
+struct ioresult {
+  uint64_t tag; ///< The tag given when the read was queued
+  ssize_t res;  ///< Number of bytes read, or -errno
+};
+
+/**
+ * @brief A queue of positioned reads kept in flight together
+ *
+ * Reads are queued with read() and submitted by wait(), which blocks until at least one
+ * of them completes. Short reads are retried internally, so a read only completes short
+ * at end of file.
+ *
+ * The io_uring backend is used when the kernel supports it. Otherwise a pool of threads
+ * doing blocking pread()s is used.
+ */
+class ioqueue {
+  public:
+    virtual ~ioqueue() = default;
+
+    // Queue a read. buf must stay valid until the read completes.
+    virtual void read(int fd, char* buf, size_t len, uint64_t offset, uint64_t tag) = 0;
+
+    // Submit queued reads and wait for completions. Empty when nothing is in flight.
+    virtual vector<ioresult> wait() = 0;
+
+    // Name of the backend in use
+    virtual const char* backend() const = 0;
+
+    static std::unique_ptr<ioqueue> create(unsigned depth);
+};
@@ -0,0 +1,202 @@
+#include "layout.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Preferred distance between connected nodes
+constexpr float SPRING_LENGTH = 30.f;
+
+// Barnes-Hut opening angle. Larger is faster and rougher.
+constexpr float THETA = 0.9f;
+
+// Pull of every node towards the center, keeps disconnected parts from drifting away
+constexpr float GRAVITY = 0.02f;
+
+// Each iteration the largest step a node may take shrinks by this much
+constexpr float COOLING = 0.995f;
+constexpr float MIN_STEP = 0.05f;
+constexpr size_t MAX_ITERATIONS = 3000;
+
+// Deeper than this, nodes are treated as being on top of each other
+constexpr unsigned MAX_DEPTH = 32;
+
+namespace {
+
+/**
+ * @brief A square of the quadtree. Leaves hold at most one node.
+ */
+struct quad {
+  float x, y, half;       // Center and half width
+  float mx = 0, my = 0;   // Sum of the positions below, the center of mass once finished
+  float mass = 0;         // Number of nodes below
+  int32_t child = -1;     // First of the 4 children, which are stored next to each other
+  int32_t body = -1;      // The node in this leaf
+};
+
+class quadtree {
+  vector<quad> quads;
+  const vector<layoutpoint>& pos;
+
+  static int quadrant(const quad& q, const layoutpoint& p) {
+    return (p.x >= q.x) | ((p.y >= q.y) << 1);
+  }
+
+  void split(int32_t q) {
+    int32_t first = quads.size();
+    float h = quads[q].half / 2;
+    for( int c = 0; c < 4; c++ ){
+      quad sub;
+      sub.x = quads[q].x + (c & 1 ? h : -h);
+      sub.y = quads[q].y + (c & 2 ? h : -h);
+      sub.half = h;
+      quads.push_back(sub);
+    }
+    quads[q].child = first;
+
+    // Move the leaf's node down
+    int32_t b = quads[q].body;
+    quads[q].body = -1;
+    quad& sub = quads[first + quadrant(quads[q], pos[b])];
+    sub.body = b;
+    sub.mass = 1;
+    sub.mx = pos[b].x;
+    sub.my = pos[b].y;
+  }
+
+  void insert(int32_t b) {
+    int32_t q = 0;
+    for( unsigned depth = 0; ; depth++ ){
+      bool empty = quads[q].mass == 0;
+      quads[q].mass += 1;
+      quads[q].mx += pos[b].x;
+      quads[q].my += pos[b].y;
+
+      if( quads[q].child < 0 ){
+        if( empty ){
+          quads[q].body = b;
+          return;
+        }
+        if( depth >= MAX_DEPTH ) return; // Counted in the mass, close enough
+        split(q);
+      }
+      q = quads[q].child + quadrant(quads[q], pos[b]);
+    }
+  }
+
+  public:
+    explicit quadtree(const vector<layoutpoint>& pos) : pos(pos) {
+      float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+      for( auto& p : pos ){
+        x0 = std::min(x0, p.x); y0 = std::min(y0, p.y);
+        x1 = std::max(x1, p.x); y1 = std::max(y1, p.y);
+      }
+
+      quads.reserve(pos.size() * 2 + 1);
+      quad root;
+      root.x = (x0 + x1) / 2;
+      root.y = (y0 + y1) / 2;
+      root.half = std::max({x1 - x0, y1 - y0, 1.f}) / 2 + 1;
+      quads.push_back(root);
+
+      for( size_t b = 0; b < pos.size(); b++ )
+        insert(b);
+
+      for( auto& q : quads ){
+        if( q.mass > 0 ){
+          q.mx /= q.mass;
+          q.my /= q.mass;
+        }
+      }
+    }
+
+    // Add the push of every other node on node b to (fx, fy)
+    void repulse(int32_t b, float& fx, float& fy) const {
+      const float k2 = SPRING_LENGTH * SPRING_LENGTH;
+      const layoutpoint& p = pos[b];
+
+      int32_t stack[MAX_DEPTH * 4 + 4];
+      int top = 0;
+      stack[top++] = 0;
+      while( top > 0 ){
+        const quad& q = quads[stack[--top]];
+        if( q.mass == 0 || q.body == b ) continue;
+
+        float dx = p.x - q.mx, dy = p.y - q.my;
+        float d2 = std::max(dx * dx + dy * dy, 0.01f);
+        float width = q.half * 2;
+
+        if( q.child < 0 || width * width < THETA * THETA * d2 ){
+          // Far enough to be treated as a single mass
+          float f = k2 * q.mass / d2;
+          fx += dx * f;
+          fy += dy * f;
+        }else{
+          for( int c = 0; c < 4; c++ )
+            stack[top++] = q.child + c;
+        }
+      }
+    }
+};
+
+}
+
+forcelayout::forcelayout(size_t nodes, vector<edge> edges) : nodes(nodes), edges(std::move(edges)) {
+  // Start on a jittered spiral so that no two nodes are on top of each other
+  auto start = std::make_shared<vector<layoutpoint>>(nodes);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> jitter(-1.f, 1.f);
+  for( size_t i = 0; i < nodes; i++ ){
+    float r = SPRING_LENGTH * std::sqrt((float)i);
+    float a = i * 2.39996f; // Golden angle
+    (*start)[i] = { r * std::cos(a) + jitter(rng), r * std::sin(a) + jitter(rng) };
+  }
+  published.store(start);
+
+  worker = std::thread(&forcelayout::run, this);
+}
+
+forcelayout::~forcelayout() {
+  stopping = true;
+  if( worker.joinable() ) worker.join();
+}
+
+void forcelayout::run() {
+  vector<layoutpoint> pos = *published.load();
+  vector<layoutpoint> force(nodes);
+  float step = SPRING_LENGTH * std::max(1.f, std::sqrt((float)nodes) / 4);
+
+  while( !stopping && nodes > 0 && step > MIN_STEP && iteration < MAX_ITERATIONS ){
+    quadtree tree(pos);
+
+    for( size_t i = 0; i < nodes; i++ ){
+      force[i] = { -GRAVITY * pos[i].x, -GRAVITY * pos[i].y };
+      tree.repulse(i, force[i].x, force[i].y);
+    }
+
+    for( auto [a, b] : edges ){
+      if( a == b ) continue;
+      float dx = pos[b].x - pos[a].x, dy = pos[b].y - pos[a].y;
+      float d = std::sqrt(dx * dx + dy * dy);
+      float f = d / SPRING_LENGTH; // d^2 / k, along the unit vector
+      force[a].x += dx * f; force[a].y += dy * f;
+      force[b].x -= dx * f; force[b].y -= dy * f;
+    }
+
+    // Move each node along its force, at most one step
+    for( size_t i = 0; i < nodes; i++ ){
+      float len = std::sqrt(force[i].x * force[i].x + force[i].y * force[i].y);
+      if( len > 0 ){
+        float s = std::min(len, step) / len;
+        pos[i].x += force[i].x * s;
+        pos[i].y += force[i].y * s;
+      }
+    }
+
+    step *= COOLING;
+    published.store(std::make_shared<const vector<layoutpoint>>(pos));
+    iteration++;
+  }
+
+  done = true;
+}
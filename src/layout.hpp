@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::vector;
+
+struct layoutpoint {
+  float x = 0, y = 0;
+};
+
+/**
+ * @brief Force directed graph layout, computed on a worker thread
+ *
+ * Edges pull their nodes together like springs, and every node pushes every other node away.
+ * The pushing is approximated with a Barnes-Hut quadtree, so an iteration costs O(n log n)
+ * instead of O(n^2). The worker publishes the positions after every iteration and stops once
+ * the layout has cooled down, so callers can draw whatever the latest positions are without
+ * ever waiting on it.
+ */
+class forcelayout {
+  public:
+    using edge = std::pair<uint32_t, uint32_t>;
+
+  private:
+    size_t nodes;
+    vector<edge> edges;
+
+    std::atomic<std::shared_ptr<const vector<layoutpoint>>> published;
+    std::atomic<size_t> iteration = 0;
+    std::atomic<bool> done = false;
+    std::atomic<bool> stopping = false;
+    std::thread worker;
+
+    void run();
+
+  public:
+    // Start laying out nodes 0 to nodes-1 connected by the given edges
+    forcelayout(size_t nodes, vector<edge> edges);
+    ~forcelayout();
+
+    forcelayout(const forcelayout&) = delete;
+    forcelayout& operator=(const forcelayout&) = delete;
+
+    // The latest positions, centered around (0, 0)
+    std::shared_ptr<const vector<layoutpoint>> positions() const {
+      return published.load();
+    }
+
+    size_t iterations() const {
+      return iteration;
+    }
+
+    // Whether the layout has cooled down and stopped moving
+    bool settled() const {
+      return done;
+    }
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
 #include <iterator>
@@ -9,11 +10,28 @@
 #include <memory>
 #include <string_view>
 #include <optional>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
 
 #include "document.hpp"
 #include "graph.hpp"
 #include "utils.hpp"
 #include "gui.hpp"
+#include "export.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "textindex.hpp"
+#include "scanjob.hpp"
+#include "budget.hpp"
+#include "spill.hpp"
+#include "xmlarena.hpp"
+#include "distscan.hpp"
+#include "naming.hpp"
+#include "graphdiff.hpp"
+#include "release.hpp"
 
 // Dear ImGUI
 #include "imgui.h"
@@ -21,13 +39,424 @@
 #include "imgui_impl_opengl2.h"
 #include <GLFW/glfw3.h>
 
-using std::cout, std::endl;
-
 static void glfw_error_callback(int error, const char* description) {
   fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
-int main() {
+static void usage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [-d DIR] [--stats table|prometheus FILE] [--trace FILE] [--memory-budget SIZE] [--resolve-exact] [--naming FILE] [MODE]\n"
+            << "       " << prog << " [-d DIR] [--workers N] [--worker-cmd CMD]... [...] | --worker\n"
+            << "  MODE is one of --export, --serve, --diff, --stale, --release-order, --index-text, --query-text\n"
+            << "  or --duplicates, which runs without the GUI. Without one the GUI is opened.\n"
+            << "  -d DIR          Document directory to manage (default: test_dir)\n"
+            << "  --export FMT F  Write the graph to F (\"-\" for stdout) and exit\n"
+            << "  --serve SOCKET  Answer graph queries on a Unix socket until interrupted\n"
+            << "  --stats FMT F   Write hot path counters and stage timings to F (\"-\" for stdout) on exit\n"
+            << "  --trace FILE    Write a Chrome trace of the scan and parse stages to FILE on exit\n"
+            << "  --memory-budget SIZE\n"
+            << "                  Limit the documents being read at once to SIZE bytes (K, M or G suffix) and\n"
+            << "                  keep parsed references in a scratch file instead of memory\n"
+            << "  --resolve-exact Resolve every reference naming exactly one document's file, on all cores\n"
+            << "  --diff SNAPSHOT Report the documents, references and revisions that changed since the graph\n"
+            << "                  snapshot SNAPSHOT, such as a copy of DIR/.docmng.graph, then exit\n"
+            << "  --stale         List the references to an older revision of a document than its latest, then exit\n"
+            << "  --release-order List the documents in waves to update them in, each after the documents it\n"
+            << "                  references, and the longest chain of references, then exit\n"
+            << "  --naming FILE   Name documents by the patterns in FILE, one per line and tried in order, instead of\n"
+            << "                  REGS-{subsystem}-R{revision}-{name}. Fields are {subsystem}, {subsystem_name},\n"
+            << "                  {revision}, {name} and {any}. Files matching none are skipped and listed\n"
+            << "  --workers N     Parse a fresh scan with N local worker processes, each given a shard of the files\n"
+            << "  --worker-cmd CMD\n"
+            << "                  Also parse a shard with the worker started by the shell command CMD, such as\n"
+            << "                  \"ssh host docmng --worker\". The documents must be at the same path there\n"
+            << "  --worker        Run as a worker, talking to the coordinator on stdin and stdout\n"
+            << "  --index-text    Parse every document and build the full-text index, then exit\n"
+            << "  --query-text Q  Print the documents matching Q in the full-text index, then exit.\n"
+            << "                  Q is words and \"phrases\", combined with AND, OR, NOT/- and ()\n"
+            << "  --duplicates    List identical copies of documents, and copies which have drifted apart, then exit\n";
+}
+
+/**
+ * @brief Write the collected stats to a file, or stdout for "-"
+ *
+ * @param format "table" or "prometheus"
+ * @param file Where to write them
+ */
+static void dumpStats(const string& format, const path& file) {
+  if( format.empty() )
+    return;
+
+  std::ofstream out;
+  if( file != "-" ){
+    out.open(file);
+    if( !out ){
+      std::cerr << "Could not open " << file << " for the stats" << std::endl;
+      return;
+    }
+  }
+  std::ostream& os = file == "-" ? std::cout : out;
+
+  const statsnapshot snap = stats_collect();
+  if( format == "prometheus" )
+    stats_prometheus(os, snap);
+  else
+    stats_print(os, snap);
+  os.flush();
+}
+
+/**
+ * @brief Tell which files a scan left out because of their names
+ *
+ * @param graph The scanned graph
+ * @param shown How many of the files to list
+ */
+static void reportSkipped(const docgraph& graph, size_t shown = 10) {
+  const auto& skipped = graph.nameDiagnostics();
+  if( skipped.empty() )
+    return;
+
+  std::cerr << "Skipped " << skipped.size() << " files by their names:\n";
+  for( size_t i = 0; i < std::min(shown, skipped.size()); i++ )
+    std::cerr << "  " << skipped[i].file.string() << ": " << skipped[i].reason << '\n';
+  if( skipped.size() > shown )
+    std::cerr << "  and " << skipped.size() - shown << " more\n";
+  std::cerr.flush();
+}
+
+// The running query server, stopped by SIGINT/SIGTERM
+static queryserver* server = nullptr;
+
+static void stop_server(int) {
+  if( server ) server->stop();
+}
+
+/**
+ * @brief Load the graph of a directory, from its snapshot if there is one, else by scanning it
+ *
+ * A snapshot is brought up to date with the directory, see docgraph::refresh().
+ *
+ * @param graph The graph to fill
+ * @param dir The document directory
+ * @param graphfile The snapshot of the directory's graph
+ * @param workers The commands of the workers to parse a scan with, if any
+ * @returns True if the references of all the documents are already parsed. A snapshot saved
+ *          part way through parsing is loaded, and the rest of the documents still need it.
+ */
+static bool loadGraph(docgraph& graph, const path& dir, const path& graphfile, const vector<string>& workers = {}) {
+  // Reopen the last session's graph, with its resolved references, if there is one
+  if( std::filesystem::exists(graphfile) ){
+    bool loaded = false;
+    try {
+      graph.load(graphfile);
+      loaded = true;
+    } catch( std::exception& e ){
+      std::cerr << e.what() << std::endl;
+    }
+
+    // The directory may have changed since the snapshot was saved
+    if( loaded ){
+      if( size_t changed = graph.refresh(dir) )
+        std::cout << changed << " documents added, removed or changed since the last session" << std::endl;
+      reportSkipped(graph);
+      return graph.parsedCount() == graph.size();
+    }
+  }
+
+  if( workers.empty() ){
+    graph.scan_dir(dir);
+    reportSkipped(graph);
+    return false;
+  }
+
+  size_t done = graph.scan_distributed(dir, workers);
+  reportSkipped(graph);
+  std::cout << "Workers parsed " << done << " of " << graph.size() << " documents" << std::endl;
+  return graph.parsedCount() == graph.size();
+}
+
+int main(int argc, char** argv) {
+  // Before anything touches libxml2
+  xml_arena_install();
+
+  path dir = "test_dir";
+  std::optional<exportformat> exportfmt;
+  path exportfile;
+  path socket;
+  string statsfmt;
+  path statsfile;
+  path tracefile;
+  bool indextext = false;
+  bool duplicates = false;
+  bool resolveexact = false;
+  vector<string> workers;
+  std::optional<string> textquery;
+  std::optional<path> diffbase;
+  bool stale = false;
+  bool releaseorder = false;
+
+  for( int i = 1; i < argc; i++ ){
+    std::string_view arg = argv[i];
+    if( arg == "-d" && i + 1 < argc ){
+      dir = argv[++i];
+    }else if( arg == "--export" && i + 2 < argc ){
+      exportfmt = exportformat_from_string(argv[++i]);
+      exportfile = argv[++i];
+      if( !exportfmt ){
+        usage(argv[0]);
+        return 1;
+      }
+    }else if( arg == "--serve" && i + 1 < argc ){
+      socket = argv[++i];
+    }else if( arg == "--stats" && i + 2 < argc ){
+      statsfmt = argv[++i];
+      statsfile = argv[++i];
+      if( statsfmt != "table" && statsfmt != "prometheus" ){
+        usage(argv[0]);
+        return 1;
+      }
+    }else if( arg == "--trace" && i + 1 < argc ){
+      tracefile = argv[++i];
+    }else if( arg == "--memory-budget" && i + 1 < argc ){
+      auto bytes = parse_size(argv[++i]);
+      if( !bytes ){
+        usage(argv[0]);
+        return 1;
+      }
+      memory_budget_set(*bytes);
+      try {
+        spill_enable(std::filesystem::temp_directory_path());
+      } catch( std::exception& e ){
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }else if( arg == "--index-text" ){
+      indextext = true;
+    }else if( arg == "--query-text" && i + 1 < argc ){
+      textquery = argv[++i];
+    }else if( arg == "--duplicates" ){
+      duplicates = true;
+    }else if( arg == "--resolve-exact" ){
+      resolveexact = true;
+    }else if( arg == "--diff" && i + 1 < argc ){
+      diffbase = argv[++i];
+    }else if( arg == "--stale" ){
+      stale = true;
+    }else if( arg == "--release-order" ){
+      releaseorder = true;
+    }else if( arg == "--naming" && i + 1 < argc ){
+      try {
+        naming_set(naming_read(argv[++i]));
+      } catch( std::exception& e ){
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }else if( arg == "--workers" && i + 1 < argc ){
+      int n = std::atoi(argv[++i]);
+      if( n <= 0 ){
+        usage(argv[0]);
+        return 1;
+      }
+      try {
+        workers.insert(workers.end(), n, scanworker_local_command());
+      } catch( std::exception& e ){
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }else if( arg == "--worker-cmd" && i + 1 < argc ){
+      workers.push_back(argv[++i]);
+    }else if( arg == "--worker" ){
+      // The protocol gets stdout to itself, anything printed goes to stderr
+      int out = dup(STDOUT_FILENO);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+      return scanworker_run(STDIN_FILENO, out);
+    }else{
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // Each mode runs instead of the others, so asking for two is a mistake
+  int modes = exportfmt.has_value() + !socket.empty() + diffbase.has_value() + stale + releaseorder
+            + indextext + textquery.has_value() + duplicates;
+  if( modes > 1 ){
+    usage(argv[0]);
+    return 1;
+  }
+
+  // These modes scan on their own or read no documents, so workers would go unused
+  if( !workers.empty() && (indextext || textquery || duplicates) ){
+    std::cerr << "--workers and --worker-cmd can't be used with --index-text, --query-text or --duplicates" << std::endl;
+    usage(argv[0]);
+    return 1;
+  }
+
+  if( !tracefile.empty() )
+    trace_start();
+
+  // Write the stats and the trace asked for, and pass on the exit status
+  auto finish = [&](int status) {
+    dumpStats(statsfmt, statsfile);
+    if( !tracefile.empty() )
+      trace_write(tracefile);
+    return status;
+  };
+
+  const path graphfile = dir / ".docmng.graph";
+  const path textfile = dir / ".docmng.text";
+
+  // Full-Text Index. Every document is read from a fresh scan, and the graph snapshot is left
+  // alone, so the references resolved by hand and the review position are kept.
+  if( indextext ){
+    docgraph graph;
+    textindexbuilder text;
+    graph.scan_dir(dir);
+    reportSkipped(graph);
+    graph.parseDocuments({}, 64, &text);
+    bool ok = text.save(textfile);
+    std::cout << "Indexed " << text.size() << " documents into " << textfile << std::endl;
+    return finish(ok ? 0 : 1);
+  }
+
+  // Full-Text Query
+  if( textquery ){
+    try {
+      textindex text(textfile);
+      for( uint32_t doc : text.query(*textquery) )
+        std::cout << text.docpath(doc) << '\n';
+      std::cout.flush();
+    } catch( std::exception& e ){
+      std::cerr << e.what() << std::endl;
+      return finish(1);
+    }
+    return finish(0);
+  }
+
+  // Duplicate Report, Always From A Fresh Scan So The Hashes Are Current
+  if( duplicates ){
+    docgraph graph;
+    graph.scan_dir(dir);
+    reportSkipped(graph);
+
+    auto printGroup = [&graph](const vector<dochandle>& group) {
+      for( dochandle h : group ){
+        const document& doc = graph.get(h);
+        std::cout << "  " << doc.filepath().string();
+        if( auto hash = doc.contentHash() ){
+          char hex[17];
+          snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)*hash);
+          std::cout << "  " << hex;
+        }
+        std::cout << '\n';
+      }
+    };
+
+    auto same = graph.duplicates();
+    std::cout << same.size() << " groups of identical documents\n";
+    for( auto& group : same ){
+      std::cout << graph.get(group.front()).filename() << '\n';
+      printGroup(group);
+    }
+
+    auto drift = graph.drifted();
+    std::cout << drift.size() << " documents whose copies differ\n";
+    for( auto& group : drift ){
+      std::cout << graph.get(group.front()).filename() << '\n';
+      printGroup(group);
+    }
+    std::cout.flush();
+    return finish(0);
+  }
+
+  // Query Server Daemon
+  if( !socket.empty() ){
+    try {
+      queryserver srv(socket, [dir, graphfile, workers]() {
+        auto graph = std::make_shared<docgraph>();
+        if( !loadGraph(*graph, dir, graphfile, workers) )
+          graph->parseDocuments();
+        return graph;
+      });
+      server = &srv;
+      std::signal(SIGINT, stop_server);
+      std::signal(SIGTERM, stop_server);
+      srv.run();
+      server = nullptr;
+    } catch( std::exception& e ){
+      std::cerr << e.what() << std::endl;
+      return finish(1);
+    }
+    return finish(0);
+  }
+
+  docgraph testdir;
+  bool parsed = loadGraph(testdir, dir, graphfile, workers);
+
+  // Parse Here Instead Of In The GUI When Running Headless, Or When Resolving Up Front
+  if( !parsed && (exportfmt || resolveexact || diffbase || stale || releaseorder) ){
+    scanjob job(testdir, graphfile);
+    job.start();
+    job.wait();
+    parsed = !job.cancelled();
+  }
+
+  if( resolveexact ){
+    size_t added = testdir.resolveExact();
+    std::cout << "Resolved " << added << " references by file name" << std::endl;
+    testdir.save(graphfile);
+  }
+
+  // Stale Reference Report
+  if( stale ){
+    auto found = testdir.staleReferences();
+    std::cout << found.size() << " references to outdated revisions\n";
+    for( const staleref& s : found )
+      std::cout << "  " << testdir.get(s.from).filename() << " -> " << testdir.get(s.to).filename()
+                << " (latest " << testdir.get(s.latest).filename() << ")\n";
+    std::cout.flush();
+    return finish(0);
+  }
+
+  // Update Order
+  if( releaseorder ){
+    releaseplan plan = release_order(testdir);
+    for( size_t w = 0; w < plan.waves.size(); w++ ){
+      std::cout << "Wave " << w + 1 << ", " << plan.waves[w].size() << " documents\n";
+      for( dochandle h : plan.waves[w] )
+        std::cout << "  " << testdir.get(h).filename() << '\n';
+    }
+
+    std::cout << plan.cycles.size() << " groups of documents referencing each other\n";
+    for( auto& cycle : plan.cycles ){
+      for( size_t i = 0; i < cycle.size(); i++ )
+        std::cout << (i ? ", " : "  ") << testdir.get(cycle[i]).filename();
+      std::cout << '\n';
+    }
+
+    std::cout << "Longest chain of references, " << plan.critical_path.size() << " documents\n";
+    for( dochandle h : plan.critical_path )
+      std::cout << "  " << testdir.get(h).filename() << '\n';
+    std::cout.flush();
+    return finish(0);
+  }
+
+  // Changes Since A Baseline
+  if( diffbase ){
+    int ret = 0;
+    try {
+      docgraph base;
+      base.load(*diffbase);
+      print_diff(std::cout, diff_graphs(base, testdir));
+    } catch( std::exception& e ){
+      std::cerr << e.what() << std::endl;
+      ret = 1;
+    }
+    return finish(ret);
+  }
+
+  // Headless Export
+  if( exportfmt ){
+    return finish(export_graph(testdir, *exportfmt, exportfile) ? 0 : 1);
+  }
 
   // Setup Window
   glfwSetErrorCallback(glfw_error_callback);
@@ -50,15 +479,9 @@ int main() {
   ImGui_ImplOpenGL2_Init();
 
 
-  docgraph testdir;
-  testdir.scan_dir("test_dir");
-  
-
-
   // testdir.parseAndConnect();
   
   static bool close = false;
-  bool parsed = false;
 
   // My Program
   while( !glfwWindowShouldClose(window) && !close){
@@ -70,12 +493,20 @@ int main() {
     ImGui::NewFrame();
 
     if( !parsed ){ // Parse/Load Documents First
-      parsed = parseDocs(testdir);
+      parsed = parseDocs(testdir, graphfile);
     }else{ // Do work on parsed docs
       // Actual Drawing Part
       close = menuBar();
 
-      close |= referenceWindow(testdir);
+      close |= referenceWindow(testdir, graphfile);
+
+      graphWindow(testdir);
+
+      searchWindow(testdir);
+
+      staleWindow(testdir);
+
+      textSearchWindow(textfile);
     }
 
 
@@ -93,17 +524,10 @@ int main() {
     glfwSwapBuffers(window);
   }
 
-  for( unsigned i = 0; i < testdir.size(); i++  ){
-    cout << "Printing Out BFS For Document " << testdir.getChild(i)->docname() << endl;
-    for( auto it = testdir.bfsbegin(i); it != testdir.bfsend(); ++it ){
-      cout << "\t" << it->docname() << endl;
-    }
-  }
+  guiShutdown();
 
-  // cout << "Printing out BFS iteration over document 0" << endl;
-  // for( auto it = testdir.bfsbegin(0); it != testdir.bfsend(); ++it ){
-  //   cout << it->filename() << endl;
-  // }
+  // Saved even if parsing was stopped, the next session resumes it
+  testdir.save(graphfile);
 
   // Shutdown ImGUI and Backend
   ImGui_ImplGlfw_Shutdown();
@@ -113,5 +537,5 @@ int main() {
   glfwDestroyWindow(window);
   glfwTerminate();
 
-
+  return finish(0);
 }
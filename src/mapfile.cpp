@@ -0,0 +1,59 @@
+#include "mapfile.hpp"
+
+#include <fstream>
+#include <iostream>
+
+static uint64_t align8(uint64_t off) {
+  return (off + 7) & ~uint64_t(7);
+}
+
+mapfilewriter::mapfilewriter(size_t header_size) : header_size(header_size), cursor(header_size) {}
+
+uint64_t mapfilewriter::place(const void* data, size_t bytes) {
+  uint64_t off = align8(cursor);
+  sections.push_back({off, data, bytes});
+  cursor = off + bytes;
+  return off;
+}
+
+/**
+ * @brief Write the file
+ *
+ * The file is written next to its destination and then renamed over it, so an existing file is
+ * never left half written. The sections are written one after another with zeros between them,
+ * without putting the whole file together in memory first.
+ *
+ * @param file The path of the file to write
+ * @param header The header, of the size the writer was made with
+ * @param what What the file is, for error messages
+ * @returns True if the file was written
+ */
+bool mapfilewriter::save(const path& file, const void* header, std::string_view what) const {
+  static const char ZEROS[8] = {};
+
+  path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+    os.write((const char*)header, header_size);
+    uint64_t written = header_size;
+    for( auto& s : sections ){
+      os.write(ZEROS, s.off - written);
+      if( s.bytes ) os.write((const char*)s.data, s.bytes);
+      written = s.off + s.bytes;
+    }
+    if( !os ){
+      std::cerr << "Unable to write " << what << ' ' << tmp << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, file, ec);
+  if( ec ){
+    std::cerr << "Unable to write " << what << ' ' << file << ": " << ec.message() << std::endl;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+using std::filesystem::path;
+using std::vector;
+
+/**
+ * @brief Lays out and writes a file of sections to be mapped and used in place
+ *
+ * The file starts with a header, and every section placed after it starts on an 8 byte
+ * boundary, so a mapped file can be read through its offsets without copying. Graph snapshots
+ * and full-text indexes are written this way.
+ *
+ * The sections aren't copied: their data must stay alive until the file is written.
+ */
+class mapfilewriter {
+  struct section {
+    uint64_t off;
+    const void* data;
+    size_t bytes;
+  };
+
+  size_t header_size;
+  uint64_t cursor;
+  vector<section> sections;
+
+  public:
+    // Start a file whose header is the given number of bytes
+    explicit mapfilewriter(size_t header_size);
+
+    // Place a section after the ones before it. Returns its offset in the file.
+    uint64_t place(const void* data, size_t bytes);
+
+    template<typename T>
+    uint64_t place(const vector<T>& items) {
+      return place(items.data(), items.size() * sizeof(T));
+    }
+
+    // Size of the file with every section placed so far
+    uint64_t size() const {
+      return cursor;
+    }
+
+    // Write the header and the sections, replacing the file at once. Returns false on errors,
+    // naming the file as what in the message.
+    bool save(const path& file, const void* header, std::string_view what) const;
+};
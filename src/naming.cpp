@@ -0,0 +1,259 @@
+#include "naming.hpp"
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+// Units a pattern may have, one bit each in a DFA state's set
+static constexpr size_t MAX_UNITS = 63;
+// DFA states a pattern may compile to
+static constexpr size_t MAX_STATES = 4096;
+
+static std::array<bool, 256> fieldClass(namingscheme::fieldkind kind) {
+  std::array<bool, 256> cls{};
+  for( int c = 0; c < 256; c++ ){
+    bool digit = c >= '0' && c <= '9';
+    bool alpha = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    switch( kind ){
+      case namingscheme::SUBSYSTEM:
+      case namingscheme::REVISION:
+        cls[c] = digit;
+        break;
+      case namingscheme::SUBSYSTEM_NAME:
+        cls[c] = digit || alpha;
+        break;
+      case namingscheme::NAME:
+      case namingscheme::ANY:
+        cls[c] = c != '\n' && c != '/' && c != '\0';
+        break;
+      case namingscheme::LITERAL:
+        break;
+    }
+  }
+  return cls;
+}
+
+namingscheme::namingscheme(std::string_view pattern) : source(pattern) {
+  static const std::map<std::string_view, fieldkind> FIELDS = {
+    {"subsystem", SUBSYSTEM}, {"subsystem_name", SUBSYSTEM_NAME}, {"revision", REVISION},
+    {"name", NAME}, {"any", ANY},
+  };
+
+  auto bad = [&](const string& why) {
+    return std::invalid_argument("Naming scheme \"" + source + "\": " + why);
+  };
+
+  size_t count[ANY + 1] = {};
+  for( size_t i = 0; i < pattern.size(); i++ ){
+    char c = pattern[i];
+    if( (c == '{' || c == '}') && i + 1 < pattern.size() && pattern[i + 1] == c ){
+      i++;
+    }else if( c == '{' ){
+      size_t end = pattern.find('}', i);
+      if( end == std::string_view::npos )
+        throw bad("unclosed {");
+      auto field = FIELDS.find(pattern.substr(i + 1, end - i - 1));
+      if( field == FIELDS.end() )
+        throw bad("unknown field {" + string(pattern.substr(i + 1, end - i - 1)) + "}");
+      units.push_back({field->second, fieldClass(field->second)});
+      count[field->second]++;
+      i = end;
+      continue;
+    }else if( c == '}' ){
+      throw bad("unmatched }");
+    }
+
+    unit lit{LITERAL, {}};
+    lit.accepts[(unsigned char)c] = true;
+    units.push_back(lit);
+  }
+
+  if( count[NAME] != 1 )
+    throw bad("needs exactly one {name}");
+  if( count[SUBSYSTEM] + count[SUBSYSTEM_NAME] > 1 || count[REVISION] > 1 )
+    throw bad("a subsystem or revision can only be given once");
+  if( units.size() > MAX_UNITS )
+    throw bad("longer than " + std::to_string(MAX_UNITS) + " characters and fields");
+
+  compile();
+}
+
+/**
+ * @brief Build the DFA by subset construction
+ *
+ * NFA state k means the first k units are matched, and the last of them may go on matching if
+ * it's a field. So on a byte, state k goes to state k if unit k-1 is a field accepting it, and
+ * to state k+1 if unit k accepts it.
+ */
+void namingscheme::compile() {
+  // Group the bytes that no unit tells apart
+  std::map<vector<bool>, uint8_t> signatures;
+  for( int c = 0; c < 256; c++ ){
+    vector<bool> sig;
+    for( auto& u : units )
+      sig.push_back(u.accepts[c]);
+    auto [it, added] = signatures.emplace(std::move(sig), signatures.size());
+    byteclass[c] = it->second;
+  }
+  classes = signatures.size();
+
+  // One representative byte per class
+  vector<int> rep(classes);
+  for( int c = 255; c >= 0; c-- )
+    rep[byteclass[c]] = c;
+
+  const size_t n = units.size();
+  auto step = [&](uint64_t set, int c) {
+    uint64_t out = 0;
+    for( size_t k = 0; k <= n; k++ ){
+      if( !(set >> k & 1) ) continue;
+      if( k > 0 && units[k - 1].kind != LITERAL && units[k - 1].accepts[c] )
+        out |= uint64_t(1) << k;
+      if( k < n && units[k].accepts[c] )
+        out |= uint64_t(1) << (k + 1);
+    }
+    return out;
+  };
+
+  std::map<uint64_t, int32_t> ids;
+  auto state = [&](uint64_t set) -> int32_t {
+    auto [it, added] = ids.emplace(set, (int32_t)nfa.size());
+    if( added ){
+      if( nfa.size() == MAX_STATES )
+        throw std::invalid_argument("Naming scheme \"" + source + "\" is too complex to compile");
+      nfa.push_back(set);
+      accepting.push_back(set >> n & 1);
+    }
+    return it->second;
+  };
+
+  state(1);
+  for( size_t s = 0; s < nfa.size(); s++ ){
+    next.resize((s + 1) * classes);
+    for( size_t cls = 0; cls < classes; cls++ ){
+      uint64_t to = step(nfa[s], rep[cls]);
+      next[s * classes + cls] = to ? state(to) : -1;
+    }
+  }
+}
+
+std::optional<namefields> namingscheme::match(std::string_view filename, string* why) const {
+  // The DFA state before each byte, and the field each byte ends up in
+  thread_local vector<int32_t> trail;
+  trail.resize(filename.size() + 1);
+
+  int32_t s = 0;
+  trail[0] = s;
+  for( size_t i = 0; i < filename.size(); i++ ){
+    s = next[s * classes + byteclass[(unsigned char)filename[i]]];
+    if( s < 0 ) return std::nullopt;
+    trail[i + 1] = s;
+  }
+  if( !accepting[s] ) return std::nullopt;
+
+  // Walk back from the end. Byte i-1 took the NFA from some state q in the set before it to
+  // state k, and belongs to unit k-1. q is k-1 if unit k-1 starts there, or k if it carried on;
+  // starting units as late as possible leaves the earlier fields as long as possible.
+  std::array<size_t, MAX_UNITS> ustart, uend;
+  uend.fill(std::string_view::npos);
+  size_t k = units.size();
+  for( size_t i = filename.size(); i > 0; i-- ){
+    if( uend[k - 1] == std::string_view::npos )
+      uend[k - 1] = i;
+    ustart[k - 1] = i - 1;
+
+    if( nfa[trail[i - 1]] >> (k - 1) & 1 )
+      k--;
+  }
+
+  namefields fields;
+  for( size_t u = 0; u < units.size(); u++ ){
+    std::string_view text = filename.substr(ustart[u], uend[u] - ustart[u]);
+    switch( units[u].kind ){
+      case SUBSYSTEM: {
+        auto num = parse_number(text);
+        auto sys = num ? subsystem_from_number(num->first) : std::nullopt;
+        if( !sys ){
+          if( why ) *why = "Invalid system number " + string(text);
+          return std::nullopt;
+        }
+        fields.subsys = *sys;
+        break;
+      }
+      case SUBSYSTEM_NAME: {
+        auto sys = subsystem_from_name(text);
+        if( !sys ){
+          if( why ) *why = "Unknown subsystem " + string(text);
+          return std::nullopt;
+        }
+        fields.subsys = *sys;
+        break;
+      }
+      case REVISION: {
+        auto num = parse_number(text);
+        if( !num ){
+          if( why ) *why = "Revision number " + string(text) + " is too large";
+          return std::nullopt;
+        }
+        fields.revision = num->first;
+        break;
+      }
+      case NAME:
+        fields.name = text;
+        break;
+      case LITERAL:
+      case ANY:
+        break;
+    }
+  }
+  return fields;
+}
+
+static vector<namingscheme>& schemes() {
+  static vector<namingscheme> list = {namingscheme(DEFAULT_NAMING_SCHEME)};
+  return list;
+}
+
+void naming_set(const vector<string>& patterns) {
+  vector<namingscheme> list;
+  for( auto& p : patterns )
+    list.emplace_back(p);
+  if( list.empty() )
+    list.emplace_back(DEFAULT_NAMING_SCHEME);
+  schemes() = std::move(list);
+}
+
+vector<string> naming_read(const path& file) {
+  std::ifstream in(file);
+  if( !in )
+    throw std::invalid_argument("Unable to read naming schemes from " + file.string());
+
+  vector<string> patterns;
+  string line;
+  while( std::getline(in, line) ){
+    while( !line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t') )
+      line.pop_back();
+    size_t first = line.find_first_not_of(" \t");
+    if( first == string::npos || line[first] == '#' ) continue;
+    patterns.push_back(line.substr(first));
+  }
+  return patterns;
+}
+
+const vector<namingscheme>& naming_schemes() {
+  return schemes();
+}
+
+std::optional<namefields> naming_match(std::string_view filename, string& why) {
+  why.clear();
+  for( const namingscheme& scheme : schemes() ){
+    string refused;
+    if( auto fields = scheme.match(filename, &refused) )
+      return fields;
+    if( why.empty() )
+      why = refused;
+  }
+  if( why.empty() )
+    why = "File name doesn't match any naming scheme";
+  return std::nullopt;
+}
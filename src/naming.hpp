@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "subsystems.hpp"
+
+using std::filesystem::path;
+using std::string;
+using std::vector;
+
+// What a document's file name says about it
+struct namefields {
+  SUBSYSTEMS subsys = SUBSYSTEMS::SYSTEMS;
+  uint32_t revision = 0;
+  std::string_view name; ///< Points into the file name that was matched
+};
+
+/**
+ * @brief A file naming convention, compiled once into a DFA
+ *
+ * A pattern is literal text with fields in braces, matched against a whole file name:
+ *
+ *   {subsystem}       A subsystem number, such as 01
+ *   {subsystem_name}  A subsystem name without punctuation, such as GOES or ADSB
+ *   {revision}        A revision number
+ *   {name}            The document's name, one or more of any character. Required.
+ *   {any}             One or more of any character, ignored
+ *
+ * "{{" and "}}" are literal braces. Fields which are left out are subsystem 0 and revision 0.
+ * The default scheme, REGS-{subsystem}-R{revision}-{name}, matches what the old
+ * "REGS-(\d+)-R(\d+)-(.+)" regex did.
+ *
+ * Matching runs the DFA over the name once, remembering its states, then walks them back to
+ * find where each field is. When a name splits into fields more than one way, earlier fields
+ * are as long as they can be, as with a greedy regex.
+ */
+class namingscheme {
+  public:
+    enum fieldkind : uint8_t { LITERAL, SUBSYSTEM, SUBSYSTEM_NAME, REVISION, NAME, ANY };
+
+  private:
+    struct unit {
+      fieldkind kind;
+      std::array<bool, 256> accepts;
+    };
+
+    string source;
+    vector<unit> units;       // The pattern, one literal character or field per unit
+    uint8_t byteclass[256];   // Bytes every unit treats the same share a class
+    size_t classes = 0;
+    vector<int32_t> next;     // DFA transitions, state * classes + class. -1 is no match.
+    vector<uint64_t> nfa;     // The set of units each DFA state stands for, as a bitmask
+    vector<bool> accepting;
+
+    void compile();
+
+  public:
+    // @throws invalid_argument if the pattern is malformed or too large to compile
+    explicit namingscheme(std::string_view pattern);
+
+    const string& pattern() const {
+      return source;
+    }
+
+    /**
+     * @brief Match a whole file name
+     *
+     * @param filename The file name, without directories
+     * @param why Set to why a name of the right shape was still refused, such as an unknown
+     *            subsystem number. Left alone if the name doesn't have the shape at all.
+     * @returns The fields, or nothing if the name doesn't match
+     */
+    std::optional<namefields> match(std::string_view filename, string* why = nullptr) const;
+};
+
+// The pattern documents were named with before schemes were configurable
+inline constexpr std::string_view DEFAULT_NAMING_SCHEME = "REGS-{subsystem}-R{revision}-{name}";
+
+// Use these schemes, tried in order, for documents made from now on. Set them before scanning.
+// @throws invalid_argument if a pattern is malformed
+void naming_set(const vector<string>& patterns);
+
+// Read the schemes from a file, one pattern per line. Blank lines and lines starting with # are skipped.
+// @throws invalid_argument if the file can't be read or a pattern is malformed
+vector<string> naming_read(const path& file);
+
+// The schemes in use, the default one unless naming_set() was called
+const vector<namingscheme>& naming_schemes();
+
+/**
+ * @brief Match a file name against every scheme in use
+ *
+ * @param filename The file name, without directories
+ * @param why Set to why the name was refused, if it was
+ * @returns The fields from the first scheme that matches
+ */
+std::optional<namefields> naming_match(std::string_view filename, string& why);
+
+// A file that was left out of the graph, and why
+struct namediagnostic {
+  path file;
+  string reason;
+};
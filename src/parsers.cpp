@@ -1,5 +1,14 @@
 #include "document.hpp"
+#include "parsers.hpp"
 #include "utils.hpp"
+#include "zip.hpp"
+#include "budget.hpp"
+#include "naming.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "xmlarena.hpp"
+#include <algorithm>
+#include <cctype>
 #include <cstddef>
 #include <cstdio>
 #include <fstream>
@@ -10,8 +19,11 @@
 #include <optional>
 #include <vector>
 #include <cstring>
+#include <deque>
 #include <functional>
 #include <regex>
+#include <map>
+#include <set>
 
 /**
  * @brief A basic RAII wrapper for the xmlChar* strings
@@ -61,7 +73,7 @@ class xmlString {
       string me((char*)ptr);
       xmlFree(ptr);
       me += other;
-      ptr = (xmlChar*)xmlMemMalloc(me.size() + 1);
+      ptr = (xmlChar*)xmlMalloc(me.size() + 1); // Freed with xmlFree, so from the same allocator
       memcpy(ptr, me.data(), me.size()+1);
       
       return *this;
@@ -136,56 +148,167 @@ std::optional<std::vector<xmlNodePtr>> getAllInnerTextRun(xmlNodePtr root) {
 }
 
 /**
- * @brief Takes a vector of <w:t> nodes and concatenates their contents into one string
+ * @brief Takes a vector of <w:t> nodes and concatenates their contents into a string
  *
  * @author Gaultier Delbarre
  * @date 9/15/2022
  *
  * @param doc The document pointer
  * @param nodes Vector of <w:t> node pointers
- * @returns the created string
+ * @param result Replaced with the text. Reusing it between paragraphs saves allocating.
  */
-string concatTextNodes(xmlDocPtr doc, std::vector<xmlNodePtr> &nodes) {
-  string result;
+void concatTextNodes(xmlDocPtr doc, std::vector<xmlNodePtr> &nodes, string& result) {
+  result.clear();
   for( auto node : nodes ){
     xmlString str = xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-    result += str;
+    if( str ) result += (const char*)str.get();
+  }
+}
+
+/**
+ * @brief Tells which paragraph styles of a word document are headings
+ *
+ * Style ids such as "Heading1" are recognised directly. Documents from other locales or tools
+ * use their own style ids, so for those the style names are looked up in word/styles.xml.
+ * It's only read the first time an unknown style id comes up.
+ */
+class headingStyles {
+  std::function<std::optional<string>()> loadStyles;
+  std::optional<std::set<string>> styles;
+
+  static bool isHeadingName(string name) {
+    std::transform(name.begin(), name.end(), name.begin(), [](char c){return std::tolower(c);});
+    return name.rfind("heading", 0) == 0 || name == "title";
   }
 
-  return result;
+  // Get every paragraph style id in styles.xml whose name is a heading, or that sets an outline level
+  void parseStyles() {
+    styles.emplace();
+
+    auto xml = loadStyles();
+    if( !xml ) return;
+
+    xmlDocPtr doc = xmlReadMemory(xml->data(), xml->size(), "styles.xml", NULL, 0);
+    if( doc == NULL ) return;
+
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    for( xmlNodePtr style = root ? root->children : NULL; style != NULL; style = style->next ){
+      if( xmlStrcmp(style->name, (const xmlChar*)"style") ) continue;
+
+      xmlString id = xmlGetProp(style, (const xmlChar*)"styleId");
+      if( !id ) continue;
+
+      for( xmlNodePtr prop = style->children; prop != NULL; prop = prop->next ){
+        bool heading = false;
+        if( !xmlStrcmp(prop->name, (const xmlChar*)"name") ){
+          xmlString name = xmlGetProp(prop, (const xmlChar*)"val");
+          heading = name && isHeadingName(name);
+        }else if( !xmlStrcmp(prop->name, (const xmlChar*)"pPr") ){
+          for( xmlNodePtr ppr = prop->children; ppr != NULL; ppr = ppr->next )
+            heading |= !xmlStrcmp(ppr->name, (const xmlChar*)"outlineLvl");
+        }
+
+        if( heading ){
+          styles->insert(id);
+          break;
+        }
+      }
+    }
+
+    xmlFreeDoc(doc);
+  }
+
+  public:
+    explicit headingStyles(std::function<std::optional<string>()> loadStyles)
+      : loadStyles(loadStyles) {}
+
+    /**
+     * @brief Check whether a <w:p> paragraph is a heading, from its style or outline level
+     */
+    bool isHeading(xmlNodePtr para) {
+      for( xmlNodePtr ppr = para->children; ppr != NULL; ppr = ppr->next ){
+        if( xmlStrcmp(ppr->name, (const xmlChar*)"pPr") ) continue;
+
+        for( xmlNodePtr prop = ppr->children; prop != NULL; prop = prop->next ){
+          if( !xmlStrcmp(prop->name, (const xmlChar*)"outlineLvl") )
+            return true;
+
+          if( !xmlStrcmp(prop->name, (const xmlChar*)"pStyle") ){
+            xmlString id = xmlGetProp(prop, (const xmlChar*)"val");
+            if( !id ) return false;
+            if( isHeadingName(id) ) return true;
+
+            if( !styles ) parseStyles();
+            return styles->count(id) != 0;
+          }
+        }
+      }
+
+      return false;
+    }
+};
+
+/**
+ * @brief Match "\\s*(.+)" against a whole string, the way std::regex would
+ *
+ * @returns The (.+) group, or nothing if there is no match
+ */
+static std::optional<std::string_view> matchReference(std::string_view s) {
+  size_t i = 0;
+  while( i < s.size() && std::isspace((unsigned char)s[i]) ) i++;
+
+  // If the spaces took everything, the last one is given back to (.+)
+  std::string_view m = i < s.size() ? s.substr(i) : i > 0 ? s.substr(i - 1) : std::string_view();
+
+  // '.' matches anything but line terminators
+  if( m.empty() || m.find_first_of("\n\r") != std::string_view::npos )
+    return std::nullopt;
+  return m;
 }
 
 /**
- * @brief Special parser for word XML documents
+ * @brief Strip the "[n]" numbering off a reference and add it to a list, unless it's blank
  *
- * @author Gaultier Delbarre
- * @date 9/15/2022
+ * Does what matching "^(\\[\\d+\\])?\\s*(.+)" and keeping the second group did, without copying.
+ */
+static void addReference(reflist& references, std::string_view ref) {
+  if( ref.size() > 2 && ref[0] == '[' ){
+    size_t i = 1;
+    while( i < ref.size() && std::isdigit((unsigned char)ref[i]) ) i++;
+    if( i > 1 && i < ref.size() && ref[i] == ']' ){
+      if( auto m = matchReference(ref.substr(i + 1)) ){
+        references.push_back(*m);
+        return;
+      }
+    }
+  }
+
+  if( auto m = matchReference(ref) )
+    references.push_back(*m);
+}
+
+/**
+ * @brief Find the references section of a parsed word XML document and extract its entries
+ *
+ * The references section starts after the last heading mentioning "Reference". If no heading
+ * does, the last paragraph mentioning it is used instead.
  *
+ * @param doc The parsed word/document.xml
+ * @param headings Tells which paragraphs are headings
  * @returns A vector containing all the refrences in the document
  */
-template<> 
-vector<string> document::parseReferences<WORD_XML>() const {
-  auto docxml = unzip_file(file, "word/document.xml");
-  if( !docxml ){
-    std::cerr << "Unable to unzip DOCX file " << file.filename() << std::endl;
-    return {};
-  }
+static reflist extractWordReferences(xmlDocPtr doc, headingStyles& headings) {
+  STATS_SCOPE(EXTRACT);
+  STATS_ADD(DOCUMENTS_PARSED, 1);
 
-  // Parse XML here
-  xmlDocPtr doc;
   xmlNodePtr cur;
 
-  doc = xmlParseFile(docxml->c_str());
-  if( doc == NULL ){
-    std::cerr << "Document " << *docxml << " not successfully parsed" << std::endl;
-    return {};
-  }
-
   // Get Root Node
   cur = xmlDocGetRootElement(doc);
 
   if( cur == NULL ){
-    std::cerr << "Empty XML file: " << *docxml << std::endl;
+    std::cerr << "Empty XML file" << std::endl;
+    return {};
   }
 
 
@@ -207,17 +330,24 @@ vector<string> document::parseReferences<WORD_XML>() const {
 
     cur = cur->next;
   }
+  STATS_ADD(PARAGRAPHS_VISITED, paragraphs.size());
   
 
   // Find reference node
   xmlNodePtr ref = NULL;
+  xmlNodePtr fallback = NULL;
+  string txt;
   for( auto it = paragraphs.rbegin(); it != paragraphs.rend(); ++it ){
     auto nodes = getAllInnerTextRun(*it);
     if( nodes ){
-      string txt = concatTextNodes(doc, *nodes);
+      concatTextNodes(doc, *nodes, txt);
       if( txt.find("Reference") != string::npos ) {
-        ref = *it;
-        break;
+        if( fallback == NULL )
+          fallback = *it;
+        if( headings.isHeading(*it) ){
+          ref = *it;
+          break;
+        }
       }
     }
     // auto txtnode = getInnerTextRun(*it);
@@ -230,6 +360,10 @@ vector<string> document::parseReferences<WORD_XML>() const {
     // }    
   }
   
+  // No heading mentions references, use the last paragraph that does
+  if( ref == NULL )
+    ref = fallback;
+
   // Reference node not found
   if( ref == NULL ){
     std::cerr << "Unable to find references section in word document!" << std::endl;
@@ -238,13 +372,13 @@ vector<string> document::parseReferences<WORD_XML>() const {
 
   // Get all actual references
   ref = ref->next;
-  vector<string> references;
+  reflist references;
 
   while( ref != NULL ){
     auto nodes = getAllInnerTextRun(ref);
     if( nodes ){
-      string txt = concatTextNodes(doc, *nodes);
-      references.push_back(txt);
+      concatTextNodes(doc, *nodes, txt);
+      addReference(references, txt);
     }else{
       break;
     }
@@ -260,20 +394,510 @@ vector<string> document::parseReferences<WORD_XML>() const {
     ref = ref->next;
   }
 
-  // Clean Up Reference Strings
-  const std::regex REFCLEAN("^(\\[\\d+\\])?\\s*(.+)");
-  std::smatch m;
-  auto it = references.begin();
-  while( it != references.end() ){
-    if( std::regex_match(*it, m, REFCLEAN) ){
+  return references;
+}
+
+
+/**
+ * @brief Append the text of every <w:t> under a node
+ */
+static void collectText(xmlNodePtr node, string& out) {
+  for( node = node->children; node != NULL; node = node->next ){
+    if( !xmlStrcmp(node->name, (const xmlChar*)"t") ){
+      for( xmlNodePtr txt = node->children; txt != NULL; txt = txt->next )
+        if( txt->type == XML_TEXT_NODE && txt->content )
+          out += (const char*)txt->content;
+    }else{
+      collectText(node, out);
+    }
+  }
+}
+
+/**
+ * @brief Pass the text of every paragraph in the document, tables included, to a callback
+ *
+ * A paragraph's runs are joined first, since Word often splits a word across runs.
+ */
+static void extractWordText(xmlNodePtr node, const paragraphfn& paragraph, string& text) {
+  for( node = node->children; node != NULL; node = node->next ){
+    if( !xmlStrcmp(node->name, (const xmlChar*)"p") ){
+      text.clear();
+      collectText(node, text);
+      if( !text.empty() )
+        paragraph(text);
+    }else{
+      extractWordText(node, paragraph, text);
+    }
+  }
+}
+
+/**
+ * @brief Parse an XML archive entry, timing and tracing it
+ *
+ * @returns Nothing if the XML isn't well formed
+ */
+static xmlDocPtr parseXML(std::string_view xml, const char* name, const path& file) {
+  STATS_SCOPE(XML_PARSE);
+  TRACE_SCOPE("xml_parse", file.native());
+  xmlDocPtr doc = xmlReadMemory(xml.data(), xml.size(), name, NULL, 0);
+  if( doc == NULL )
+    std::cerr << "Document " << file.filename() << " not successfully parsed" << std::endl;
+  return doc;
+}
 
-      *it = m[2];
+/**
+ * @brief Parser for word XML documents
+ *
+ * @author Gaultier Delbarre
+ * @date 9/15/2022
+ *
+ * @param file The document
+ * @param contents The contents of word/document.xml
+ * @param paragraph If set, called with the text of every paragraph, from the same parse
+ * @returns A vector containing all the refrences in the document
+ */
+static reflist parseWord(const path& file, std::string_view contents, const paragraphfn& paragraph) {
+  xmlDocPtr doc = parseXML(contents, "document.xml", file);
+  if( doc == NULL )
+    return {};
+
+  if( paragraph ){
+    TRACE_SCOPE("extract_text", file.native());
+    string text;
+    if( xmlNodePtr root = xmlDocGetRootElement(doc) )
+      extractWordText(root, paragraph, text);
+  }
 
-      it++;
+  headingStyles headings([file]() { return unzip_file(file, "word/styles.xml"); });
+  reflist refs;
+  {
+    TRACE_SCOPE("extract_references", file.native());
+    refs = extractWordReferences(doc, headings);
+  }
+
+  xmlFreeDoc(doc);
+  return refs;
+}
+
+/**
+ * @brief A paragraph of a document in a format without Word's heading styles
+ */
+struct textparagraph {
+  string text;
+  bool heading;
+};
+
+/**
+ * @brief Append all text under a node. Spacing elements (ODF's <text:s>, tabs, breaks) become spaces.
+ */
+static void collectAllText(xmlNodePtr node, string& out) {
+  for( node = node->children; node != NULL; node = node->next ){
+    if( node->type == XML_TEXT_NODE && node->content ){
+      out += (const char*)node->content;
+    }else if( !xmlStrcmp(node->name, (const xmlChar*)"s") || !xmlStrcmp(node->name, (const xmlChar*)"tab")
+           || !xmlStrcmp(node->name, (const xmlChar*)"line-break") || !xmlStrcmp(node->name, (const xmlChar*)"br") ){
+      out += ' ';
     }else{
-      it = references.erase(it);
+      collectAllText(node, out);
     }
   }
+}
+
+/**
+ * @brief Find the references in a list of paragraphs, the way they're found in word documents
+ *
+ * The references are the paragraphs after the last heading mentioning "Reference", or after
+ * the last paragraph mentioning it if no heading does, up to the next heading or blank paragraph.
+ */
+static reflist referencesAfterHeading(const vector<textparagraph>& paragraphs) {
+  STATS_SCOPE(EXTRACT);
+  STATS_ADD(DOCUMENTS_PARSED, 1);
+  STATS_ADD(PARAGRAPHS_VISITED, paragraphs.size());
+
+  std::optional<size_t> ref, fallback;
+  for( size_t i = paragraphs.size(); i-- > 0; ){
+    if( paragraphs[i].text.find("Reference") == string::npos ) continue;
+    if( !fallback ) fallback = i;
+    if( paragraphs[i].heading ){
+      ref = i;
+      break;
+    }
+  }
+  if( !ref ) ref = fallback;
+  if( !ref ){
+    std::cerr << "Unable to find references section in document!" << std::endl;
+    return {};
+  }
+
+  reflist references;
+  for( size_t i = *ref + 1; i < paragraphs.size() && !paragraphs[i].heading && !paragraphs[i].text.empty(); i++ )
+    addReference(references, paragraphs[i].text);
 
   return references;
 }
+
+/**
+ * @brief Collect the paragraphs of an OpenDocument text body. <text:h> elements are headings.
+ */
+static void collectODTParagraphs(xmlNodePtr node, vector<textparagraph>& out) {
+  for( node = node->children; node != NULL; node = node->next ){
+    bool heading = !xmlStrcmp(node->name, (const xmlChar*)"h");
+    if( heading || !xmlStrcmp(node->name, (const xmlChar*)"p") ){
+      textparagraph para = {"", heading};
+      collectAllText(node, para.text);
+      out.push_back(std::move(para));
+    }else if( node->type == XML_ELEMENT_NODE ){
+      collectODTParagraphs(node, out);
+    }
+  }
+}
+
+/**
+ * @brief Parser for OpenDocument text documents
+ *
+ * @param file The document
+ * @param contents The contents of content.xml
+ * @param paragraph If set, called with the text of every paragraph
+ * @returns The references in the document
+ */
+static reflist parseODT(const path& file, std::string_view contents, const paragraphfn& paragraph) {
+  xmlDocPtr doc = parseXML(contents, "content.xml", file);
+  if( doc == NULL )
+    return {};
+
+  vector<textparagraph> paragraphs;
+  if( xmlNodePtr root = xmlDocGetRootElement(doc) )
+    collectODTParagraphs(root, paragraphs);
+  xmlFreeDoc(doc);
+
+  if( paragraph )
+    for( auto& p : paragraphs )
+      if( !p.text.empty() ) paragraph(p.text);
+
+  TRACE_SCOPE("extract_references", file.native());
+  return referencesAfterHeading(paragraphs);
+}
+
+/**
+ * @brief Whether a <p:sp> shape is a slide's title placeholder
+ */
+static bool isTitleShape(xmlNodePtr shape) {
+  for( xmlNodePtr nv = shape->children; nv != NULL; nv = nv->next ){
+    if( xmlStrcmp(nv->name, (const xmlChar*)"nvSpPr") ) continue;
+    for( xmlNodePtr pr = nv->children; pr != NULL; pr = pr->next ){
+      if( xmlStrcmp(pr->name, (const xmlChar*)"nvPr") ) continue;
+      for( xmlNodePtr ph = pr->children; ph != NULL; ph = ph->next ){
+        if( xmlStrcmp(ph->name, (const xmlChar*)"ph") ) continue;
+        xmlString type = xmlGetProp(ph, (const xmlChar*)"type");
+        return type && (string(type) == "title" || string(type) == "ctrTitle");
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Collect the <a:p> paragraphs of a slide. Paragraphs of the title placeholder are headings.
+ */
+static void collectSlideParagraphs(xmlNodePtr node, bool title, vector<textparagraph>& out) {
+  for( node = node->children; node != NULL; node = node->next ){
+    if( node->type != XML_ELEMENT_NODE ) continue;
+
+    if( !xmlStrcmp(node->name, (const xmlChar*)"p") ){
+      textparagraph para = {"", title};
+      collectText(node, para.text);
+      out.push_back(std::move(para));
+    }else{
+      bool shape = !xmlStrcmp(node->name, (const xmlChar*)"sp");
+      collectSlideParagraphs(node, shape ? isTitleShape(node) : title, out);
+    }
+  }
+}
+
+// Namespace of the r:id attributes pointing into a part's relationships
+static const xmlChar* RELATIONSHIPS_NS = (const xmlChar*)"http://schemas.openxmlformats.org/officeDocument/2006/relationships";
+
+/**
+ * @brief Find a presentation's slides, in the order they're shown
+ *
+ * The order is the one of the <p:sldId> elements of ppt/presentation.xml, whose r:id attributes
+ * name relationships in ppt/_rels/presentation.xml.rels pointing at the slide entries.
+ *
+ * @param file The presentation, for error messages
+ * @param presentation The contents of ppt/presentation.xml
+ * @param rels The contents of ppt/_rels/presentation.xml.rels
+ * @returns The archive entries of the slides
+ */
+static vector<string> slideEntries(const path& file, std::string_view presentation, std::string_view rels) {
+  std::map<string, string> targets;
+  if( xmlDocPtr doc = parseXML(rels, "presentation.xml.rels", file) ){
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    for( xmlNodePtr rel = root ? root->children : NULL; rel != NULL; rel = rel->next ){
+      if( rel->type != XML_ELEMENT_NODE || xmlStrcmp(rel->name, (const xmlChar*)"Relationship") ) continue;
+      xmlString id = xmlGetProp(rel, (const xmlChar*)"Id");
+      xmlString target = xmlGetProp(rel, (const xmlChar*)"Target");
+      if( !id || !target ) continue;
+      // Targets are relative to ppt/, unless they start at the root of the archive
+      string t(target);
+      targets[string(id)] = t[0] == '/' ? t.substr(1) : "ppt/" + t;
+    }
+    xmlFreeDoc(doc);
+  }
+
+  vector<string> slides;
+  xmlDocPtr doc = parseXML(presentation, "presentation.xml", file);
+  if( doc == NULL )
+    return slides;
+
+  std::function<void(xmlNodePtr)> walk = [&](xmlNodePtr node) {
+    for( ; node != NULL; node = node->next ){
+      if( node->type != XML_ELEMENT_NODE ) continue;
+      if( !xmlStrcmp(node->name, (const xmlChar*)"sldId") ){
+        xmlString id = xmlGetNsProp(node, (const xmlChar*)"id", RELATIONSHIPS_NS);
+        auto it = id ? targets.find(string(id)) : targets.end();
+        if( it != targets.end() )
+          slides.push_back(it->second);
+      }else{
+        walk(node->children);
+      }
+    }
+  };
+  walk(xmlDocGetRootElement(doc));
+  xmlFreeDoc(doc);
+  return slides;
+}
+
+/**
+ * @brief Parser for PowerPoint XML presentations
+ *
+ * Slides are read in the order of the presentation, or by their numbers if it has no slide
+ * list, and treated as one document whose slide titles are its headings, so a "References"
+ * slide works like a references section. The archive is opened once for all of its slides,
+ * and each slide is charged to the memory budget while it's held.
+ *
+ * @param file The presentation
+ * @param contents The contents of ppt/presentation.xml, with the order of the slides
+ * @param paragraph If set, called with the text of every paragraph
+ * @returns The references in the presentation
+ */
+static reflist parsePPTX(const path& file, std::string_view contents, const paragraphfn& paragraph) {
+  ziparchive archive(file);
+  if( !archive.is_open() )
+    return {};
+
+  auto rels = archive.read("ppt/_rels/presentation.xml.rels");
+  vector<string> slides = rels ? slideEntries(file, contents, *rels) : vector<string>();
+
+  // Without a slide list, go by the numbers of the ppt/slides/slideN.xml entries
+  if( slides.empty() ){
+    vector<std::pair<unsigned, string>> numbered;
+    const std::regex SLIDE("ppt/slides/slide(\\d+)\\.xml");
+    std::smatch m;
+    for( auto& name : archive.entries() )
+      if( std::regex_match(name, m, SLIDE) )
+        numbered.push_back({(unsigned)std::stoul(m[1]), name});
+    std::sort(numbered.begin(), numbered.end());
+    for( auto& [n, name] : numbered )
+      slides.push_back(std::move(name));
+  }
+
+  bytesemaphore* budget = memory_budget();
+  vector<textparagraph> paragraphs;
+  for( auto& name : slides ){
+    auto ent = archive.entry(name);
+    if( !ent || !zip_entry_size_ok(*ent) ) continue;
+
+    // The slide is already part of a document being read, so its memory is taken without waiting
+    size_t charge = ent->compressed_size + ent->uncompressed_size;
+    if( budget ) budget->force(charge);
+
+    size_t first = paragraphs.size();
+    auto xml = archive.read(name);
+    if( xmlDocPtr doc = xml ? parseXML(*xml, "slide.xml", file) : NULL ){
+      if( xmlNodePtr root = xmlDocGetRootElement(doc) )
+        collectSlideParagraphs(root, false, paragraphs);
+      xmlFreeDoc(doc);
+    }
+    if( budget ) budget->release(charge);
+
+    // A slide's text ends at the slide, don't run its list on into the next one
+    if( paragraphs.size() > first )
+      paragraphs.push_back({"", false});
+  }
+
+  if( paragraph )
+    for( auto& p : paragraphs )
+      if( !p.text.empty() ) paragraph(p.text);
+
+  TRACE_SCOPE("extract_references", file.native());
+  return referencesAfterHeading(paragraphs);
+}
+
+/**
+ * @brief Find the document a workbook cell names, such as "[3] REGS-01-R0-GOES ICD"
+ *
+ * The cell's text, without its "[n]" numbering and the spaces around it, has to match one of
+ * the naming schemes in use, see naming_match().
+ *
+ * @returns The name, pointing into the cell's text, or nothing if the cell names no document
+ */
+static std::optional<std::string_view> cellDocName(std::string_view text) {
+  auto trim = [](std::string_view s) {
+    while( !s.empty() && std::isspace((unsigned char)s.front()) ) s.remove_prefix(1);
+    while( !s.empty() && std::isspace((unsigned char)s.back()) ) s.remove_suffix(1);
+    return s;
+  };
+
+  text = trim(text);
+  if( text.size() > 2 && text[0] == '[' ){
+    size_t i = 1;
+    while( i < text.size() && std::isdigit((unsigned char)text[i]) ) i++;
+    if( i > 1 && i < text.size() && text[i] == ']' )
+      text = trim(text.substr(i + 1));
+  }
+
+  string why;
+  if( text.empty() || text.find_first_of("\n\r") != std::string_view::npos || !naming_match(text, why) )
+    return std::nullopt;
+  return text;
+}
+
+/**
+ * @brief Parser for Excel XML workbooks, such as traceability matrices
+ *
+ * Every distinct cell text of a workbook is in its shared strings table. A workbook has no
+ * references section, so every cell naming a document by the naming schemes in use, like
+ * "REGS-01-R0-GOES ICD", is taken as a reference.
+ *
+ * @param file The workbook
+ * @param contents The contents of xl/sharedStrings.xml
+ * @param paragraph If set, called with the text of every shared string
+ * @returns The documents named in the workbook
+ */
+static reflist parseXLSX(const path& file, std::string_view contents, const paragraphfn& paragraph) {
+  xmlDocPtr doc = parseXML(contents, "sharedStrings.xml", file);
+  if( doc == NULL )
+    return {};
+
+  STATS_SCOPE(EXTRACT);
+  STATS_ADD(DOCUMENTS_PARSED, 1);
+  TRACE_SCOPE("extract_references", file.native());
+
+  reflist references;
+  std::set<string> seen;
+
+  xmlNodePtr root = xmlDocGetRootElement(doc);
+  for( xmlNodePtr si = root ? root->children : NULL; si != NULL; si = si->next ){
+    if( xmlStrcmp(si->name, (const xmlChar*)"si") ) continue;
+
+    string text;
+    collectText(si, text);
+    if( paragraph && !text.empty() )
+      paragraph(text);
+    auto name = cellDocName(text);
+    if( name && seen.emplace(*name).second )
+      references.push_back(*name);
+  }
+  xmlFreeDoc(doc);
+
+  return references;
+}
+
+/**
+ * @brief Run a parser with libxml2's allocations in the thread's arena, reset when it returns
+ */
+template<typename Fn>
+static auto inArena(Fn parse) {
+  return [parse = std::move(parse)](const path& file, std::string_view contents, const paragraphfn& paragraph) {
+    xmlarenascope arena;
+    return parse(file, contents, paragraph);
+  };
+}
+
+/**
+ * @brief The registered parsers, with the built in formats first
+ *
+ * A deque so that parsers never move once registered.
+ */
+static std::deque<docparser>& registry() {
+  static std::deque<docparser> parsers = {
+    {WORD_XML, "docx", {".docx", ".docm"}, "word/document.xml", "", inArena(parseWord)},
+    {EXCEL_XML, "xlsx", {".xlsx", ".xlsm"}, "xl/sharedStrings.xml", "", inArena(parseXLSX)},
+    {POWERPOINT_XML, "pptx", {".pptx", ".pptm"}, "ppt/presentation.xml", "", inArena(parsePPTX)},
+    {OPENDOCUMENT_TEXT, "odt", {".odt"}, "content.xml", "application/vnd.oasis.opendocument.text", inArena(parseODT)},
+  };
+  return parsers;
+}
+
+/**
+ * @brief Add a parser for a format. It runs with libxml2 in the arena like the built in ones,
+ *        so it must free or abandon its libxml2 documents before returning.
+ */
+void register_parser(docparser parser) {
+  parser.parse = inArena(std::move(parser.parse));
+  registry().push_back(std::move(parser));
+}
+
+const std::deque<docparser>& parsers() {
+  return registry();
+}
+
+/**
+ * @brief Find the parser for a file
+ *
+ * The file's extension is tried first. Zip archives with an unknown extension are then
+ * sniffed: the first parser whose body entry (and mimetype, if it has one) is in the archive
+ * is used. Parsers registered later take precedence.
+ *
+ * @returns Nothing if no parser handles the file
+ */
+const docparser* find_parser(const path& file) {
+  auto& parsers = registry();
+
+  string ext = file.extension();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](char c){return std::tolower(c);});
+  for( auto it = parsers.rbegin(); it != parsers.rend(); ++it )
+    if( std::find(it->extensions.begin(), it->extensions.end(), ext) != it->extensions.end() )
+      return &*it;
+
+  // Only open files that start like a zip archive
+  char magic[4] = {};
+  std::ifstream is(file, std::ios::binary);
+  if( !is.read(magic, sizeof(magic)) || memcmp(magic, "PK\x03\x04", 4) )
+    return nullptr;
+
+  ziparchive zip(file);
+  if( !zip.is_open() ) return nullptr;
+
+  std::optional<string> mimetype;
+  for( auto it = parsers.rbegin(); it != parsers.rend(); ++it ){
+    if( !zip.contains(it->entry) ) continue;
+    if( it->mimetype.empty() ) return &*it;
+
+    if( !mimetype ) mimetype = zip.read("mimetype").value_or("");
+    if( *mimetype == it->mimetype ) return &*it;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Parse the document's references with the parser for its format
+ *
+ * @param paragraph If set, called with the text of every paragraph
+ * @returns The references, empty if the format has no parser or the document can't be read
+ */
+reflist document::readReferences(const paragraphfn& paragraph) const {
+  const docparser* parser = find_parser(file);
+  if( !parser ){
+    std::cerr << "Error: " << file.filename() << " is not a parseable document" << std::endl;
+    return {};
+  }
+
+  auto body = unzip_file(file, parser->entry);
+  if( !body ){
+    std::cerr << "Unable to unzip " << parser->name << " file " << file.filename() << std::endl;
+    return {};
+  }
+
+  return parser->parse(file, *body, paragraph);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.hpp"
+
+using std::filesystem::path;
+using std::string;
+using std::vector;
+
+/**
+ * @brief A parser backend for one document format
+ *
+ * Every format handled is a zip archive whose body is in one entry. The body is read for all
+ * documents at once in the batched archive pass and handed to the parser, which may read more
+ * entries of the archive through the document's path.
+ */
+struct docparser {
+  DOCTYPE type;
+  string name;
+  vector<string> extensions; ///< Lowercase, with the dot
+  string entry;              ///< The body entry. Zip archives holding it are sniffed as this format.
+  string mimetype;           ///< If set, the archive's "mimetype" entry must also match to be sniffed
+
+  // Find the references from the body, passing the text of every paragraph to the callback if set
+  std::function<reflist(const path&, std::string_view, const paragraphfn&)> parse;
+};
+
+// Add a parser backend. Parsers registered later take precedence. Register before parsing.
+void register_parser(docparser);
+
+// Every registered parser, the built in ones first
+const std::deque<docparser>& parsers();
+
+// Find the parser for a file by its extension, else by sniffing its zip contents
+const docparser* find_parser(const path&);
@@ -0,0 +1,54 @@
+#include "reflist.hpp"
+
+#include <cctype>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Names live in a deque so that the views the map is keyed on never move
+static std::shared_mutex names_mtx;
+static std::deque<string> names;
+static std::unordered_map<std::string_view, refid> ids;
+
+/**
+ * @brief Lowercase a name into a reused per-thread buffer
+ */
+static std::string_view lower(std::string_view name) {
+  thread_local string buf;
+  buf.resize(name.size());
+  for( size_t i = 0; i < name.size(); i++ )
+    buf[i] = std::tolower((unsigned char)name[i]);
+  return buf;
+}
+
+refid ref_intern(std::string_view name) {
+  std::string_view key = lower(name);
+  {
+    std::shared_lock lk(names_mtx);
+    auto it = ids.find(key);
+    if( it != ids.end() ) return it->second;
+  }
+
+  std::unique_lock lk(names_mtx);
+  auto it = ids.find(key);
+  if( it != ids.end() ) return it->second;
+
+  refid id = names.size();
+  names.emplace_back(key);
+  ids.emplace(names.back(), id);
+  return id;
+}
+
+std::optional<refid> ref_find(std::string_view name) {
+  std::string_view key = lower(name);
+  std::shared_lock lk(names_mtx);
+  auto it = ids.find(key);
+  if( it == ids.end() ) return std::nullopt;
+  return it->second;
+}
+
+std::string_view ref_name(refid id) {
+  std::shared_lock lk(names_mtx);
+  return names.at(id);
+}
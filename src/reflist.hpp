@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * @brief A document's references, packed back to back into one buffer
+ *
+ * References are handed out as string_views into the buffer, so reading them never copies or
+ * allocates. Lists are move-only; clone() makes the rare copy that's really needed.
+ */
+class reflist {
+  string text;           // Every reference, back to back
+  vector<uint32_t> ends; // Where each reference ends in text
+
+  public:
+    class iterator {
+      const reflist* list;
+      size_t idx;
+
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::string_view;
+
+        iterator(const reflist* list, size_t idx) : list(list), idx(idx) {}
+
+        std::string_view operator*() const { return (*list)[idx]; }
+        iterator& operator++() { idx++; return *this; }
+        iterator operator++(int) { iterator tmp = *this; idx++; return tmp; }
+        iterator& operator--() { idx--; return *this; }
+        iterator& operator+=(difference_type n) { idx += n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(list, idx + n); }
+        difference_type operator-(const iterator& other) const { return difference_type(idx) - difference_type(other.idx); }
+        bool operator==(const iterator& other) const { return idx == other.idx; }
+        bool operator!=(const iterator& other) const { return idx != other.idx; }
+    };
+
+    reflist() = default;
+    reflist(reflist&&) = default;
+    reflist& operator=(reflist&&) = default;
+    reflist(const reflist&) = delete;
+    reflist& operator=(const reflist&) = delete;
+
+    // Rebuild a list from its buffer and reference ends, as written by text() and ends()
+    reflist(string text, vector<uint32_t> ends) : text(std::move(text)), ends(std::move(ends)) {}
+
+    reflist clone() const {
+      return reflist(text, ends);
+    }
+
+    void push_back(std::string_view ref) {
+      text.append(ref);
+      ends.push_back(text.size());
+    }
+
+    std::string_view operator[](size_t idx) const {
+      size_t begin = idx ? ends[idx - 1] : 0;
+      return std::string_view(text).substr(begin, ends[idx] - begin);
+    }
+
+    size_t size() const { return ends.size(); }
+    bool empty() const { return ends.empty(); }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, ends.size()); }
+
+    const string& buffer() const { return text; }
+    const vector<uint32_t>& offsets() const { return ends; }
+};
+
+/*
+ * Interned reference names. Names are compared without case, so each is stored lowercased,
+ * once, and referred to by a 32 bit id for the life of the process.
+ */
+using refid = uint32_t;
+
+// The id of a name, adding it if it's new
+refid ref_intern(std::string_view);
+
+// The id of a name if it has been interned
+std::optional<refid> ref_find(std::string_view);
+
+// The lowercased name of an id
+std::string_view ref_name(refid);
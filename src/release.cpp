@@ -0,0 +1,204 @@
+#include "release.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+static constexpr uint32_t NONE = UINT32_MAX;
+
+// Documents the wave workers take from the frontier at once
+static constexpr size_t WAVE_CHUNK = 64;
+
+/**
+ * @brief Find the strongly connected components of the references, with Tarjan's algorithm
+ *
+ * Iterative, so a long chain of references can't overflow the stack.
+ *
+ * @param edges The references to follow
+ * @param comp Set to the component of each slot
+ * @returns The number of components. Every component is numbered after the ones it references.
+ */
+static uint32_t components(const edgeview& edges, vector<uint32_t>& comp) {
+  const size_t n = edges.size();
+  vector<uint32_t> order(n, NONE), low(n);
+  vector<bool> onstack(n, false);
+  vector<uint32_t> stack;
+  vector<std::pair<uint32_t, uint32_t>> calls; // Slot, and the next of its references to visit
+  uint32_t visited = 0, count = 0;
+
+  comp.assign(n, NONE);
+  for( uint32_t root = 0; root < n; root++ ){
+    if( order[root] != NONE ) continue;
+
+    calls.push_back({root, 0});
+    order[root] = low[root] = visited++;
+    stack.push_back(root);
+    onstack[root] = true;
+
+    while( !calls.empty() ){
+      auto& [v, next] = calls.back();
+      auto refs = edges.references(v);
+      if( next < refs.size() ){
+        uint32_t w = refs[next++].index();
+        if( w >= n ) continue;
+        if( order[w] == NONE ){
+          order[w] = low[w] = visited++;
+          stack.push_back(w);
+          onstack[w] = true;
+          calls.push_back({w, 0});
+        }else if( onstack[w] ){
+          low[v] = std::min(low[v], order[w]);
+        }
+        continue;
+      }
+
+      uint32_t done = v;
+      calls.pop_back();
+      if( !calls.empty() )
+        low[calls.back().first] = std::min(low[calls.back().first], low[done]);
+
+      if( low[done] == order[done] ){
+        uint32_t w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          onstack[w] = false;
+          comp[w] = count;
+        } while( w != done );
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Plan the order to update a graph's documents in
+ *
+ * The references are condensed into a graph of their strongly connected components, which has
+ * no cycles, and the components are peeled off with Kahn's algorithm a level at a time: the
+ * first wave is the components referencing nothing else, and each wave after it the
+ * components whose references are all in earlier waves. The components of a wave are worked
+ * through by all the threads at once, each counting down the components referencing them and
+ * collecting the ones it finishes for the next wave.
+ *
+ * @param graph The graph, whose last published references are followed
+ * @param threads How many threads to work through each wave on, all cores if 0
+ */
+releaseplan release_order(const docgraph& graph, unsigned threads) {
+  TRACE_SCOPE("release_order");
+  auto edges = graph.view();
+  const size_t n = edges->size();
+
+  vector<uint32_t> comp;
+  const uint32_t ncomp = components(*edges, comp);
+
+  // The documents of each component, and the components referencing each one
+  vector<uint32_t> member_off(ncomp + 1, 0), members(n);
+  for( size_t i = 0; i < n; i++ )
+    member_off[comp[i] + 1]++;
+  for( uint32_t c = 0; c < ncomp; c++ )
+    member_off[c + 1] += member_off[c];
+  {
+    vector<uint32_t> fill(member_off.begin(), member_off.end() - 1);
+    for( size_t i = 0; i < n; i++ )
+      members[fill[comp[i]]++] = i;
+  }
+
+  vector<std::pair<uint32_t, uint32_t>> cross; // Referenced component, referencing component
+  for( size_t i = 0; i < n; i++ )
+    for( dochandle to : edges->references(i) )
+      if( to.index() < n && comp[to.index()] != comp[i] )
+        cross.emplace_back(comp[to.index()], comp[i]);
+  std::sort(cross.begin(), cross.end());
+  cross.erase(std::unique(cross.begin(), cross.end()), cross.end());
+
+  vector<uint32_t> by_off(ncomp + 1, 0), by(cross.size());
+  vector<std::atomic<uint32_t>> remaining(ncomp);
+  for( size_t e = 0; e < cross.size(); e++ ){
+    by_off[cross[e].first + 1]++;
+    by[e] = cross[e].second;
+    remaining[cross[e].second].fetch_add(1, std::memory_order_relaxed);
+  }
+  for( uint32_t c = 0; c < ncomp; c++ )
+    by_off[c + 1] += by_off[c];
+
+  // Kahn's algorithm, one wave at a time
+  vector<uint32_t> frontier, via(ncomp, NONE);
+  for( uint32_t c = 0; c < ncomp; c++ )
+    if( remaining[c].load(std::memory_order_relaxed) == 0 )
+      frontier.push_back(c);
+
+  if( threads == 0 )
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, std::max<size_t>(ncomp, 1));
+
+  vector<vector<uint32_t>> waves;
+  vector<vector<uint32_t>> found(threads);
+  std::atomic<size_t> pos = 0;
+
+  // Between waves: the next wave is what the threads found
+  auto advance = [&]() noexcept {
+    waves.push_back(std::move(frontier));
+    frontier.clear();
+    for( auto& f : found ){
+      frontier.insert(frontier.end(), f.begin(), f.end());
+      f.clear();
+    }
+    pos = 0;
+  };
+  std::barrier sync(threads, advance);
+
+  auto worker = [&](unsigned t) {
+    while( !frontier.empty() ){
+      for( size_t first = pos.fetch_add(WAVE_CHUNK); first < frontier.size(); first = pos.fetch_add(WAVE_CHUNK) ){
+        size_t last = std::min(frontier.size(), first + WAVE_CHUNK);
+        for( size_t k = first; k < last; k++ ){
+          uint32_t c = frontier[k];
+          for( uint32_t e = by_off[c]; e < by_off[c + 1]; e++ ){
+            // The last reference counted down is in the latest wave before the component's
+            if( remaining[by[e]].fetch_sub(1, std::memory_order_acq_rel) == 1 ){
+              via[by[e]] = c;
+              found[t].push_back(by[e]);
+            }
+          }
+        }
+      }
+      sync.arrive_and_wait();
+    }
+  };
+
+  vector<std::thread> pool;
+  for( unsigned t = 1; t < threads; t++ )
+    pool.emplace_back(worker, t);
+  worker(0);
+  for( auto& t : pool )
+    t.join();
+
+  releaseplan plan;
+  for( auto& wave : waves ){
+    auto& docs = plan.waves.emplace_back();
+    for( uint32_t c : wave )
+      for( uint32_t m = member_off[c]; m < member_off[c + 1]; m++ )
+        docs.push_back(graph.handle(members[m]));
+    std::sort(docs.begin(), docs.end());
+  }
+
+  for( uint32_t c = 0; c < ncomp; c++ ){
+    if( member_off[c + 1] - member_off[c] < 2 ) continue;
+    auto& cycle = plan.cycles.emplace_back();
+    for( uint32_t m = member_off[c]; m < member_off[c + 1]; m++ )
+      cycle.push_back(graph.handle(members[m]));
+  }
+
+  if( !waves.empty() ){
+    for( uint32_t c = waves.back().front(); c != NONE; c = via[c] )
+      plan.critical_path.push_back(graph.handle(members[member_off[c]]));
+    std::reverse(plan.critical_path.begin(), plan.critical_path.end());
+  }
+  return plan;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "graph.hpp"
+
+using std::vector;
+
+/**
+ * @brief The order to update documents in, so each comes after the documents it references
+ *
+ * Documents which reference each other, directly or through others, form a cycle and have to be
+ * updated together, so they are always in the same wave.
+ */
+struct releaseplan {
+  // Groups of documents which can be reviewed at the same time, in the order to update them.
+  // Every document references only documents of earlier waves, or of its own cycle.
+  vector<vector<dochandle>> waves;
+
+  // The groups of more than one document which reference each other
+  vector<vector<dochandle>> cycles;
+
+  // The longest chain of references, one document per wave, from the first to update to the
+  // last. Its length is the number of waves.
+  vector<dochandle> critical_path;
+};
+
+// Plan the order to update a graph's documents in, from its published references, on the given
+// number of threads (all cores if 0)
+releaseplan release_order(const docgraph&, unsigned threads = 0);
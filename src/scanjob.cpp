@@ -0,0 +1,52 @@
+#include "scanjob.hpp"
+#include "trace.hpp"
+
+#include <iostream>
+
+scanjob::scanjob(docgraph& graph, path checkpoint, std::chrono::steady_clock::duration interval)
+  : graph(graph), checkpoint(std::move(checkpoint)), interval(interval), parsed(graph.parsedCount()) {}
+
+scanjob::~scanjob() {
+  cancel();
+  wait();
+}
+
+/**
+ * @brief Start parsing the graph's documents on a worker thread
+ *
+ * Checkpoints are taken between documents, on the worker, so the graph is never saved in the
+ * middle of a document.
+ */
+void scanjob::start() {
+  if( worker.joinable() || finished )
+    return;
+
+  worker = std::jthread([this](std::stop_token stop) {
+    TRACE_SCOPE("scan_job", checkpoint.native());
+    auto last = std::chrono::steady_clock::now();
+
+    graph.parseDocuments([&](size_t n) {
+      parsed = n;
+      if( !checkpoint.empty() && std::chrono::steady_clock::now() - last >= interval ){
+        TRACE_SCOPE("checkpoint", checkpoint.native());
+        graph.save(checkpoint);
+        last = std::chrono::steady_clock::now();
+      }
+    }, 64, nullptr, stop);
+
+    if( !checkpoint.empty() )
+      graph.save(checkpoint);
+    if( stop.stop_requested() )
+      std::cerr << "Parsing stopped after " << parsed << " of " << graph.size() << " documents" << std::endl;
+    finished = true;
+  });
+}
+
+void scanjob::cancel() {
+  worker.request_stop();
+}
+
+void scanjob::wait() {
+  if( worker.joinable() )
+    worker.join();
+}
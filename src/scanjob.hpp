@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <thread>
+
+#include "graph.hpp"
+
+using std::filesystem::path;
+
+/**
+ * @brief Parses a graph's documents on a worker thread, checkpointing as it goes
+ *
+ * The graph is saved to the checkpoint file every so often while parsing, and once more when
+ * the job finishes or is cancelled. Loading the checkpoint and starting a new job on it resumes
+ * the parse, only the documents not parsed yet are read.
+ *
+ * The graph must not be used by anything else until the job is done.
+ */
+class scanjob {
+  docgraph& graph;
+  path checkpoint;
+  std::chrono::steady_clock::duration interval;
+
+  std::atomic<size_t> parsed = 0;
+  std::atomic<bool> finished = false;
+  std::jthread worker;
+
+  public:
+    // Checkpoint to a snapshot file every interval, or never if the file is empty
+    scanjob(docgraph&, path checkpoint = {}, std::chrono::steady_clock::duration interval = std::chrono::seconds(30));
+
+    // Cancels the job and waits for it
+    ~scanjob();
+
+    scanjob(const scanjob&) = delete;
+    scanjob& operator=(const scanjob&) = delete;
+
+    // Start parsing. Does nothing if the job was started before.
+    void start();
+
+    // Ask the job to stop. The documents being read are finished and checkpointed.
+    void cancel();
+
+    // Wait for the job to finish or be cancelled
+    void wait();
+
+    // Whether the worker has stopped, after finishing or being cancelled
+    bool done() const {
+      return finished;
+    }
+
+    bool cancelled() const {
+      return worker.get_stop_token().stop_requested();
+    }
+
+    // Number of documents parsed so far, including the ones parsed before the job
+    size_t progress() const {
+      return parsed;
+    }
+
+    size_t size() const {
+      return graph.size();
+    }
+};
@@ -0,0 +1,196 @@
+#include "search.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+// Score of a match in each field, and the bonus for matching a whole word
+static constexpr float FIELD_WEIGHT[] = { 8.f, 4.f, 2.f, 1.f };
+static constexpr float EXACT_BONUS = 2.f;
+
+vector<string> search_tokenize(std::string_view text) {
+  vector<string> words;
+  string word;
+  for( char c : text ){
+    if( std::isalnum((unsigned char)c) ){
+      word.push_back(std::tolower((unsigned char)c));
+    }else if( !word.empty() ){
+      words.push_back(std::move(word));
+      word.clear();
+    }
+  }
+  if( !word.empty() )
+    words.push_back(std::move(word));
+  return words;
+}
+
+searchindex::searchindex(const docgraph& graph) {
+  // Every (word, document, field) occurrence, then sorted to number the words
+  struct occurrence {
+    string term;
+    uint32_t doc;
+    searchfield field;
+  };
+  vector<occurrence> occ;
+
+  for( size_t i = 0; i < graph.size(); i++ ){
+    const document& d = graph.getChild(i);
+    docs.push_back(graph.handle(i));
+    names.push_back(d.filename());
+
+    auto add = [&](std::string_view text, searchfield field) {
+      for( auto& w : search_tokenize(text) )
+        occ.push_back({std::move(w), (uint32_t)i, field});
+    };
+    add(d.filename(), searchfield::NAME);
+    add(to_string(d.subsystem()), searchfield::SUBSYSTEM);
+    add("r" + std::to_string(d.getRevision()), searchfield::REVISION);
+    for( std::string_view ref : d.getParsedReferences() )
+      add(ref, searchfield::REFERENCE);
+  }
+
+  std::sort(occ.begin(), occ.end(), [](const occurrence& a, const occurrence& b) {
+    if( a.term != b.term ) return a.term < b.term;
+    if( a.doc != b.doc ) return a.doc < b.doc;
+    return a.field < b.field;
+  });
+
+  // A document is listed once per term, with the best field it was found in
+  vector<std::pair<uint32_t, uint32_t>> pairs; // (doc, term << 2 | field)
+  for( size_t i = 0; i < occ.size(); i++ ){
+    if( i > 0 && occ[i].term == occ[i - 1].term && occ[i].doc == occ[i - 1].doc )
+      continue;
+    if( terms.empty() || terms.back() != occ[i].term ){
+      post_off.push_back(post.size());
+      terms.push_back(occ[i].term);
+    }
+    uint32_t term = terms.size() - 1;
+    post.push_back(occ[i].doc << 2 | (uint32_t)occ[i].field);
+    pairs.push_back({occ[i].doc, term << 2 | (uint32_t)occ[i].field});
+  }
+  post_off.push_back(post.size());
+
+  std::sort(pairs.begin(), pairs.end());
+  fwd_off.assign(docs.size() + 1, 0);
+  for( auto& [doc, entry] : pairs ){
+    fwd_off[doc + 1]++;
+    fwd.push_back(entry);
+  }
+  for( size_t i = 0; i < docs.size(); i++ )
+    fwd_off[i + 1] += fwd_off[i];
+}
+
+std::pair<uint32_t, uint32_t> searchindex::prefixRange(std::string_view prefix) const {
+  auto first = std::lower_bound(terms.begin(), terms.end(), prefix,
+      [](const string& t, std::string_view p) { return std::string_view(t) < p; });
+  auto last = std::partition_point(first, terms.end(),
+      [prefix](const string& t) { return std::string_view(t).starts_with(prefix); });
+  return { uint32_t(first - terms.begin()), uint32_t(last - terms.begin()) };
+}
+
+searchsession::searchsession(std::shared_ptr<const searchindex> index) : index(index), stamp(index->size(), 0) {}
+
+/**
+ * @brief Find the documents matching every word of a query, best first
+ *
+ * Candidates come from the previous query's matches when the query extends it, else from the
+ * word with the fewest postings. Each candidate is then checked against every word by comparing
+ * its term ids to the words' id ranges, which needs no string compares.
+ *
+ * @param q The query, as typed
+ * @param budget How long to spend before giving up with what was found so far
+ * @param limit The most results to rank and return
+ */
+searchsession::results searchsession::query(std::string_view q, std::chrono::microseconds budget, size_t limit) {
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now() + budget;
+  const searchindex& idx = *index;
+  results res;
+
+  vector<string> words = search_tokenize(q);
+  if( words.empty() ){
+    last.clear();
+    matches.clear();
+    return res;
+  }
+
+  vector<std::pair<uint32_t, uint32_t>> ranges;
+  for( auto& w : words )
+    ranges.push_back(idx.prefixRange(w));
+
+  // Candidates
+  vector<uint32_t> cand;
+  if( !last.empty() && q.starts_with(last) ){
+    cand = std::move(matches);
+  }else{
+    size_t best = 0;
+    auto postings = [&](size_t w) { return idx.post_off[ranges[w].second] - idx.post_off[ranges[w].first]; };
+    for( size_t w = 1; w < words.size(); w++ )
+      if( postings(w) < postings(best) ) best = w;
+
+    if( ++generation == 0 ){ // Wrapped, forget old stamps
+      std::fill(stamp.begin(), stamp.end(), 0);
+      generation = 1;
+    }
+    uint32_t first = idx.post_off[ranges[best].first];
+    for( uint32_t p = first; p < idx.post_off[ranges[best].second]; p++ ){
+      if( ((p - first) & 4095) == 4095 && clock::now() > deadline ){
+        res.complete = false;
+        break;
+      }
+      uint32_t doc = idx.post[p] >> 2;
+      if( stamp[doc] != generation ){
+        stamp[doc] = generation;
+        cand.push_back(doc);
+      }
+    }
+  }
+
+  // Check and score every candidate against every word
+  vector<searchresult> scored;
+  size_t checked = 0;
+  for( ; checked < cand.size(); checked++ ){
+    if( (checked & 1023) == 1023 && clock::now() > deadline ){
+      res.complete = false;
+      break;
+    }
+
+    uint32_t doc = cand[checked];
+    float score = 0;
+    bool all = true;
+    for( size_t w = 0; w < words.size() && all; w++ ){
+      auto [lo, hi] = ranges[w];
+      float best = 0;
+      for( uint32_t f = idx.fwd_off[doc]; f < idx.fwd_off[doc + 1]; f++ ){
+        uint32_t term = idx.fwd[f] >> 2;
+        if( term < lo || term >= hi ) continue;
+        float s = FIELD_WEIGHT[idx.fwd[f] & 3];
+        if( idx.terms[term].size() == words[w].size() ) s *= EXACT_BONUS;
+        best = std::max(best, s);
+      }
+      all = best > 0;
+      score += best;
+    }
+    if( all )
+      scored.push_back({doc, score});
+  }
+
+  // Only a complete answer can be narrowed down by the next query
+  matches.clear();
+  if( res.complete ){
+    last = q;
+    for( auto& r : scored )
+      matches.push_back(r.doc);
+  }else{
+    last.clear();
+  }
+
+  res.matches = scored.size();
+  size_t n = std::min(limit, scored.size());
+  std::partial_sort(scored.begin(), scored.begin() + n, scored.end(), [&idx](const searchresult& a, const searchresult& b) {
+    if( a.score != b.score ) return a.score > b.score;
+    return idx.name(a.doc) < idx.name(b.doc);
+  });
+  scored.resize(n);
+  res.top = std::move(scored);
+  return res;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+
+using std::string;
+using std::vector;
+
+/**
+ * @brief Where in a document a search term was found. Earlier fields rank higher.
+ */
+enum class searchfield : uint8_t {
+  NAME,
+  SUBSYSTEM,
+  REVISION,
+  REFERENCE,
+};
+
+// Split text into lowercase alphanumeric words
+vector<string> search_tokenize(std::string_view);
+
+/**
+ * @brief Prebuilt index over document names, subsystems, revisions and parsed references
+ *
+ * Every word is given an id in sorted order, so all the words starting with a prefix are one
+ * contiguous range of ids found with two binary searches. Both the term to document and the
+ * document to term lists are stored flat, with offsets into them, so a query never allocates
+ * per document.
+ */
+class searchindex {
+  vector<dochandle> docs;
+  vector<string> names;
+
+  vector<string> terms;        // Sorted
+  vector<uint32_t> post_off;   // Term -> range of post
+  vector<uint32_t> post;       // Documents, as doc << 2 | field
+  vector<uint32_t> fwd_off;    // Document -> range of fwd
+  vector<uint32_t> fwd;        // Terms, as term << 2 | field
+
+  friend class searchsession;
+
+  public:
+    explicit searchindex(const docgraph&);
+
+    size_t size() const {
+      return docs.size();
+    }
+
+    // The document's handle in the graph the index was built from
+    dochandle doc(uint32_t id) const {
+      return docs[id];
+    }
+
+    // The document's file name, ready for display
+    const string& name(uint32_t id) const {
+      return names[id];
+    }
+
+    // The ids of the terms starting with a prefix, as [first, last)
+    std::pair<uint32_t, uint32_t> prefixRange(std::string_view) const;
+};
+
+struct searchresult {
+  uint32_t doc;
+  float score;
+};
+
+/**
+ * @brief A search that is refined as the user types
+ *
+ * Each word of a query matches words starting with it, so typing more can only narrow the
+ * matches down. When a query extends the previous one, only the previous matches are checked
+ * again instead of the whole index.
+ */
+class searchsession {
+  std::shared_ptr<const searchindex> index;
+
+  string last;              // The last query answered completely
+  vector<uint32_t> matches; // Its matches, unranked
+  vector<uint32_t> stamp;   // Per document, the query that last saw it, to dedup candidates
+  uint32_t generation = 0;
+
+  public:
+    struct results {
+      vector<searchresult> top; // Best first
+      size_t matches = 0;       // Number of matching documents, of which top is the best
+      bool complete = true;     // False if the budget ran out before every candidate was checked
+    };
+
+    explicit searchsession(std::shared_ptr<const searchindex>);
+
+    results query(std::string_view, std::chrono::microseconds budget = std::chrono::microseconds(2000), size_t limit = 200);
+};
@@ -0,0 +1,499 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// Longest request line accepted before the client is dropped
+constexpr size_t MAX_REQUEST = 1 << 16;
+
+static string lowercase(std::string_view s) {
+  string out(s);
+  std::transform(out.begin(), out.end(), out.begin(), [](char c){return std::tolower(c);});
+  return out;
+}
+
+/**
+ * @brief The graph with the lookup tables queries need, built once per (re)scan
+ */
+struct queryindex {
+  std::shared_ptr<docgraph> graph;
+  vector<vector<size_t>> referencedby;
+  std::unordered_map<string, vector<size_t>> names; // Lowercase name, and name without extension
+
+  explicit queryindex(std::shared_ptr<docgraph> g) : graph(g), referencedby(g->size()) {
+    for( size_t i = 0; i < graph->size(); i++ ){
+      string name = lowercase(graph->getChild(i).docname());
+      names[name].push_back(i);
+      string stem = path(name).stem().string();
+      if( stem != name )
+        names[stem].push_back(i);
+    }
+
+    for( size_t i = 0; i < graph->size(); i++ ){
+      for( dochandle ref : graph->getChild(i).getReferences() )
+        referencedby[graph->indexOf(ref)].push_back(i);
+    }
+  }
+
+  const vector<size_t>& named(std::string_view name) const {
+    static const vector<size_t> none;
+    auto it = names.find(lowercase(name));
+    return it == names.end() ? none : it->second;
+  }
+};
+
+using jsonobject = std::unordered_map<string, string>;
+
+/**
+ * @brief Parse a flat JSON object. Nested values aren't supported.
+ *
+ * Strings are unescaped, other values (numbers, true, false, null) are kept as their text.
+ *
+ * @returns Nothing if the line isn't a flat JSON object
+ */
+static std::optional<jsonobject> parse_request(std::string_view s) {
+  size_t pos = 0;
+  auto ws = [&]() { while( pos < s.size() && std::isspace((unsigned char)s[pos]) ) pos++; };
+  auto peek = [&]() { return pos < s.size() ? s[pos] : '\0'; };
+
+  auto parse_string = [&]() -> std::optional<string> {
+    if( peek() != '"' ) return std::nullopt;
+    pos++;
+    string out;
+    while( pos < s.size() && s[pos] != '"' ){
+      char c = s[pos++];
+      if( c != '\\' ){
+        out += c;
+        continue;
+      }
+      if( pos >= s.size() ) return std::nullopt;
+      switch( c = s[pos++] ){
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          unsigned cp = 0;
+          if( pos + 4 > s.size() || std::from_chars(s.data() + pos, s.data() + pos + 4, cp, 16).ptr != s.data() + pos + 4 )
+            return std::nullopt;
+          pos += 4;
+          // Encode as UTF-8. Surrogates aren't paired up, they're rare in document names.
+          if( cp < 0x80 ){
+            out += char(cp);
+          }else if( cp < 0x800 ){
+            out += char(0xC0 | (cp >> 6));
+            out += char(0x80 | (cp & 0x3F));
+          }else{
+            out += char(0xE0 | (cp >> 12));
+            out += char(0x80 | ((cp >> 6) & 0x3F));
+            out += char(0x80 | (cp & 0x3F));
+          }
+          break;
+        }
+        default: out += c;
+      }
+    }
+    if( pos >= s.size() ) return std::nullopt;
+    pos++;
+    return out;
+  };
+
+  jsonobject obj;
+  ws();
+  if( peek() != '{' ) return std::nullopt;
+  pos++;
+  ws();
+  if( peek() == '}' ) return obj;
+
+  while( true ){
+    ws();
+    auto key = parse_string();
+    if( !key ) return std::nullopt;
+    ws();
+    if( peek() != ':' ) return std::nullopt;
+    pos++;
+    ws();
+
+    if( peek() == '"' ){
+      auto val = parse_string();
+      if( !val ) return std::nullopt;
+      obj[*key] = *val;
+    }else{
+      size_t start = pos;
+      while( pos < s.size() && (std::isalnum((unsigned char)s[pos]) || s[pos] == '.' || s[pos] == '-' || s[pos] == '+') )
+        pos++;
+      if( start == pos ) return std::nullopt;
+      obj[*key] = string(s.substr(start, pos - start));
+    }
+
+    ws();
+    if( peek() == ',' ){
+      pos++;
+    }else if( peek() == '}' ){
+      return obj;
+    }else{
+      return std::nullopt;
+    }
+  }
+}
+
+static string error(std::string_view msg) {
+  string out = "{\"ok\":false,\"error\":";
+  append_json_string(out, msg);
+  out += "}\n";
+  return out;
+}
+
+/**
+ * @brief Write the answer to a query: a list of documents
+ */
+static string results(const queryindex& idx, const vector<size_t>& docs) {
+  string out = "{\"ok\":true,\"results\":[";
+  for( size_t n = 0; n < docs.size(); n++ ){
+    const document& doc = idx.graph->getChild(docs[n]);
+    if( n ) out += ',';
+    out += "{\"id\":" + std::to_string(docs[n]) + ",\"file\":";
+    append_json_string(out, doc.filepath().string());
+    out += ",\"name\":";
+    append_json_string(out, doc.docname());
+    out += ",\"subsystem\":";
+    append_json_string(out, to_string(doc.subsystem()));
+    out += ",\"revision\":" + std::to_string(doc.getRevision()) + "}";
+  }
+  out += "]}\n";
+  return out;
+}
+
+queryserver::queryserver(path socket, loader load, unsigned threads)
+  : socket_path(socket), load(load), threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+  stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if( stop_fd < 0 )
+    throw std::runtime_error(string("Unable to create eventfd: ") + strerror(errno));
+
+  auto graph = load();
+  if( !graph ) graph = std::make_shared<docgraph>();
+  index.store(std::make_shared<const queryindex>(graph));
+}
+
+queryserver::~queryserver() {
+  {
+    std::lock_guard lk(rescan_mtx);
+    if( rescan_thread.joinable() ) rescan_thread.join();
+  }
+  if( listen_fd >= 0 ){
+    close(listen_fd);
+    unlink(socket_path.c_str());
+  }
+  if( stop_fd >= 0 ) close(stop_fd);
+}
+
+/**
+ * @brief Answer a single request line
+ *
+ * @param line The request, without its newline
+ * @returns The response line, with its newline
+ */
+string queryserver::handle(std::string_view line) {
+  auto req = parse_request(line);
+  if( !req ) return error("malformed request");
+
+  // Hold on to this snapshot for the whole request, even if a rescan swaps in another
+  std::shared_ptr<const queryindex> idx = index.load();
+  const docgraph& graph = *idx->graph;
+
+  string op = (*req)["op"];
+  string name = (*req)["name"];
+
+  if( op == "lookup" ){
+    return results(*idx, idx->named(name));
+  }
+
+  if( op == "latest" ){
+    const auto& docs = idx->named(name);
+    if( docs.empty() ) return results(*idx, {});
+    size_t latest = *std::max_element(docs.begin(), docs.end(), [&graph](size_t a, size_t b) {
+      return graph.getChild(a).getRevision() < graph.getChild(b).getRevision();
+    });
+    return results(*idx, {latest});
+  }
+
+  if( op == "references" || op == "referencedby" ){
+    vector<size_t> found;
+    for( size_t doc : idx->named(name) ){
+      if( op == "references" ){
+        for( dochandle ref : graph.getChild(doc).getReferences() )
+          found.push_back(graph.indexOf(ref));
+      }else{
+        found.insert(found.end(), idx->referencedby[doc].begin(), idx->referencedby[doc].end());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return results(*idx, found);
+  }
+
+  if( op == "search" ){
+    size_t minmatch = 3;
+    if( req->count("min") )
+      std::from_chars((*req)["min"].data(), (*req)["min"].data() + (*req)["min"].size(), minmatch);
+
+    try {
+      vector<size_t> found;
+      for( dochandle doc : graph.getDoc((*req)["query"], minmatch) )
+        found.push_back(graph.indexOf(doc));
+      return results(*idx, found);
+    } catch( std::invalid_argument& e ){
+      return error(e.what());
+    }
+  }
+
+  if( op == "closure" ){
+    size_t root = graph.size();
+    if( req->count("id") ){
+      const string& id = (*req)["id"];
+      std::from_chars(id.data(), id.data() + id.size(), root);
+    }else if( !idx->named(name).empty() ){
+      root = idx->named(name).front();
+    }
+    if( root >= graph.size() ) return error("no such document");
+
+    vector<size_t> found;
+    if( (*req)["order"] == "dfs" ){
+      for( auto it = graph.cdfsbegin(root); it != graph.cdfsend(); ++it )
+        found.push_back(graph.indexOf(it.handle()));
+    }else{
+      for( auto it = graph.cbfsbegin(root); it != graph.cbfsend(); ++it )
+        found.push_back(graph.indexOf(it.handle()));
+    }
+    return results(*idx, found);
+  }
+
+  if( op == "orphans" ){
+    vector<size_t> found;
+    for( size_t i = 0; i < graph.size(); i++ ){
+      if( idx->referencedby[i].empty() )
+        found.push_back(i);
+    }
+    return results(*idx, found);
+  }
+
+  if( op == "rescan" ){
+    rescan();
+    return "{\"ok\":true,\"results\":[]}\n";
+  }
+
+  return error("unknown op");
+}
+
+/**
+ * @brief One serving thread's event loop
+ *
+ * All threads wait on the listening socket, the kernel wakes only one of them per
+ * connection. A connection stays with the thread that accepted it.
+ */
+void queryserver::serve() {
+  struct conn {
+    string in;
+    string out;
+  };
+  std::unordered_map<int, conn> conns;
+
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  if( ep < 0 ){
+    std::cerr << "epoll_create1 failed: " << strerror(errno) << std::endl;
+    return;
+  }
+
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.fd = listen_fd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.events = EPOLLIN;
+  ev.data.fd = stop_fd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, stop_fd, &ev);
+
+  auto drop = [&](int fd) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns.erase(fd);
+  };
+
+  // Write as much output as the socket takes, then only wait for output space if some is left
+  auto flush = [&](int fd, conn& c) -> bool {
+    while( !c.out.empty() ){
+      ssize_t n = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+      if( n < 0 && errno == EINTR ) continue;
+      if( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) break;
+      if( n <= 0 ) return false;
+      c.out.erase(0, n);
+    }
+    epoll_event mod;
+    memset(&mod, 0, sizeof(mod));
+    mod.events = EPOLLIN | EPOLLRDHUP;
+    if( !c.out.empty() ) mod.events |= EPOLLOUT;
+    mod.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_MOD, fd, &mod);
+    return true;
+  };
+
+  epoll_event events[64];
+  bool running = true;
+  while( running ){
+    int n = epoll_wait(ep, events, 64, -1);
+    if( n < 0 ){
+      if( errno == EINTR ) continue;
+      std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    for( int e = 0; e < n; e++ ){
+      int fd = events[e].data.fd;
+
+      if( fd == stop_fd ){
+        // Left unread so every thread sees it
+        running = false;
+        break;
+      }
+
+      if( fd == listen_fd ){
+        int client;
+        while( (client = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ){
+          epoll_event cev;
+          memset(&cev, 0, sizeof(cev));
+          cev.events = EPOLLIN | EPOLLRDHUP;
+          cev.data.fd = client;
+          epoll_ctl(ep, EPOLL_CTL_ADD, client, &cev);
+          conns[client];
+        }
+        continue;
+      }
+
+      auto it = conns.find(fd);
+      if( it == conns.end() ) continue;
+      conn& c = it->second;
+
+      if( events[e].events & EPOLLOUT ){
+        if( !flush(fd, c) ){
+          drop(fd);
+          continue;
+        }
+      }
+
+      if( events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ){
+        char buf[4096];
+        bool closed = false;
+        while( true ){
+          ssize_t r = read(fd, buf, sizeof(buf));
+          if( r < 0 && errno == EINTR ) continue;
+          if( r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) break;
+          if( r <= 0 ){
+            closed = true;
+            break;
+          }
+          c.in.append(buf, r);
+        }
+
+        size_t start = 0, nl;
+        while( (nl = c.in.find('\n', start)) != string::npos ){
+          std::string_view line(c.in.data() + start, nl - start);
+          if( !line.empty() && line.back() == '\r' ) line.remove_suffix(1);
+          if( !line.empty() ) c.out += handle(line);
+          start = nl + 1;
+        }
+        c.in.erase(0, start);
+
+        if( c.in.size() > MAX_REQUEST ){
+          c.out += error("request too long");
+          closed = true;
+        }
+
+        if( !flush(fd, c) || closed ){
+          drop(fd);
+        }
+      }
+    }
+  }
+
+  for( auto& [fd, c] : conns )
+    close(fd);
+  close(ep);
+}
+
+/**
+ * @brief Bind the socket and serve until stop() is called
+ *
+ * @throws runtime_error if the socket can't be set up
+ */
+void queryserver::run() {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if( socket_path.string().size() >= sizeof(addr.sun_path) )
+    throw std::runtime_error("Socket path too long: " + socket_path.string());
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  // Only a socket left behind by an earlier server is replaced, never any other file
+  struct stat st;
+  if( lstat(socket_path.c_str(), &st) == 0 ){
+    if( !S_ISSOCK(st.st_mode) )
+      throw std::runtime_error("Unable to listen on " + socket_path.string() + ": it exists and isn't a socket");
+    unlink(socket_path.c_str());
+  }
+
+  // Kept in listen_fd only once listening, so the destructor never unlinks a path it didn't bind
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  bool bound = fd >= 0 && bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+  if( !bound || listen(fd, SOMAXCONN) < 0 ){
+    int err = errno;
+    if( bound ) unlink(socket_path.c_str());
+    if( fd >= 0 ) close(fd);
+    throw std::runtime_error("Unable to listen on " + socket_path.string() + ": " + strerror(err));
+  }
+  listen_fd = fd;
+
+  vector<std::thread> workers;
+  for( unsigned i = 0; i < threads; i++ )
+    workers.emplace_back(&queryserver::serve, this);
+  for( auto& t : workers )
+    t.join();
+}
+
+void queryserver::stop() {
+  uint64_t one = 1;
+  ssize_t res = write(stop_fd, &one, sizeof(one));
+  (void)res;
+}
+
+/**
+ * @brief Reload the graph on a background thread and swap it in when it's ready
+ *
+ * Queries keep being answered from the old graph in the meantime. Does nothing if a rescan
+ * is already running.
+ */
+void queryserver::rescan() {
+  std::lock_guard lk(rescan_mtx);
+  if( rescanning ) return;
+  if( rescan_thread.joinable() ) rescan_thread.join();
+
+  rescanning = true;
+  rescan_thread = std::thread([this]() {
+    auto graph = load();
+    if( graph )
+      index.store(std::make_shared<const queryindex>(graph));
+    rescanning = false;
+  });
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "graph.hpp"
+
+using std::filesystem::path;
+using std::string;
+
+// Immutable, indexed view of a graph that queries are answered from
+struct queryindex;
+
+/**
+ * @brief Read-only query server over a Unix domain socket
+ *
+ * Clients send one JSON object per line and get one JSON object per line back:
+ *
+ *   {"op":"lookup","name":N}          Documents named N, any revision
+ *   {"op":"latest","name":N}          The latest revision of the documents named N
+ *   {"op":"references","name":N}      Documents referenced by documents named N
+ *   {"op":"referencedby","name":N}    Documents referencing documents named N
+ *   {"op":"search","query":Q,"min":M} Fuzzy search on file names, like docgraph::getDoc
+ *   {"op":"closure","id":I,"order":O} Everything reachable from document I, in "bfs" or "dfs" order
+ *   {"op":"orphans"}                  Documents no other document references
+ *   {"op":"rescan"}                   Reload the graph in the background
+ *
+ * Names are matched without case, with or without their file extension. Answers are
+ * {"ok":true,"results":[...]} or {"ok":false,"error":"..."}.
+ *
+ * Each serving thread runs its own epoll event loop. Queries are answered from an immutable
+ * snapshot of the graph that is swapped atomically when a rescan finishes, so readers never
+ * take a lock and never see a half built graph.
+ */
+class queryserver {
+  public:
+    using loader = std::function<std::shared_ptr<docgraph>()>;
+
+  private:
+    path socket_path;
+    loader load;
+    unsigned threads;
+
+    int listen_fd = -1;
+    int stop_fd = -1;
+
+    std::atomic<std::shared_ptr<const queryindex>> index;
+
+    std::mutex rescan_mtx;
+    std::thread rescan_thread;
+    std::atomic<bool> rescanning = false;
+
+    void serve();
+    string handle(std::string_view);
+
+  public:
+    // Load the first graph right away. Threads default to one per core.
+    queryserver(path socket, loader load, unsigned threads = 0);
+    ~queryserver();
+
+    queryserver(const queryserver&) = delete;
+    queryserver& operator=(const queryserver&) = delete;
+
+    // Serve until stop() is called
+    void run();
+
+    // Make run() return. Safe to call from any thread or a signal handler.
+    void stop();
+
+    // Reload the graph in the background and swap it in once done
+    void rescan();
+};
@@ -0,0 +1,250 @@
+#include "snapshot.hpp"
+#include "graph.hpp"
+#include "mapfile.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+/**
+ * @brief Map a snapshot file and check its header
+ *
+ * Only the header and the bounds of each section are checked here. Individual entries are
+ * bounds checked as they're accessed.
+ *
+ * @throws invalid_argument if the file can't be mapped or isn't a valid snapshot
+ * @param file The path to the snapshot file
+ */
+graphsnapshot::graphsnapshot(const path& file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if( fd < 0 || fstat(fd, &st) < 0 ){
+    if( fd >= 0 ) close(fd);
+    throw std::invalid_argument("Unable to open graph snapshot " + file.string() + ": " + strerror(errno));
+  }
+
+  len = st.st_size;
+  void* map = len >= sizeof(snapheader) ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if( map == MAP_FAILED )
+    throw std::invalid_argument("Unable to map graph snapshot " + file.string());
+  data = (const char*)map;
+
+  const snapheader& h = header();
+  auto fits = [this](uint64_t off, uint64_t count, size_t elem) {
+    return off % 8 == 0 && off <= len && count <= (len - off) / elem;
+  };
+
+  string err;
+  if( memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) )
+    err = "not a graph snapshot";
+  else if( h.version != SNAPSHOT_VERSION )
+    err = "unsupported snapshot version " + std::to_string(h.version);
+  else if( h.bom != SNAPSHOT_BOM )
+    err = "snapshot was written on a machine of different byte order";
+  else if( h.file_size != len )
+    err = "snapshot is truncated";
+  else if( h.doc_count >= UINT32_MAX || h.string_count >= UINT32_MAX
+      || !fits(h.string_offsets_off, h.string_count + 1, sizeof(uint64_t))
+      || !fits(h.docs_off, h.doc_count, sizeof(snapdoc))
+      || !fits(h.ref_index_off, h.doc_count + 1, sizeof(uint32_t))
+      || !fits(h.refs_off, h.ref_count, sizeof(uint32_t))
+      || !fits(h.unfound_index_off, h.doc_count + 1, sizeof(uint32_t))
+      || !fits(h.unfound_off, h.unfound_count, sizeof(uint32_t))
+      || !fits(h.parsed_index_off, h.doc_count + 1, sizeof(uint32_t))
+      || !fits(h.parsed_off, h.parsed_count, sizeof(uint32_t))
+      || h.string_data_off > len )
+    err = "snapshot sections are out of bounds";
+
+  if( !err.empty() ){
+    munmap((void*)data, len);
+    throw std::invalid_argument("Invalid graph snapshot " + file.string() + ": " + err);
+  }
+}
+
+graphsnapshot::~graphsnapshot() {
+  munmap((void*)data, len);
+}
+
+/**
+ * @brief Get a string from the string table
+ *
+ * @throws out_of_range on a bad string id or corrupt string table
+ */
+std::string_view graphsnapshot::str(uint32_t id) const {
+  const snapheader& h = header();
+  if( id >= h.string_count )
+    throw std::out_of_range("Snapshot string id out of range: " + std::to_string(id));
+
+  const uint64_t* offsets = section<uint64_t>(h.string_offsets_off);
+  uint64_t begin = offsets[id], end = offsets[id + 1];
+  if( begin > end || end > len - h.string_data_off )
+    throw std::out_of_range("Corrupt snapshot string table");
+
+  return std::string_view(data + h.string_data_off + begin, end - begin);
+}
+
+/**
+ * @throws out_of_range on a bad document index
+ */
+const snapdoc& graphsnapshot::doc(size_t idx) const {
+  if( idx >= size() )
+    throw std::out_of_range("Snapshot document index out of range: " + std::to_string(idx));
+
+  return section<snapdoc>(header().docs_off)[idx];
+}
+
+/**
+ * @brief Get one document's row of a CSR list
+ *
+ * @throws out_of_range on a bad document index or corrupt row pointers
+ */
+std::span<const uint32_t> graphsnapshot::row(uint64_t index_off, uint64_t list_off, uint64_t count, size_t doc) const {
+  if( doc >= size() )
+    throw std::out_of_range("Snapshot document index out of range: " + std::to_string(doc));
+
+  const uint32_t* index = section<uint32_t>(index_off);
+  if( index[doc] > index[doc + 1] || index[doc + 1] > count )
+    throw std::out_of_range("Corrupt snapshot row pointers");
+
+  return std::span<const uint32_t>(section<uint32_t>(list_off) + index[doc], index[doc + 1] - index[doc]);
+}
+
+/**
+ * @brief Save the graph to a snapshot file
+ *
+ * The snapshot holds every document, its resolved references, unfound references and parsed
+ * references. The file is written next to its destination and then renamed over it, so an
+ * existing snapshot is never left half written.
+ *
+ * @param file The path of the snapshot file to write
+ * @returns True if the snapshot was written
+ */
+bool docgraph::save(const path& file) const {
+  // A deque, so the views the ids are keyed on never move
+  std::deque<string> strings;
+  std::unordered_map<std::string_view, uint32_t> string_ids;
+  auto intern = [&](std::string_view s) -> uint32_t {
+    auto it = string_ids.find(s);
+    if( it != string_ids.end() ) return it->second;
+    strings.emplace_back(s);
+    return string_ids.emplace(strings.back(), strings.size() - 1).first->second;
+  };
+
+  vector<snapdoc> sdocs;
+  vector<uint32_t> ref_index = {0}, refs, unfound_index = {0}, unfound, parsed_index = {0}, parsed;
+  for( auto& doc : docs ){
+    sdocs.push_back({intern(doc.file.string()), intern(doc.document_name), (uint32_t)doc.subsys, doc.revision,
+                     doc.content_hash.has_value(), doc.parsed, doc.content_hash.value_or(0)});
+
+    for( dochandle ref : doc.references )
+      if( docs.contains(ref) )
+        refs.push_back(indexOf(ref));
+    ref_index.push_back(refs.size());
+
+    for( auto& ref : doc.unfound_references )
+      unfound.push_back(intern(ref_name(ref)));
+    unfound_index.push_back(unfound.size());
+
+    for( std::string_view ref : doc.getParsedReferences() )
+      parsed.push_back(intern(ref));
+    parsed_index.push_back(parsed.size());
+  }
+
+  string string_data;
+  vector<uint64_t> string_offsets = {0};
+  for( auto& s : strings ){
+    string_data += s;
+    string_offsets.push_back(string_data.size());
+  }
+
+  // Lay out the sections
+  snapheader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  h.version = SNAPSHOT_VERSION;
+  h.bom = SNAPSHOT_BOM;
+  h.doc_count = sdocs.size();
+  h.string_count = strings.size();
+  h.ref_count = refs.size();
+  h.unfound_count = unfound.size();
+  h.parsed_count = parsed.size();
+  h.review_doc = review.first;
+  h.review_ref = review.second;
+
+  mapfilewriter out(sizeof(snapheader));
+  h.string_offsets_off = out.place(string_offsets);
+  h.docs_off = out.place(sdocs);
+  h.ref_index_off = out.place(ref_index);
+  h.refs_off = out.place(refs);
+  h.unfound_index_off = out.place(unfound_index);
+  h.unfound_off = out.place(unfound);
+  h.parsed_index_off = out.place(parsed_index);
+  h.parsed_off = out.place(parsed);
+  h.string_data_off = out.place(string_data.data(), string_data.size());
+  h.file_size = out.size();
+
+  return out.save(file, &h, "graph snapshot");
+}
+
+/**
+ * @brief Replace the graph with the contents of a snapshot file
+ *
+ * The documents don't need to exist on disk anymore. Their references, including the ones
+ * resolved by hand, are restored as they were saved.
+ *
+ * @throws invalid_argument if the file isn't a valid snapshot
+ * @param file The path of the snapshot file to read
+ */
+void docgraph::load(const path& file) {
+  graphsnapshot snap(file);
+
+  // Everything is read and checked before the graph is touched, so a bad snapshot leaves it as it was
+  vector<document> loaded;
+  loaded.reserve(snap.size());
+  for( size_t i = 0; i < snap.size(); i++ ){
+    const snapdoc& d = snap.doc(i);
+    if( d.subsys >= SUBSYSTEM_COUNT )
+      throw std::invalid_argument("Invalid graph snapshot " + file.string() + ": bad subsystem number");
+
+    loaded.push_back(document(path(snap.str(d.file)), SUBSYSTEMS(d.subsys), d.revision, string(snap.str(d.name))));
+    if( d.hashed )
+      loaded.back().content_hash = d.content_hash;
+    loaded.back().parsed = d.parsed;
+  }
+
+  for( size_t i = 0; i < loaded.size(); i++ ){
+    for( uint32_t ref : snap.references(i) )
+      if( ref >= loaded.size() )
+        throw std::invalid_argument("Invalid graph snapshot " + file.string() + ": bad reference");
+
+    for( uint32_t ref : snap.unfound(i) )
+      loaded[i].unfound_references.push_back(ref_intern(snap.str(ref)));
+
+    reflist parsed;
+    for( uint32_t ref : snap.parsed(i) )
+      parsed.push_back(snap.str(ref));
+    loaded[i].setParsedReferences(std::move(parsed));
+  }
+
+  // Handles into the old graph stop finding anything
+  docs.clear();
+  diagnostics.clear();
+  vector<dochandle> handles;
+  handles.reserve(loaded.size());
+  for( auto& doc : loaded )
+    handles.push_back(docs.insert(std::move(doc)));
+
+  for( size_t i = 0; i < handles.size(); i++ )
+    for( uint32_t ref : snap.references(i) )
+      docs[handles[i]].references.push_back(handles[ref]);
+  commitEdges();
+
+  review = snap.reviewPosition();
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <utility>
+
+using std::filesystem::path;
+
+/*
+ * Graph snapshot file layout. Every section starts on an 8 byte boundary and is addressed by
+ * its offset from the start of the file, so a mapped file can be used in place:
+ *
+ *   snapheader
+ *   uint64_t string_offsets[string_count + 1]   String i is string_data[offsets[i], offsets[i+1])
+ *   snapdoc  docs[doc_count]
+ *   uint32_t ref_index[doc_count + 1]           CSR row pointers into refs
+ *   uint32_t refs[ref_count]                    Referenced document indices
+ *   uint32_t unfound_index[doc_count + 1]       CSR row pointers into unfound
+ *   uint32_t unfound[unfound_count]             String ids of unfound references
+ *   uint32_t parsed_index[doc_count + 1]        CSR row pointers into parsed
+ *   uint32_t parsed[parsed_count]               String ids of parsed references
+ *   char     string_data[]
+ *
+ * Integers are stored in host byte order. The byte order mark rejects files from the other kind.
+ */
+
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'O', 'C', 'G', 'R', 'A', 'P', 'H'};
+constexpr uint32_t SNAPSHOT_VERSION = 3;
+constexpr uint32_t SNAPSHOT_BOM = 0x01020304;
+
+struct snapheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bom;
+  uint64_t file_size;
+
+  uint64_t doc_count;
+  uint64_t string_count;
+  uint64_t ref_count;
+  uint64_t unfound_count;
+  uint64_t parsed_count;
+
+  uint64_t review_doc; ///< Where the reference resolver got to
+  uint64_t review_ref;
+
+  uint64_t string_offsets_off;
+  uint64_t docs_off;
+  uint64_t ref_index_off;
+  uint64_t refs_off;
+  uint64_t unfound_index_off;
+  uint64_t unfound_off;
+  uint64_t parsed_index_off;
+  uint64_t parsed_off;
+  uint64_t string_data_off;
+};
+
+/**
+ * @brief A document as stored in a snapshot. Strings are ids into the string table.
+ */
+struct snapdoc {
+  uint32_t file;
+  uint32_t name;
+  uint32_t subsys;
+  uint32_t revision;
+  uint32_t hashed;   ///< Nonzero if content_hash is known
+  uint32_t parsed;   ///< Nonzero if the references were parsed
+  uint64_t content_hash;
+};
+
+/**
+ * @brief A read-only view of a graph snapshot file
+ *
+ * Opening a snapshot is a single mmap plus a check of the header; nothing is parsed or copied.
+ * The mapping is shared, so many processes can use the same snapshot at little cost.
+ */
+class graphsnapshot {
+  const char* data = nullptr;
+  size_t len = 0;
+
+  const snapheader& header() const {
+    return *(const snapheader*)data;
+  }
+
+  template<typename T>
+  const T* section(uint64_t off) const {
+    return (const T*)(data + off);
+  }
+
+  std::span<const uint32_t> row(uint64_t index_off, uint64_t list_off, uint64_t count, size_t doc) const;
+
+  public:
+    explicit graphsnapshot(const path&);
+    ~graphsnapshot();
+
+    graphsnapshot(const graphsnapshot&) = delete;
+    graphsnapshot& operator=(const graphsnapshot&) = delete;
+
+    // Number of documents in the snapshot
+    size_t size() const {
+      return header().doc_count;
+    }
+
+    // Get a string from the string table
+    std::string_view str(uint32_t) const;
+
+    const snapdoc& doc(size_t) const;
+
+    // Where the reference resolver got to when the snapshot was saved
+    std::pair<size_t, size_t> reviewPosition() const {
+      return {header().review_doc, header().review_ref};
+    }
+
+    // Indices of the documents referenced by a document
+    std::span<const uint32_t> references(size_t doc) const {
+      return row(header().ref_index_off, header().refs_off, header().ref_count, doc);
+    }
+
+    // String ids of a document's unfound references
+    std::span<const uint32_t> unfound(size_t doc) const {
+      return row(header().unfound_index_off, header().unfound_off, header().unfound_count, doc);
+    }
+
+    // String ids of a document's parsed references
+    std::span<const uint32_t> parsed(size_t doc) const {
+      return row(header().parsed_index_off, header().parsed_off, header().parsed_count, doc);
+    }
+};
@@ -0,0 +1,98 @@
+#include "spill.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+
+/**
+ * @brief Create an anonymous scratch file
+ *
+ * @throws runtime_error if no file can be made in the directory
+ */
+spillstore::spillstore(const path& dir) {
+#ifdef O_TMPFILE
+  fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+  if( fd < 0 ){
+    // No O_TMPFILE here, make a named file and unlink it at once
+    string name = (dir / "docmng-spill-XXXXXX").string();
+    fd = mkostemp(name.data(), O_CLOEXEC);
+    if( fd >= 0 )
+      unlink(name.c_str());
+  }
+  if( fd < 0 )
+    throw std::runtime_error("Unable to create a spill file in " + dir.string() + ": " + strerror(errno));
+}
+
+spillstore::~spillstore() {
+  if( fd >= 0 ) close(fd);
+}
+
+/**
+ * @brief Append a reference list to the file
+ *
+ * The list's reference ends are stored first, then its text, both as they are in memory.
+ *
+ * @throws runtime_error if the write fails
+ */
+spillref spillstore::write(const reflist& refs) {
+  const auto& ends = refs.offsets();
+  string buf((const char*)ends.data(), ends.size() * sizeof(uint32_t));
+  buf += refs.buffer();
+
+  uint64_t offset;
+  {
+    std::lock_guard lk(mtx);
+    offset = end;
+    end += buf.size();
+  }
+
+  for( size_t done = 0; done < buf.size(); ){
+    ssize_t n = pwrite(fd, buf.data() + done, buf.size() - done, offset + done);
+    if( n < 0 && errno == EINTR ) continue;
+    if( n <= 0 )
+      throw std::runtime_error(string("Unable to write to the spill file: ") + strerror(errno));
+    done += n;
+  }
+
+  return {offset, (uint32_t)buf.size(), (uint32_t)refs.size()};
+}
+
+/**
+ * @brief Read back a reference list written before
+ *
+ * @throws runtime_error if the read fails
+ */
+reflist spillstore::read(const spillref& ref) const {
+  string buf(ref.bytes, '\0');
+  for( size_t done = 0; done < buf.size(); ){
+    ssize_t n = pread(fd, buf.data() + done, buf.size() - done, ref.offset + done);
+    if( n < 0 && errno == EINTR ) continue;
+    if( n <= 0 )
+      throw std::runtime_error(string("Unable to read the spill file: ") + (n == 0 ? "short read" : strerror(errno)));
+    done += n;
+  }
+
+  vector<uint32_t> ends(ref.count);
+  memcpy(ends.data(), buf.data(), ends.size() * sizeof(uint32_t));
+  buf.erase(0, ends.size() * sizeof(uint32_t));
+  return reflist(std::move(buf), std::move(ends));
+}
+
+static std::unique_ptr<spillstore> store;
+
+/**
+ * @brief Spill parsed references to a scratch file in a directory from now on
+ *
+ * @throws runtime_error if no file can be made in the directory
+ */
+void spill_enable(const path& dir) {
+  store = std::make_unique<spillstore>(dir);
+}
+
+spillstore* spill_store() {
+  return store.get();
+}
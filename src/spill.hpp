@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "reflist.hpp"
+
+using std::filesystem::path;
+using std::string;
+using std::vector;
+
+/**
+ * @brief Where a reference list was written in a spill store
+ */
+struct spillref {
+  uint64_t offset;
+  uint32_t bytes;
+  uint32_t count;
+};
+
+/**
+ * @brief An append-only scratch file that reference lists are moved out of memory to
+ *
+ * The file is anonymous and goes away with the process. Writes and reads may come from any
+ * thread.
+ */
+class spillstore {
+  int fd = -1;
+  std::mutex mtx;
+  uint64_t end = 0;
+
+  public:
+    // Create the scratch file in a directory
+    explicit spillstore(const path& dir);
+    ~spillstore();
+
+    spillstore(const spillstore&) = delete;
+    spillstore& operator=(const spillstore&) = delete;
+
+    spillref write(const reflist&);
+    reflist read(const spillref&) const;
+};
+
+// Move parsed references to a scratch file in a directory from now on
+void spill_enable(const path& dir);
+
+// The scratch file references are moved to, or nullptr if they stay in memory
+spillstore* spill_store();
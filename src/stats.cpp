@@ -0,0 +1,207 @@
+#include "stats.hpp"
+
+#include <atomic>
+#include <bit>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/resource.h>
+
+/**
+ * @brief One thread's stats. Only its own thread writes to it.
+ */
+struct threadstats {
+  struct histogram {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> total_ns = 0;
+    std::atomic<uint64_t> max_ns = 0;
+    std::array<std::atomic<uint64_t>, STAT_BUCKETS> buckets = {};
+  };
+
+  std::array<std::atomic<uint64_t>, STAT_COUNTERS> counters = {};
+  std::array<histogram, STAT_TIMERS> timers;
+};
+
+// Every thread's block. Blocks outlive their threads so nothing counted is lost.
+static std::mutex registry_mtx;
+static std::vector<std::unique_ptr<threadstats>> registry;
+
+static threadstats& local() {
+  thread_local threadstats* mine = []() {
+    std::lock_guard lk(registry_mtx);
+    registry.push_back(std::make_unique<threadstats>());
+    return registry.back().get();
+  }();
+  return *mine;
+}
+
+// Gauges are shared by every thread
+static std::array<std::atomic<uint64_t>, STAT_GAUGES> gauges = {};
+
+// Only the owning thread writes, so a plain load and store is enough
+static void bump(std::atomic<uint64_t>& a, uint64_t n) {
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void stats_add(statcounter c, uint64_t n) {
+  bump(local().counters[(size_t)c], n);
+}
+
+void stats_record(stattimer t, uint64_t ns) {
+  auto& h = local().timers[(size_t)t];
+  bump(h.count, 1);
+  bump(h.total_ns, ns);
+  if( ns > h.max_ns.load(std::memory_order_relaxed) )
+    h.max_ns.store(ns, std::memory_order_relaxed);
+
+  size_t bucket = ns ? std::bit_width(ns) - 1 : 0;
+  bump(h.buckets[std::min(bucket, STAT_BUCKETS - 1)], 1);
+}
+
+void stats_peak(statgauge g, uint64_t n) {
+  auto& a = gauges[(size_t)g];
+  uint64_t cur = a.load(std::memory_order_relaxed);
+  while( n > cur && !a.compare_exchange_weak(cur, n, std::memory_order_relaxed) );
+}
+
+statsnapshot stats_collect() {
+  statsnapshot snap;
+
+  // The kernel keeps the peak RSS, in kilobytes
+  struct rusage ru;
+  if( getrusage(RUSAGE_SELF, &ru) == 0 )
+    stats_peak(statgauge::PEAK_RSS_BYTES, uint64_t(ru.ru_maxrss) * 1024);
+  for( size_t g = 0; g < STAT_GAUGES; g++ )
+    snap.gauges[g] = gauges[g].load(std::memory_order_relaxed);
+
+  std::lock_guard lk(registry_mtx);
+  for( auto& ts : registry ){
+    for( size_t c = 0; c < STAT_COUNTERS; c++ )
+      snap.counters[c] += ts->counters[c].load(std::memory_order_relaxed);
+
+    for( size_t t = 0; t < STAT_TIMERS; t++ ){
+      auto& from = ts->timers[t];
+      auto& to = snap.timers[t];
+      to.count += from.count.load(std::memory_order_relaxed);
+      to.total_ns += from.total_ns.load(std::memory_order_relaxed);
+      to.max_ns = std::max(to.max_ns, from.max_ns.load(std::memory_order_relaxed));
+      for( size_t b = 0; b < STAT_BUCKETS; b++ )
+        to.buckets[b] += from.buckets[b].load(std::memory_order_relaxed);
+    }
+  }
+
+  return snap;
+}
+
+uint64_t stathistogram::quantile(double q) const {
+  if( count == 0 ) return 0;
+
+  uint64_t rank = q * (count - 1);
+  uint64_t seen = 0;
+  for( size_t b = 0; b < STAT_BUCKETS; b++ ){
+    seen += buckets[b];
+    if( seen > rank )
+      return std::min(max_ns, (uint64_t(2) << b) - 1); // Upper bound of the bucket
+  }
+  return max_ns;
+}
+
+const char* to_string(statcounter c) {
+  switch( c ){
+    case statcounter::BYTES_INFLATED: return "bytes_inflated";
+    case statcounter::DOCUMENTS_PARSED: return "documents_parsed";
+    case statcounter::PARAGRAPHS_VISITED: return "paragraphs_visited";
+    case statcounter::GETDOC_CANDIDATES: return "getdoc_candidates";
+    case statcounter::TRAVERSAL_NODES: return "traversal_nodes";
+    case statcounter::BYTES_HASHED: return "bytes_hashed";
+    case statcounter::DUPLICATES_SKIPPED: return "duplicates_skipped";
+    default: return "invalid";
+  }
+}
+
+const char* to_string(statgauge g) {
+  switch( g ){
+    case statgauge::PEAK_RSS_BYTES: return "peak_rss_bytes";
+    case statgauge::BUDGET_PEAK_BYTES: return "budget_peak_bytes";
+    default: return "invalid";
+  }
+}
+
+const char* to_string(stattimer t) {
+  switch( t ){
+    case stattimer::UNZIP: return "unzip";
+    case stattimer::XML_PARSE: return "xml_parse";
+    case stattimer::EXTRACT: return "extract";
+    default: return "invalid";
+  }
+}
+
+/**
+ * @brief Print the stats as a table: counters first, then timers with their quantiles
+ */
+void stats_print(std::ostream& os, const statsnapshot& snap) {
+  os << std::left << std::setw(20) << "counter" << std::right << std::setw(16) << "value" << '\n';
+  for( size_t c = 0; c < STAT_COUNTERS; c++ )
+    os << std::left << std::setw(20) << to_string(statcounter(c)) << std::right << std::setw(16) << snap.counters[c] << '\n';
+  for( size_t g = 0; g < STAT_GAUGES; g++ )
+    os << std::left << std::setw(20) << to_string(statgauge(g)) << std::right << std::setw(16) << snap.gauges[g] << '\n';
+
+  os << '\n' << std::left << std::setw(20) << "timer" << std::right
+     << std::setw(10) << "count" << std::setw(12) << "total ms" << std::setw(12) << "mean us"
+     << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us" << '\n';
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+  os << std::fixed << std::setprecision(1);
+  for( size_t t = 0; t < STAT_TIMERS; t++ ){
+    const stathistogram& h = snap.timers[t];
+    os << std::left << std::setw(20) << to_string(stattimer(t)) << std::right
+       << std::setw(10) << h.count
+       << std::setw(12) << h.total_ns / 1e6
+       << std::setw(12) << (h.count ? h.total_ns / 1e3 / h.count : 0.0)
+       << std::setw(12) << h.quantile(0.5) / 1e3
+       << std::setw(12) << h.quantile(0.99) / 1e3
+       << std::setw(12) << h.max_ns / 1e3 << '\n';
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
+
+/**
+ * @brief Print the stats for Prometheus' textfile collector
+ *
+ * Counters become docmng_<name>_total, gauges docmng_<name>, and timers become
+ * docmng_<name>_seconds histograms.
+ */
+void stats_prometheus(std::ostream& os, const statsnapshot& snap) {
+  const auto precision = os.precision(10); // Bucket bounds are powers of two in nanoseconds
+
+  for( size_t c = 0; c < STAT_COUNTERS; c++ ){
+    const char* name = to_string(statcounter(c));
+    os << "# TYPE docmng_" << name << "_total counter\n";
+    os << "docmng_" << name << "_total " << snap.counters[c] << '\n';
+  }
+
+  for( size_t g = 0; g < STAT_GAUGES; g++ ){
+    const char* name = to_string(statgauge(g));
+    os << "# TYPE docmng_" << name << " gauge\n";
+    os << "docmng_" << name << ' ' << snap.gauges[g] << '\n';
+  }
+
+  for( size_t t = 0; t < STAT_TIMERS; t++ ){
+    const char* name = to_string(stattimer(t));
+    const stathistogram& h = snap.timers[t];
+    os << "# TYPE docmng_" << name << "_seconds histogram\n";
+
+    uint64_t cumulative = 0;
+    for( size_t b = 0; b < STAT_BUCKETS; b++ ){
+      cumulative += h.buckets[b];
+      os << "docmng_" << name << "_seconds_bucket{le=\"" << ((uint64_t(2) << b) / 1e9) << "\"} " << cumulative << '\n';
+    }
+    os << "docmng_" << name << "_seconds_bucket{le=\"+Inf\"} " << h.count << '\n';
+    os << "docmng_" << name << "_seconds_sum " << h.total_ns / 1e9 << '\n';
+    os << "docmng_" << name << "_seconds_count " << h.count << '\n';
+  }
+
+  os.precision(precision);
+}
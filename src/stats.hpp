@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Hot path instrumentation. Every thread counts into its own block of relaxed atomics, so
+ * counting never contends. Blocks are only summed up when the stats are read.
+ *
+ * Define DOCMNG_NO_STATS to compile all STATS_* macros out.
+ */
+
+/**
+ * @brief Plain event counters
+ */
+enum class statcounter {
+  BYTES_INFLATED,     ///< Bytes of decompressed archive entries
+  DOCUMENTS_PARSED,   ///< Documents whose references were parsed
+  PARAGRAPHS_VISITED, ///< <w:p> paragraphs looked at while finding references
+  GETDOC_CANDIDATES,  ///< Documents scored by docgraph::getDoc
+  TRAVERSAL_NODES,    ///< Documents visited by the BFS/DFS iterators
+  BYTES_HASHED,       ///< Bytes of documents hashed while scanning
+  DUPLICATES_SKIPPED, ///< Documents whose parse was shared with an identical copy
+  COUNT
+};
+
+/**
+ * @brief Timed stages, recorded into histograms
+ */
+enum class stattimer {
+  UNZIP,     ///< Reading and inflating one archive entry
+  XML_PARSE, ///< Parsing one XML entry into a DOM
+  EXTRACT,   ///< Finding the references in one parsed document
+  COUNT
+};
+
+/**
+ * @brief High water marks
+ */
+enum class statgauge {
+  PEAK_RSS_BYTES,    ///< Peak resident set size of the process
+  BUDGET_PEAK_BYTES, ///< Most bytes held from the memory budget at once
+  COUNT
+};
+
+constexpr size_t STAT_COUNTERS = (size_t)statcounter::COUNT;
+constexpr size_t STAT_TIMERS = (size_t)stattimer::COUNT;
+constexpr size_t STAT_GAUGES = (size_t)statgauge::COUNT;
+
+// Histogram buckets: bucket i holds durations in [2^i, 2^(i+1)) nanoseconds
+constexpr size_t STAT_BUCKETS = 40;
+
+const char* to_string(statcounter);
+const char* to_string(stattimer);
+const char* to_string(statgauge);
+
+/**
+ * @brief Summed up histogram of one timer
+ */
+struct stathistogram {
+  uint64_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  std::array<uint64_t, STAT_BUCKETS> buckets = {};
+
+  // Approximate quantile (0-1) in nanoseconds, from the bucket bounds
+  uint64_t quantile(double) const;
+};
+
+/**
+ * @brief The stats of all threads summed up
+ */
+struct statsnapshot {
+  std::array<uint64_t, STAT_COUNTERS> counters = {};
+  std::array<stathistogram, STAT_TIMERS> timers = {};
+  std::array<uint64_t, STAT_GAUGES> gauges = {};
+};
+
+void stats_add(statcounter, uint64_t);
+void stats_record(stattimer, uint64_t ns);
+
+// Raise a gauge to a value if it's higher
+void stats_peak(statgauge, uint64_t);
+
+// Sum up the stats of every thread that has ever counted something
+statsnapshot stats_collect();
+
+// Print the stats as a human readable table
+void stats_print(std::ostream&, const statsnapshot&);
+
+// Print the stats in the Prometheus text exposition format
+void stats_prometheus(std::ostream&, const statsnapshot&);
+
+/**
+ * @brief Records the time from its construction to its destruction
+ */
+class statscope {
+  stattimer timer;
+  std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit statscope(stattimer timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+
+    ~statscope() {
+      stats_record(timer, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    statscope(const statscope&) = delete;
+    statscope& operator=(const statscope&) = delete;
+};
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+
+#ifndef DOCMNG_NO_STATS
+#define STATS_ENABLED 1
+#define STATS_ADD(counter, n) stats_add(statcounter::counter, (n))
+#define STATS_RECORD(timer, ns) stats_record(stattimer::timer, (ns))
+#define STATS_SCOPE(timer) statscope STATS_CONCAT(stats_scope_, __LINE__)(stattimer::timer)
+#define STATS_PEAK(gauge, n) stats_peak(statgauge::gauge, (n))
+#else
+#define STATS_ENABLED 0
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_RECORD(timer, ns) ((void)0)
+#define STATS_SCOPE(timer) ((void)0)
+#define STATS_PEAK(gauge, n) ((void)0)
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using std::string;
+
+/**
+ * @brief List of all subsystems in REGS, generated from subsystems.def
+ *
+ * A subsystem's value is its number in file names.
+ *
+ * @author Gaultier Delbarre
+ * @date 9/15/2022
+ */
+enum class SUBSYSTEMS : uint8_t {
+#define SUBSYSTEM(id, name, color) id,
+#include "subsystems.def"
+#undef SUBSYSTEM
+};
+
+struct subsysteminfo {
+  SUBSYSTEMS id;
+  std::string_view name;       ///< Display name
+  std::string_view enumerator; ///< Name of the enumerator, e.g. "ADSB"
+  uint32_t color;              ///< Colour in the reference graph, as 0xRRGGBB
+};
+
+// Every subsystem, indexed by its number
+inline constexpr subsysteminfo SUBSYSTEM_TABLE[] = {
+#define SUBSYSTEM(id, name, color) {SUBSYSTEMS::id, name, #id, color},
+#include "subsystems.def"
+#undef SUBSYSTEM
+};
+
+inline constexpr size_t SUBSYSTEM_COUNT = std::size(SUBSYSTEM_TABLE);
+
+// The subsystem with a number, if there is one
+constexpr std::optional<SUBSYSTEMS> subsystem_from_number(uint64_t n) {
+  if( n >= SUBSYSTEM_COUNT ) return std::nullopt;
+  return SUBSYSTEM_TABLE[n].id;
+}
+
+constexpr std::string_view subsystem_name(SUBSYSTEMS sys) {
+  size_t i = (size_t)sys;
+  return i < SUBSYSTEM_COUNT ? SUBSYSTEM_TABLE[i].name : "INVALID SUBSYSTEM";
+}
+
+inline string to_string(SUBSYSTEMS sys) {
+  return string(subsystem_name(sys));
+}
+
+// The subsystem with a display name or enumerator name, ignoring case
+constexpr std::optional<SUBSYSTEMS> subsystem_from_name(std::string_view name) {
+  auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c; };
+  auto same = [&](std::string_view a, std::string_view b) {
+    if( a.size() != b.size() ) return false;
+    for( size_t i = 0; i < a.size(); i++ )
+      if( lower(a[i]) != lower(b[i]) ) return false;
+    return true;
+  };
+  for( const subsysteminfo& s : SUBSYSTEM_TABLE )
+    if( same(name, s.name) || same(name, s.enumerator) )
+      return s.id;
+  return std::nullopt;
+}
+
+/**
+ * @brief Read the decimal number at the start of a view
+ *
+ * @returns The number and how many digits it took, or nothing if the view doesn't start with a
+ *          digit or the number doesn't fit in 32 bits
+ */
+constexpr std::optional<std::pair<uint32_t, size_t>> parse_number(std::string_view s) {
+  uint64_t n = 0;
+  size_t i = 0;
+  for( ; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++ ){
+    n = n * 10 + (s[i] - '0');
+    if( n > UINT32_MAX ) return std::nullopt;
+  }
+  if( i == 0 ) return std::nullopt;
+  return std::make_pair((uint32_t)n, i);
+}
+
+static_assert(SUBSYSTEM_COUNT > 0 && SUBSYSTEM_COUNT <= 256, "Subsystems must fit the enum");
+static_assert(subsystem_from_number((size_t)SUBSYSTEMS::ADSB) == SUBSYSTEMS::ADSB);
+static_assert(subsystem_from_name("ads-b") == SUBSYSTEMS::ADSB);
+static_assert(parse_number("12-GOES")->first == 12 && parse_number("12-GOES")->second == 2);
+static_assert(!parse_number("99999999999"));
@@ -0,0 +1,360 @@
+#include "textindex.hpp"
+#include "mapfile.hpp"
+#include "search.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void put_varint(string& out, uint64_t v) {
+  while( v >= 0x80 ){
+    out.push_back(char(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(char(v));
+}
+
+// Read a varint, stopping at the end. Returns false if it runs past it.
+static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+  v = 0;
+  for( unsigned shift = 0; p < end && shift < 64; shift += 7 ){
+    uint8_t b = *p++;
+    v |= uint64_t(b & 0x7f) << shift;
+    if( !(b & 0x80) ) return true;
+  }
+  return false;
+}
+
+void textindexbuilder::beginDocument(const path& file) {
+  docs.push_back(file.string());
+  current.clear();
+  position = 0;
+}
+
+void textindexbuilder::addParagraph(std::string_view text) {
+  for( auto& word : search_tokenize(text) )
+    current[std::move(word)].push_back(position++);
+  position++; // So that phrases don't match across paragraphs
+}
+
+void textindexbuilder::endDocument() {
+  uint32_t doc = docs.size() - 1;
+  for( auto& [word, positions] : current ){
+    termdata& t = terms[word];
+    put_varint(t.postings, doc - t.last_doc);
+    put_varint(t.postings, positions.size());
+    uint32_t prev = 0;
+    for( uint32_t p : positions ){
+      put_varint(t.postings, p - prev);
+      prev = p;
+    }
+    t.last_doc = doc;
+    t.doc_freq++;
+  }
+  current.clear();
+}
+
+/**
+ * @brief Write the index to a file
+ *
+ * Like graph snapshots, the index is written next to its destination and renamed over it.
+ *
+ * @param file The path of the index file
+ * @returns True if the index was written
+ */
+bool textindexbuilder::save(const path& file) const {
+  vector<const std::pair<const string, termdata>*> sorted;
+  for( auto& t : terms )
+    sorted.push_back(&t);
+  std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+
+  string strings, postings;
+  vector<uint64_t> doc_paths = {0};
+  for( auto& d : docs ){
+    strings += d;
+    doc_paths.push_back(strings.size());
+  }
+
+  vector<textterm> tterms;
+  for( auto t : sorted ){
+    tterms.push_back({strings.size(), (uint32_t)t->first.size(), t->second.doc_freq, postings.size(), t->second.postings.size()});
+    strings += t->first;
+    postings += t->second.postings;
+  }
+
+  textheader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TEXTINDEX_MAGIC, sizeof(TEXTINDEX_MAGIC));
+  h.version = TEXTINDEX_VERSION;
+  h.bom = TEXTINDEX_BOM;
+  h.doc_count = docs.size();
+  h.term_count = tterms.size();
+
+  mapfilewriter out(sizeof(textheader));
+  h.doc_paths_off = out.place(doc_paths);
+  h.terms_off = out.place(tterms);
+  h.strings_off = out.place(strings.data(), strings.size());
+  h.strings_size = strings.size();
+  h.postings_off = out.place(postings.data(), postings.size());
+  h.postings_size = postings.size();
+  h.file_size = out.size();
+
+  return out.save(file, &h, "text index");
+}
+
+/**
+ * @brief Map an index file and check its header and the bounds of every term
+ *
+ * @throws invalid_argument if the file can't be mapped or isn't a valid index
+ */
+textindex::textindex(const path& file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if( fd < 0 || fstat(fd, &st) < 0 ){
+    if( fd >= 0 ) close(fd);
+    throw std::invalid_argument("Unable to open text index " + file.string() + ": " + strerror(errno));
+  }
+
+  len = st.st_size;
+  void* map = len >= sizeof(textheader) ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if( map == MAP_FAILED )
+    throw std::invalid_argument("Unable to map text index " + file.string());
+  data = (const char*)map;
+
+  const textheader& h = header();
+  auto fits = [this](uint64_t off, uint64_t count, size_t elem) {
+    return off % 8 == 0 && off <= len && count <= (len - off) / elem;
+  };
+
+  string err;
+  if( memcmp(h.magic, TEXTINDEX_MAGIC, sizeof(TEXTINDEX_MAGIC)) )
+    err = "not a text index";
+  else if( h.version != TEXTINDEX_VERSION )
+    err = "unsupported text index version " + std::to_string(h.version);
+  else if( h.bom != TEXTINDEX_BOM )
+    err = "text index was written on a machine of different byte order";
+  else if( h.file_size != len )
+    err = "text index is truncated";
+  else if( h.doc_count >= UINT32_MAX
+      || !fits(h.doc_paths_off, h.doc_count + 1, sizeof(uint64_t))
+      || !fits(h.terms_off, h.term_count, sizeof(textterm))
+      || !fits(h.strings_off, h.strings_size, 1)
+      || !fits(h.postings_off, h.postings_size, 1) )
+    err = "text index sections are out of bounds";
+  else {
+    const uint64_t* paths = (const uint64_t*)(data + h.doc_paths_off);
+    for( size_t i = 0; i < h.doc_count && err.empty(); i++ )
+      if( paths[i] > paths[i + 1] || paths[i + 1] > h.strings_size )
+        err = "document path out of bounds";
+
+    const textterm* terms = (const textterm*)(data + h.terms_off);
+    for( size_t i = 0; i < h.term_count && err.empty(); i++ )
+      if( terms[i].str + terms[i].str_len > h.strings_size || terms[i].post + terms[i].post_len > h.postings_size )
+        err = "term out of bounds";
+  }
+
+  if( !err.empty() ){
+    munmap((void*)data, len);
+    throw std::invalid_argument("Invalid text index " + file.string() + ": " + err);
+  }
+}
+
+textindex::~textindex() {
+  munmap((void*)data, len);
+}
+
+std::string_view textindex::docpath(uint32_t doc) const {
+  const uint64_t* paths = (const uint64_t*)(data + header().doc_paths_off);
+  if( doc >= size() ) return {};
+  return std::string_view(data + header().strings_off + paths[doc], paths[doc + 1] - paths[doc]);
+}
+
+const textterm* textindex::find(std::string_view term) const {
+  const textterm* first = (const textterm*)(data + header().terms_off);
+  const textterm* last = first + header().term_count;
+  auto str = [this](const textterm& t) {
+    return std::string_view(data + header().strings_off + t.str, t.str_len);
+  };
+
+  auto it = std::lower_bound(first, last, term, [&](const textterm& t, std::string_view w) { return str(t) < w; });
+  return it != last && str(*it) == term ? it : nullptr;
+}
+
+textindex::postinglist textindex::postings(std::string_view term) const {
+  postinglist out;
+  const textterm* t = find(term);
+  if( !t ) return out;
+
+  const uint8_t* p = (const uint8_t*)data + header().postings_off + t->post;
+  const uint8_t* end = p + t->post_len;
+  out.docs.reserve(t->doc_freq);
+  out.pos_index.push_back(0);
+
+  uint64_t doc = 0, delta, count;
+  while( p < end ){
+    if( !get_varint(p, end, delta) || !get_varint(p, end, count) ) break;
+    doc += delta;
+    uint64_t pos = 0;
+    for( uint64_t i = 0; i < count; i++ ){
+      if( !get_varint(p, end, delta) ) break;
+      pos += delta;
+      out.pos.push_back(pos);
+    }
+    out.docs.push_back(doc);
+    out.pos_index.push_back(out.pos.size());
+  }
+  return out;
+}
+
+/**
+ * @brief Find the documents containing the words right after one another
+ *
+ * The documents containing every word are found by intersecting the posting lists, then each
+ * position of the first word is checked for the others at the following positions.
+ */
+textindex::docset textindex::phrase(const vector<string>& words) const {
+  if( words.empty() ) return {};
+
+  vector<postinglist> lists;
+  for( auto& w : words )
+    lists.push_back(postings(w));
+  if( words.size() == 1 ) return lists[0].docs;
+
+  docset out;
+  vector<size_t> at(lists.size(), 0); // Index into each list's docs
+  for( size_t i = 0; i < lists[0].docs.size(); i++ ){
+    uint32_t doc = lists[0].docs[i];
+
+    bool all = true;
+    for( size_t w = 1; w < lists.size() && all; w++ ){
+      auto& docs = lists[w].docs;
+      at[w] = std::lower_bound(docs.begin() + at[w], docs.end(), doc) - docs.begin();
+      all = at[w] < docs.size() && docs[at[w]] == doc;
+    }
+    if( !all ) continue;
+
+    // Positions of each word in this document, sorted
+    auto positions = [&](size_t w, size_t d) {
+      auto& l = lists[w];
+      return std::span<const uint32_t>(l.pos.data() + l.pos_index[d], l.pos_index[d + 1] - l.pos_index[d]);
+    };
+    for( uint32_t start : positions(0, i) ){
+      bool match = true;
+      for( size_t w = 1; w < lists.size() && match; w++ ){
+        auto pos = positions(w, at[w]);
+        match = std::binary_search(pos.begin(), pos.end(), start + w);
+      }
+      if( match ){
+        out.push_back(doc);
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Run a boolean query
+ *
+ *   query := and ("OR" and)*
+ *   and   := not (["AND"] not)*
+ *   not   := ("NOT" | "-") not | "(" query ")" | "phrase" | word
+ *
+ * @throws invalid_argument if the query doesn't parse
+ */
+textindex::docset textindex::query(std::string_view q) const {
+  size_t pos = 0;
+  auto ws = [&]() { while( pos < q.size() && std::isspace((unsigned char)q[pos]) ) pos++; };
+
+  // The next bare word, without consuming it
+  auto peekword = [&]() {
+    ws();
+    size_t end = pos;
+    while( end < q.size() && !std::isspace((unsigned char)q[end]) && q[end] != '(' && q[end] != ')' && q[end] != '"' ) end++;
+    return q.substr(pos, end - pos);
+  };
+
+  auto all = [this]() {
+    docset d(size());
+    for( size_t i = 0; i < d.size(); i++ ) d[i] = i;
+    return d;
+  };
+
+  auto combine = [](const docset& a, const docset& b, bool intersect) {
+    docset out;
+    if( intersect )
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+    else
+      std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+    return out;
+  };
+
+  std::function<docset()> parse_or, parse_and, parse_not;
+
+  parse_not = [&]() -> docset {
+    ws();
+    if( pos >= q.size() ) throw std::invalid_argument("Query ends too early");
+
+    if( q[pos] == '-' || peekword() == "NOT" ){
+      pos += q[pos] == '-' ? 1 : 3;
+      docset d = all(), neg = parse_not(), out;
+      std::set_difference(d.begin(), d.end(), neg.begin(), neg.end(), std::back_inserter(out));
+      return out;
+    }
+    if( q[pos] == '(' ){
+      pos++;
+      docset d = parse_or();
+      ws();
+      if( pos >= q.size() || q[pos] != ')' ) throw std::invalid_argument("Missing ) in query");
+      pos++;
+      return d;
+    }
+    if( q[pos] == '"' ){
+      size_t end = q.find('"', pos + 1);
+      if( end == std::string_view::npos ) throw std::invalid_argument("Missing closing \" in query");
+      auto words = search_tokenize(q.substr(pos + 1, end - pos - 1));
+      pos = end + 1;
+      return phrase(words);
+    }
+    if( q[pos] == ')' ) throw std::invalid_argument("Unexpected ) in query");
+
+    std::string_view word = peekword();
+    pos += word.size();
+    return phrase(search_tokenize(word));
+  };
+
+  parse_and = [&]() -> docset {
+    docset d = parse_not();
+    while( true ){
+      ws();
+      std::string_view w = peekword();
+      if( pos >= q.size() || q[pos] == ')' || w == "OR" ) return d;
+      if( w == "AND" ) pos += 3;
+      d = combine(d, parse_not(), true);
+    }
+  };
+
+  parse_or = [&]() -> docset {
+    docset d = parse_and();
+    while( peekword() == "OR" ){
+      pos += 2;
+      d = combine(d, parse_and(), false);
+    }
+    return d;
+  };
+
+  docset d = parse_or();
+  ws();
+  if( pos < q.size() ) throw std::invalid_argument("Unexpected ) in query");
+  return d;
+}
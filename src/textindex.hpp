@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using std::filesystem::path;
+using std::string;
+using std::vector;
+
+/*
+ * Full-text index file layout. Sections start on 8 byte boundaries, addressed from the start of
+ * the file, so a mapped file is used in place:
+ *
+ *   textheader
+ *   uint64_t doc_paths[doc_count + 1]   Document i's path is strings[doc_paths[i], doc_paths[i+1])
+ *   textterm terms[term_count]          Sorted by term
+ *   char     strings[]
+ *   uint8_t  postings[]
+ *
+ * A term's posting list holds, for every document containing it in increasing order: the
+ * document id minus the previous one, the number of positions, then each word position minus
+ * the previous one. Every number is a LEB128 varint.
+ */
+
+constexpr char TEXTINDEX_MAGIC[8] = {'D', 'O', 'C', 'T', 'E', 'X', 'T', 0};
+constexpr uint32_t TEXTINDEX_VERSION = 1;
+constexpr uint32_t TEXTINDEX_BOM = 0x01020304;
+
+struct textheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bom;
+  uint64_t file_size;
+
+  uint64_t doc_count;
+  uint64_t term_count;
+
+  uint64_t doc_paths_off;
+  uint64_t terms_off;
+  uint64_t strings_off;
+  uint64_t strings_size;
+  uint64_t postings_off;
+  uint64_t postings_size;
+};
+
+struct textterm {
+  uint64_t str;      // Offset into strings
+  uint32_t str_len;
+  uint32_t doc_freq; // Number of documents containing the term
+  uint64_t post;     // Offset into postings
+  uint64_t post_len;
+};
+
+/**
+ * @brief Collects the words of documents as they're parsed and writes a full-text index
+ *
+ * Documents are added one at a time, in the order they get their ids.
+ */
+class textindexbuilder {
+  struct termdata {
+    string postings;
+    uint32_t doc_freq = 0;
+    uint32_t last_doc = 0;
+  };
+
+  std::unordered_map<string, termdata> terms;
+  vector<string> docs;
+
+  // Positions of each word of the document being added
+  std::unordered_map<string, vector<uint32_t>> current;
+  uint32_t position = 0;
+
+  public:
+    void beginDocument(const path&);
+
+    // Add one paragraph of the document being added
+    void addParagraph(std::string_view);
+
+    void endDocument();
+
+    size_t size() const {
+      return docs.size();
+    }
+
+    // Write the index, replacing the file at once. Returns false on errors.
+    bool save(const path&) const;
+};
+
+/**
+ * @brief A read-only, mapped full-text index
+ *
+ * Queries are words and "quoted phrases", all of which must match. OR, NOT (or a leading -) and
+ * parentheses combine them. Words are split like the index is, so a word with punctuation in
+ * it, such as REQ-GOES-001, is matched as a phrase.
+ */
+class textindex {
+  const char* data = nullptr;
+  size_t len = 0;
+
+  const textheader& header() const {
+    return *(const textheader*)data;
+  }
+
+  const textterm* find(std::string_view) const;
+
+  public:
+    // Documents as ids, in increasing order
+    using docset = vector<uint32_t>;
+
+    // Documents containing a word, with where they contain it
+    struct postinglist {
+      vector<uint32_t> docs;
+      vector<uint32_t> pos_index; // Document i's positions are pos[pos_index[i], pos_index[i+1])
+      vector<uint32_t> pos;
+    };
+
+    // Map an index file. Throws invalid_argument if it isn't a valid index.
+    explicit textindex(const path&);
+    ~textindex();
+
+    textindex(const textindex&) = delete;
+    textindex& operator=(const textindex&) = delete;
+
+    size_t size() const {
+      return header().doc_count;
+    }
+
+    std::string_view docpath(uint32_t) const;
+
+    // Decode a term's posting list. Empty if no document contains it.
+    postinglist postings(std::string_view term) const;
+
+    // Documents containing every word in order
+    docset phrase(const vector<string>& words) const;
+
+    // Run a query. Throws invalid_argument if it doesn't parse.
+    docset query(std::string_view) const;
+};
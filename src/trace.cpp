@@ -0,0 +1,211 @@
+#include "trace.hpp"
+#include "export.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct traceevent {
+  const char* name;
+  uint64_t start_ns; // Since trace_start()
+  uint64_t dur_ns;
+  uint8_t detail_len;
+  char detail[111];
+};
+
+/**
+ * @brief A run of one thread's events
+ *
+ * Only the owning thread writes events, publishing each through count. A full chunk is
+ * followed by a new one rather than dropping events, and is freed once it has been drained.
+ */
+struct tracechunk {
+  static constexpr size_t CAPACITY = 1 << 12;
+
+  traceevent events[CAPACITY];
+  std::atomic<size_t> count = 0;
+  std::atomic<tracechunk*> next = nullptr;
+};
+
+/**
+ * @brief One thread's events, as a chain of chunks
+ *
+ * The owning thread appends to last. The flusher and trace_write() read from first, under the
+ * registry lock, and free the chunks they are done with.
+ */
+struct tracebuffer {
+  unsigned tid;
+  tracechunk* first = new tracechunk;
+  size_t read = 0; // Events of first already drained
+  tracechunk* last = first;
+
+  ~tracebuffer() {
+    while( first )
+      delete std::exchange(first, first->next.load(std::memory_order_relaxed));
+  }
+};
+
+// How often the flusher drains the buffers, if no chunk fills first
+static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+
+static std::atomic<bool> enabled = false;
+static traceclock::time_point epoch;
+
+// Every thread's buffer. Buffers outlive their threads so no event is lost.
+static std::mutex registry_mtx;
+static std::vector<std::unique_ptr<tracebuffer>> registry;
+
+// The events taken off the rings so far, as JSON, each starting with a comma. Under registry_mtx.
+static string drained;
+
+// Drains the buffers while events are being recorded. Woken early by a chunk filling up.
+static std::condition_variable_any flush_cv;
+static std::jthread flusher;
+
+static tracebuffer& local() {
+  thread_local tracebuffer* mine = []() {
+    std::lock_guard lk(registry_mtx);
+    registry.push_back(std::make_unique<tracebuffer>());
+    registry.back()->tid = registry.size();
+    return registry.back().get();
+  }();
+  return *mine;
+}
+
+// Chrome traces count in microseconds, keep the nanoseconds as a fraction
+static void micros(string& out, uint64_t ns) {
+  char frac[4] = { char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10), 0 };
+  out += std::to_string(ns / 1000);
+  out += '.';
+  out += frac;
+}
+
+/**
+ * @brief Take every new event off the buffers and add it to the drained ones. Call under registry_mtx.
+ */
+static void drain() {
+  for( auto& buf : registry ){
+    while( true ){
+      tracechunk* chunk = buf->first;
+      size_t count = chunk->count.load(std::memory_order_acquire);
+      for( ; buf->read < count; buf->read++ ){
+        const traceevent& ev = chunk->events[buf->read];
+        drained += ",\n{\"name\":\"";
+        drained += ev.name;
+        drained += "\",\"cat\":\"docmng\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+        drained += std::to_string(buf->tid);
+        drained += ",\"ts\":";
+        micros(drained, ev.start_ns);
+        drained += ",\"dur\":";
+        micros(drained, ev.dur_ns);
+        if( ev.detail_len ){
+          drained += ",\"args\":{\"file\":";
+          append_json_string(drained, std::string_view(ev.detail, ev.detail_len));
+          drained += '}';
+        }
+        drained += '}';
+      }
+
+      // The thread is done with a chunk once it has moved on to the next
+      tracechunk* next = chunk->next.load(std::memory_order_acquire);
+      if( count < tracechunk::CAPACITY || !next ) break;
+      delete chunk;
+      buf->first = next;
+      buf->read = 0;
+    }
+  }
+}
+
+/**
+ * @brief Start recording events, and the flusher draining them
+ */
+void trace_start() {
+  epoch = traceclock::now();
+  enabled.store(true, std::memory_order_release);
+
+  if( !flusher.joinable() )
+    flusher = std::jthread([](std::stop_token stop) {
+      std::unique_lock lk(registry_mtx);
+      while( !stop.stop_requested() ){
+        flush_cv.wait_for(lk, stop, FLUSH_INTERVAL, []() { return false; });
+        drain();
+      }
+    });
+}
+
+bool trace_enabled() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+void trace_event(const char* name, traceclock::time_point start, traceclock::time_point end, std::string_view detail) {
+  if( !trace_enabled() ) return;
+
+  tracebuffer& buf = local();
+  tracechunk* chunk = buf.last;
+  size_t count = chunk->count.load(std::memory_order_relaxed);
+  if( count == tracechunk::CAPACITY ){
+    chunk = new tracechunk;
+    buf.last->next.store(chunk, std::memory_order_release);
+    buf.last = chunk;
+    count = 0;
+  }
+
+  traceevent& ev = chunk->events[count];
+  ev.name = name;
+  ev.start_ns = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count());
+  ev.dur_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+  // Keep the end of long details, the file name is the useful part of a path
+  if( detail.size() > sizeof(ev.detail) )
+    detail.remove_prefix(detail.size() - sizeof(ev.detail));
+  ev.detail_len = detail.size();
+  memcpy(ev.detail, detail.data(), detail.size());
+
+  chunk->count.store(count + 1, std::memory_order_release);
+
+  // Let the flusher free a full chunk without waiting for its next round
+  if( count + 1 == tracechunk::CAPACITY )
+    flush_cv.notify_one();
+}
+
+/**
+ * @brief Write every recorded event as a Chrome trace-event JSON file
+ *
+ * Events are complete ("X") events with the detail as their "file" argument. Each thread gets
+ * a name so the timeline shows one row per worker. The flusher is stopped, and the events it
+ * hadn't drained yet are written along with the ones it had.
+ *
+ * @param file The file to write to, "-" for stdout
+ * @returns False if the file couldn't be written
+ */
+bool trace_write(const path& file) {
+  flusher.request_stop();
+  if( flusher.joinable() )
+    flusher.join();
+
+  bufwriter out(file);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"docmng\"}}";
+
+  std::lock_guard lk(registry_mtx);
+  drain();
+  for( auto& buf : registry ){
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << uint64_t(buf->tid)
+        << ",\"args\":{\"name\":\"thread " << uint64_t(buf->tid) << "\"}}";
+  }
+  out << drained;
+  drained = string();
+
+  out << "\n]}\n";
+  return out.flush();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+using std::filesystem::path;
+
+/*
+ * Timeline tracing. Scoped events are appended to lock-free buffers owned by the thread
+ * recording them, so tracing never makes the workers wait on each other. A background thread
+ * drains the buffers as they fill, and trace_write() writes everything recorded as a Chrome
+ * trace-event JSON file, which chrome://tracing and Perfetto can open.
+ *
+ * Nothing is recorded until trace_start() is called. Define DOCMNG_NO_TRACE to compile all
+ * TRACE_* macros out.
+ */
+
+using traceclock = std::chrono::steady_clock;
+
+// Start recording events
+void trace_start();
+
+// Whether events are being recorded
+bool trace_enabled();
+
+// Record an event that ran from start to end. The detail, usually a file, is truncated to fit.
+void trace_event(const char* name, traceclock::time_point start, traceclock::time_point end, std::string_view detail = {});
+
+// Drain every thread's events into a Chrome trace file ("-" for stdout). Returns false on errors.
+bool trace_write(const path&);
+
+/**
+ * @brief Records an event from its construction to its destruction
+ */
+class tracescope {
+  const char* name;
+  std::string_view detail;
+  traceclock::time_point start;
+
+  public:
+    // The name must be a literal and the detail must outlive the scope
+    tracescope(const char* name, std::string_view detail = {}) : name(name), detail(detail) {
+      if( trace_enabled() )
+        start = traceclock::now();
+    }
+
+    ~tracescope() {
+      if( start != traceclock::time_point() )
+        trace_event(name, start, traceclock::now(), detail);
+    }
+
+    tracescope(const tracescope&) = delete;
+    tracescope& operator=(const tracescope&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifndef DOCMNG_NO_TRACE
+#define TRACE_SCOPE(...) tracescope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define TRACE_EVENT(name, start, end, detail) do { if( trace_enabled() ) trace_event(name, start, end, detail); } while(0)
+#else
+#define TRACE_SCOPE(...) ((void)0)
+#define TRACE_EVENT(name, start, end, detail) ((void)0)
+#endif
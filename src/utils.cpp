@@ -1,6 +1,17 @@
 #include "utils.hpp"
+#include "ioqueue.hpp"
+#include "zip.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "budget.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <filesystem>
 #include <optional>
 #include <stdexcept>
@@ -55,28 +66,264 @@ std::optional<int> substr_in(std::string_view view, std::string_view cont, declt
 /**
  * @brief Unzip the given file from within a zip archive
  *
+ * Only the End-Of-Central-Directory record, the central directory and the subfile's own byte
+ * range are read, so embedded media elsewhere in the archive is never touched.
+ *
  * @author Gaultier Delbarre
  * @date 9/15/2022
  *
  * @param zipfile The path to the zip file to unzip
- * @param subfile The file path within the zipfile to unzip. Leave empty for the whole zip
- * @returns Nothing if the subfile doesn't exist.
+ * @param subfile The file path within the zipfile to unzip
+ * @returns Nothing if the subfile doesn't exist, else its contents.
  * @throws invalid_argument if the zipfile doesn't exist.
  */
-std::optional<path> unzip_file(path zipfile, string subfile) {
+std::optional<string> unzip_file(path zipfile, string subfile) {
   if( !fs::exists(zipfile) )
     throw std::invalid_argument("Unzip error: " + zipfile.string() + " doesn't exist");
 
-  path tmpdir = fs::temp_directory_path();
+  TRACE_SCOPE("unzip_file", zipfile.native());
+
+  ziparchive zip(zipfile);
+  return zip.read(subfile);
+}
+
+
+/**
+ * @brief Read a subfile out of every given zip archive, keeping many reads in flight at once
+ *
+ * Each archive is read with as few positioned reads as possible: first its tail, which holds
+ * the End-Of-Central-Directory record and usually the whole central directory, then the
+ * subfile's local entry. The central directory is only read on its own when it doesn't fit in
+ * the tail. Many archives are worked on at once, so on high-latency storage the throughput
+ * scales with the queue depth instead of the number of threads.
+ *
+ * Under a memory budget, an archive is only started when its file size fits in what's left of
+ * the budget. Once its entry is found the charge becomes the exact size of the buffers, and it
+ * is given back after the callback has used the contents.
+ *
+ * @param zipfiles The zip archives to read
+ * @param subfiles The file path within each zip archive, or one path for all of them
+ * @param done Called on the calling thread with the index of the archive and the contents of
+ *             the subfile, or nothing if it couldn't be read. Called exactly once per archive
+ *             that was started.
+ * @param depth The maximum number of archives read at once
+ * @param stop Once requested, no more archives are started. The ones being read are finished.
+ */
+void read_zip_entries(const std::vector<path>& zipfiles, const std::vector<string>& subfiles, std::function<void(size_t, std::optional<string>)> done, unsigned depth, std::stop_token stop) {
+  enum stage { TAIL, CDIR, LOCAL, LOCAL_REST };
+  struct job {
+    size_t idx;
+    int fd = -1;
+    uint64_t size;
+    stage st;
+    string buf;
+    uint64_t buf_offset;
+    size_t expect; // Number of bytes the read in flight should return
+    zipentry ent;
+    std::chrono::steady_clock::time_point start;
+    size_t charged; // Bytes taken from the memory budget
+  };
+
+  bytesemaphore* budget = memory_budget();
+
+  depth = std::max(depth, 1u);
+  // Made before the queue, so the buffers outlive any read the queue still has in flight
+  std::vector<job> jobs(std::min<size_t>(depth, zipfiles.size()));
+  auto queue = ioqueue::create(depth);
+  std::vector<size_t> free_jobs;
+  for( size_t i = jobs.size(); i-- > 0; )
+    free_jobs.push_back(i);
+
+  size_t next = 0;   // The next archive to start on
+  size_t active = 0; // The number of archives being read
+
+  auto finish = [&](size_t slot, std::optional<string> result) {
+    job& j = jobs[slot];
+    [[maybe_unused]] auto end = std::chrono::steady_clock::now();
+    STATS_RECORD(UNZIP, std::chrono::duration_cast<std::chrono::nanoseconds>(end - j.start).count());
+    TRACE_EVENT("unzip_file", j.start, end, zipfiles[j.idx].native());
+    close(j.fd);
+    j.fd = -1;
+    j.buf = string();
+    free_jobs.push_back(slot);
+    active--;
+    done(j.idx, std::move(result));
+    if( budget ) budget->release(j.charged);
+  };
+
+  // Read a whole byte range of the archive into the job's buffer
+  auto read = [&](size_t slot, stage st, uint64_t offset, size_t len) {
+    job& j = jobs[slot];
+    j.st = st;
+    j.buf.resize(len);
+    j.buf_offset = offset;
+    j.expect = len;
+    queue->read(j.fd, j.buf.data(), len, offset, slot);
+  };
+
+  // Find the subfile in the central directory and read its local entry
+  auto locate = [&](size_t slot, std::string_view cdir) {
+    job& j = jobs[slot];
+    const string& subfile = subfiles.size() == 1 ? subfiles[0] : subfiles.at(j.idx);
+    // The sizes are checked before they're charged to the budget or allocated
+    auto ent = zip_find_entry(cdir, subfile);
+    if( !ent || ent->local_offset >= j.size || !zip_entry_size_ok(*ent) ){
+      finish(slot, std::nullopt);
+      return;
+    }
 
-  string command = "unzip -o \"" + zipfile.string() + "\" \"" + subfile + "\" -d " + tmpdir.string() + " > /dev/null";
+    j.ent = *ent;
+    uint64_t len = ZIP_LOCAL_HEADER_SIZE + subfile.size() + ZIP_LOCAL_SLACK + j.ent.compressed_size;
 
-  system(command.c_str());
+    // Charge what the entry really needs: the buffer read into and the inflated contents
+    if( budget ){
+      size_t need = std::max<size_t>(j.buf.size(), len) + j.ent.uncompressed_size;
+      if( need > j.charged )
+        budget->force(need - j.charged);
+      else
+        budget->release(j.charged - need);
+      j.charged = need;
+    }
 
-  path enddir = tmpdir / subfile;
+    read(slot, LOCAL, j.ent.local_offset, std::min(len, j.size - j.ent.local_offset));
+  };
 
-  if( !fs::exists(enddir) )
-    return std::nullopt;
+  // Inflate the entry once its local header and all of its data are in the buffer
+  auto extract = [&](size_t slot) {
+    job& j = jobs[slot];
+    auto hdr = zip_local_header_size(j.buf);
+    if( !hdr ){
+      finish(slot, std::nullopt);
+      return;
+    }
+
+    uint64_t need = *hdr + j.ent.compressed_size;
+    if( need <= j.buf.size() ){
+      finish(slot, zip_inflate(j.ent, std::string_view(j.buf).substr(*hdr, j.ent.compressed_size)));
+    }else if( j.st == LOCAL && j.ent.local_offset + need <= j.size ){
+      // The extra field was larger than expected, get the rest of the data
+      size_t have = j.buf.size();
+      j.st = LOCAL_REST;
+      j.buf.resize(need);
+      j.expect = need - have;
+      queue->read(j.fd, j.buf.data() + have, j.expect, j.ent.local_offset + have, slot);
+    }else{
+      finish(slot, std::nullopt);
+    }
+  };
+
+  // Start on as many archives as there are free jobs
+  auto refill = [&]() {
+    while( !free_jobs.empty() && next < zipfiles.size() && !stop.stop_requested() ){
+      // Wait for memory to be given back if the next archive doesn't fit the budget
+      struct stat st;
+      size_t charge = 0;
+      if( budget && stat(zipfiles[next].c_str(), &st) == 0 ){
+        charge = st.st_size;
+        if( active == 0 )
+          budget->force(charge);
+        else if( !budget->try_acquire(charge) )
+          break;
+      }
+
+      size_t slot = free_jobs.back();
+      free_jobs.pop_back();
+      job& j = jobs[slot];
+      j.idx = next++;
+      j.start = std::chrono::steady_clock::now();
+      j.charged = charge;
+      active++;
+
+      j.fd = open(zipfiles[j.idx].c_str(), O_RDONLY | O_CLOEXEC);
+      if( j.fd < 0 || fstat(j.fd, &st) < 0 ){
+        std::cerr << "Unable to open " << zipfiles[j.idx] << ": " << strerror(errno) << std::endl;
+        finish(slot, std::nullopt);
+        continue;
+      }
+      j.size = st.st_size;
+
+      size_t len = std::min<uint64_t>(j.size, ZIP_EOCD_SEARCH);
+      read(slot, TAIL, j.size - len, len);
+    }
+  };
+
+  refill();
+  while( active > 0 ){
+    auto results = queue->wait();
+    if( results.empty() ){
+      // Nothing is in flight, but archives are still open. Their reads were lost, so they're
+      // given up on, and each still gets its call and gives back its descriptor and budget.
+      std::cerr << "I/O queue failed with " << active << " archives being read" << std::endl;
+      for( size_t slot = 0; slot < jobs.size(); slot++ )
+        if( jobs[slot].fd >= 0 )
+          finish(slot, std::nullopt);
+      break;
+    }
+
+    for( const ioresult& r : results ){
+      size_t slot = r.tag;
+      job& j = jobs[slot];
+
+      if( r.res < 0 || (size_t)r.res != j.expect ){
+        std::cerr << "Unable to read " << zipfiles[j.idx] << ": " << (r.res < 0 ? strerror(-r.res) : "short read") << std::endl;
+        finish(slot, std::nullopt);
+        continue;
+      }
+
+      switch( j.st ){
+        case TAIL: {
+          auto eocd = zip_find_eocd(j.buf, j.buf_offset);
+          if( !eocd || eocd->cd_size > j.size || eocd->cd_offset > j.size - eocd->cd_size ){
+            std::cerr << zipfiles[j.idx] << " is not a valid zip archive" << std::endl;
+            finish(slot, std::nullopt);
+          }else if( eocd->cd_offset >= j.buf_offset ){
+            // The central directory was read along with the tail
+            locate(slot, std::string_view(j.buf).substr(eocd->cd_offset - j.buf_offset, eocd->cd_size));
+          }else{
+            read(slot, CDIR, eocd->cd_offset, eocd->cd_size);
+          }
+          break;
+        }
+        case CDIR:
+          locate(slot, j.buf);
+          break;
+        case LOCAL:
+        case LOCAL_REST:
+          extract(slot);
+          break;
+      }
+    }
+
+    refill();
+  }
+}
+
+/**
+ * @brief Append a string to out as a quoted JSON string, escaping it as needed
+ *
+ * @param out The string to append to
+ * @param s The string to quote
+ */
+void append_json_string(string& out, std::string_view s) {
+  static const char* HEX = "0123456789abcdef";
 
-  return enddir;
+  out += '"';
+  for( char c : s ){
+    switch( c ){
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if( (unsigned char)c < 0x20 ){
+          out += "\\u00";
+          out += HEX[(c >> 4) & 0xF];
+          out += HEX[c & 0xF];
+        }else{
+          out += c;
+        }
+    }
+  }
+  out += '"';
 }
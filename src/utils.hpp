@@ -5,6 +5,9 @@
 #include <optional>
 #include <stdexcept>
 #include <filesystem>
+#include <functional>
+#include <stop_token>
+#include <vector>
 
 using std::string;
 using std::filesystem::path;
@@ -12,5 +15,11 @@ using std::filesystem::path;
 // Tell how much of a substring is in a given string
 std::optional<int> substr_in(std::string_view, std::string_view, decltype(string::npos));
 
-// Unzip a given subdocument in a zip file to a temp folder and return the unzipped file path
-std::optional<path> unzip_file(path, string); 
+// Unzip a given subdocument in a zip file and return its contents
+std::optional<string> unzip_file(path, string);
+
+// Read one subfile out of many zip archives with many reads in flight. Calls back as each finishes.
+void read_zip_entries(const std::vector<path>&, const std::vector<string>&, std::function<void(size_t, std::optional<string>)>, unsigned = 64, std::stop_token = {});
+
+// Append a string to out as a quoted, escaped JSON string
+void append_json_string(string&, std::string_view);
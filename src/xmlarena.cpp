@@ -0,0 +1,172 @@
+#include "xmlarena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <libxml/parser.h>
+#include <libxml/xmlerror.h>
+#include <libxml/xmlmemory.h>
+#include <iterator>
+
+/**
+ * @brief One thread's arena
+ *
+ * Memory comes from chunks that are kept once allocated and refilled after every reset, so a
+ * thread parsing many documents stops calling malloc after the first few. Each block is preceded
+ * by its size, for realloc. The chunks are only given back when the thread exits, after which
+ * the arena owns nothing, in case libxml2 frees its thread state later.
+ */
+struct xmlarena {
+  static constexpr size_t ALIGN = 16;
+  static constexpr size_t FIRST_CHUNK = 1 << 20;
+  static constexpr size_t LARGE = 1 << 18; // Bigger blocks always come from malloc
+
+  struct chunk {
+    char* base;
+    size_t size;
+    size_t used;
+  };
+
+  chunk chunks[40];     // Doubling in size, more than enough for any address space
+  size_t count = 0;
+  size_t current = 0;   // The chunk being filled
+  char* last = nullptr; // The latest block, which can grow in place
+  unsigned depth = 0;   // Number of open scopes
+
+  ~xmlarena() {
+    for( size_t i = 0; i < count; i++ )
+      free(chunks[i].base);
+    count = 0;
+  }
+
+  static size_t round(size_t n) {
+    return (n + ALIGN - 1) & ~(ALIGN - 1);
+  }
+
+  static size_t& sizeOf(void* p) {
+    return *(size_t*)((char*)p - ALIGN);
+  }
+
+  bool owns(const void* p) const {
+    for( size_t i = 0; i < count; i++ )
+      if( (const char*)p >= chunks[i].base && (const char*)p < chunks[i].base + chunks[i].size )
+        return true;
+    return false;
+  }
+
+  void* alloc(size_t n) {
+    size_t need = ALIGN + round(n);
+    while( current < count && chunks[current].size - chunks[current].used < need )
+      current++;
+
+    if( current == count ){
+      // Each new chunk is twice the last, so a big document needs few of them
+      size_t size = count == 0 ? FIRST_CHUNK : chunks[count - 1].size * 2;
+      char* base = count < std::size(chunks) ? (char*)aligned_alloc(ALIGN, size) : nullptr;
+      if( !base ) return nullptr;
+      chunks[count++] = {base, size, 0};
+    }
+
+    chunk& c = chunks[current];
+    char* p = c.base + c.used + ALIGN;
+    c.used += need;
+    sizeOf(p) = n;
+    last = p;
+    return p;
+  }
+
+  // Grow the latest block where it is, if its chunk has room
+  bool grow(void* p, size_t n) {
+    if( p != last ) return false;
+    chunk& c = chunks[current];
+    size_t end = (char*)p - c.base + round(n);
+    if( end > c.size ) return false;
+    c.used = end;
+    sizeOf(p) = n;
+    return true;
+  }
+
+  void reset() {
+    for( size_t i = 0; i < count; i++ )
+      chunks[i].used = 0;
+    current = 0;
+    last = nullptr;
+  }
+};
+
+static thread_local xmlarena arena;
+
+static bool installed = false;
+
+static void* arenaMalloc(size_t n) {
+  xmlarena& a = arena;
+  if( a.depth == 0 || n > xmlarena::LARGE )
+    return malloc(n);
+  return a.alloc(n);
+}
+
+static void arenaFree(void* p) {
+  if( p && !arena.owns(p) )
+    free(p);
+}
+
+static void* arenaRealloc(void* p, size_t n) {
+  if( !p )
+    return arenaMalloc(n);
+
+  xmlarena& a = arena;
+  if( !a.owns(p) )
+    return realloc(p, n);
+
+  size_t old = xmlarena::sizeOf(p);
+  if( n <= old || a.grow(p, n) ){
+    if( n > old ) xmlarena::sizeOf(p) = n;
+    return p;
+  }
+
+  void* q = arenaMalloc(n);
+  if( q ) memcpy(q, p, std::min(old, n));
+  return q;
+}
+
+static char* arenaStrdup(const char* s) {
+  size_t n = strlen(s) + 1;
+  char* d = (char*)arenaMalloc(n);
+  if( d ) memcpy(d, s, n);
+  return d;
+}
+
+/**
+ * @brief Install the arena allocator into libxml2
+ *
+ * libxml2's global state is set up right after, outside of any arena, so that it isn't reset
+ * along with a document.
+ */
+void xml_arena_install() {
+#ifndef DOCMNG_NO_XML_ARENA
+  if( installed ) return;
+  installed = xmlMemSetup(arenaFree, arenaMalloc, arenaRealloc, arenaStrdup) == 0;
+#endif
+  xmlInitParser();
+}
+
+bool xml_arena_installed() {
+  return installed;
+}
+
+xmlarenascope::xmlarenascope() {
+  if( installed )
+    arena.depth++;
+}
+
+xmlarenascope::~xmlarenascope() {
+  if( !installed ) return;
+
+  xmlarena& a = arena;
+  if( --a.depth > 0 ) return;
+
+  // The thread's last error holds strings from the arena
+  xmlResetLastError();
+  a.reset();
+}
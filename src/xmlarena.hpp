@@ -0,0 +1,33 @@
+#pragma once
+
+/*
+ * libxml2 allocations from a per-thread monotonic arena.
+ *
+ * Parsing a document makes thousands of small allocations for nodes, names and text, which all
+ * die together when the document is freed. Inside an xmlarenascope they are carved out of the
+ * thread's arena instead, freeing them does nothing, and the whole arena is reset in one go when
+ * the scope ends. Outside a scope, and for very large blocks, libxml2 uses malloc as usual.
+ *
+ * Define DOCMNG_NO_XML_ARENA to leave libxml2's allocator alone.
+ */
+
+// Route libxml2's allocations through the arena. Call before anything else uses libxml2.
+void xml_arena_install();
+
+// Whether the arena allocator is in use
+bool xml_arena_installed();
+
+/**
+ * @brief Sends the calling thread's libxml2 allocations to its arena while it exists
+ *
+ * The arena is reset when the outermost scope on a thread ends, so everything libxml2 allocated
+ * in the scope must have been freed, or be abandoned, by then.
+ */
+class xmlarenascope {
+  public:
+    xmlarenascope();
+    ~xmlarenascope();
+
+    xmlarenascope(const xmlarenascope&) = delete;
+    xmlarenascope& operator=(const xmlarenascope&) = delete;
+};
@@ -0,0 +1,380 @@
+#include "zip.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Record signatures
+constexpr uint32_t SIG_EOCD = 0x06054b50;
+constexpr uint32_t SIG_EOCD64 = 0x06064b50;
+constexpr uint32_t SIG_EOCD64_LOCATOR = 0x07064b50;
+constexpr uint32_t SIG_CENTRAL = 0x02014b50;
+constexpr uint32_t SIG_LOCAL = 0x04034b50;
+
+// Size of the fixed part of a central directory header
+constexpr size_t CENTRAL_HEADER_SIZE = 46;
+
+// Zip fields are little endian. Read them byte by byte so alignment doesn't matter.
+static uint16_t le16(const char* p) {
+  auto u = (const unsigned char*)p;
+  return uint16_t(u[0] | (u[1] << 8));
+}
+
+static uint32_t le32(const char* p) {
+  auto u = (const unsigned char*)p;
+  return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+static uint64_t le64(const char* p) {
+  return uint64_t(le32(p)) | (uint64_t(le32(p + 4)) << 32);
+}
+
+/**
+ * @brief Search the tail of an archive for the End-Of-Central-Directory record
+ *
+ * The record is found by scanning backwards for its signature. Zip64 archives are supported
+ * as long as their Zip64 EOCD record lies within the given tail.
+ *
+ * @param tail The last bytes of the archive. At most ZIP_EOCD_SEARCH bytes are needed.
+ * @param tail_offset The absolute offset of the tail in the archive
+ * @returns Nothing if no valid record was found, else the central directory location
+ */
+std::optional<zipeocd> zip_find_eocd(std::string_view tail, uint64_t tail_offset) {
+  if( tail.size() < ZIP_EOCD_SIZE ) return std::nullopt;
+
+  for( size_t pos = tail.size() - ZIP_EOCD_SIZE + 1; pos-- > 0; ){
+    const char* rec = tail.data() + pos;
+    if( le32(rec) != SIG_EOCD ) continue;
+
+    // The comment must fit in the rest of the file
+    if( pos + ZIP_EOCD_SIZE + le16(rec + 20) > tail.size() ) continue;
+
+    zipeocd eocd;
+    eocd.entries = le16(rec + 10);
+    eocd.cd_size = le32(rec + 12);
+    eocd.cd_offset = le32(rec + 16);
+
+    if( eocd.entries == 0xFFFF || eocd.cd_size == 0xFFFFFFFF || eocd.cd_offset == 0xFFFFFFFF ){
+      // Zip64: The locator sits right before the EOCD record
+      if( pos < 20 || le32(rec - 20) != SIG_EOCD64_LOCATOR ) return std::nullopt;
+      uint64_t rec64 = le64(rec - 20 + 8);
+      if( rec64 < tail_offset || rec64 - tail_offset + 56 > pos ){
+        std::cerr << "Zip64 EOCD record lies outside of the read archive tail" << std::endl;
+        return std::nullopt;
+      }
+      const char* r64 = tail.data() + (rec64 - tail_offset);
+      if( le32(r64) != SIG_EOCD64 ) return std::nullopt;
+      eocd.entries = le64(r64 + 32);
+      eocd.cd_size = le64(r64 + 40);
+      eocd.cd_offset = le64(r64 + 48);
+    }
+
+    return eocd;
+  }
+
+  return std::nullopt;
+}
+
+/**
+ * @brief Walk a central directory looking for the named entry
+ *
+ * @param cdir The raw bytes of the central directory
+ * @param name The full path of the entry within the archive, i.e. "word/document.xml"
+ * @returns Nothing if the entry doesn't exist or the directory is malformed
+ */
+std::optional<zipentry> zip_find_entry(std::string_view cdir, std::string_view name) {
+  size_t pos = 0;
+
+  while( pos + CENTRAL_HEADER_SIZE <= cdir.size() ){
+    const char* hdr = cdir.data() + pos;
+    if( le32(hdr) != SIG_CENTRAL ) return std::nullopt;
+
+    size_t namelen = le16(hdr + 28);
+    size_t extralen = le16(hdr + 30);
+    size_t commentlen = le16(hdr + 32);
+    size_t next = pos + CENTRAL_HEADER_SIZE + namelen + extralen + commentlen;
+    if( next > cdir.size() ) return std::nullopt;
+
+    if( cdir.substr(pos + CENTRAL_HEADER_SIZE, namelen) == name ){
+      zipentry ent;
+      ent.name = name;
+      ent.method = le16(hdr + 10);
+      ent.crc = le32(hdr + 16);
+      ent.compressed_size = le32(hdr + 20);
+      ent.uncompressed_size = le32(hdr + 24);
+      ent.local_offset = le32(hdr + 42);
+
+      // Zip64 extended information holds only the fields that overflowed, in this order
+      const char* extra = hdr + CENTRAL_HEADER_SIZE + namelen;
+      const char* extra_end = extra + extralen;
+      while( extra + 4 <= extra_end ){
+        uint16_t id = le16(extra);
+        uint16_t len = le16(extra + 2);
+        const char* field = extra + 4;
+        const char* field_end = field + len;
+        if( field_end > extra_end ) break;
+
+        if( id == 0x0001 ){
+          if( ent.uncompressed_size == 0xFFFFFFFF && field + 8 <= field_end ){
+            ent.uncompressed_size = le64(field);
+            field += 8;
+          }
+          if( ent.compressed_size == 0xFFFFFFFF && field + 8 <= field_end ){
+            ent.compressed_size = le64(field);
+            field += 8;
+          }
+          if( ent.local_offset == 0xFFFFFFFF && field + 8 <= field_end ){
+            ent.local_offset = le64(field);
+          }
+        }
+        extra = field_end;
+      }
+
+      return ent;
+    }
+
+    pos = next;
+  }
+
+  return std::nullopt;
+}
+
+/**
+ * @brief List the names of every entry in a raw central directory, in their order in it
+ *
+ * @param cdir The whole central directory
+ * @returns The names, up to the first malformed header
+ */
+std::vector<string> zip_entry_names(std::string_view cdir) {
+  std::vector<string> names;
+  size_t pos = 0;
+
+  while( pos + CENTRAL_HEADER_SIZE <= cdir.size() ){
+    const char* hdr = cdir.data() + pos;
+    if( le32(hdr) != SIG_CENTRAL ) break;
+
+    size_t namelen = le16(hdr + 28);
+    size_t next = pos + CENTRAL_HEADER_SIZE + namelen + le16(hdr + 30) + le16(hdr + 32);
+    if( next > cdir.size() ) break;
+
+    names.emplace_back(cdir.substr(pos + CENTRAL_HEADER_SIZE, namelen));
+    pos = next;
+  }
+
+  return names;
+}
+
+/**
+ * @brief Get the length of a local file header. The entry data follows right after it.
+ *
+ * The name and extra field lengths of the local header can differ from the central
+ * directory, so they must be read from the local header itself.
+ *
+ * @param local Bytes starting at the local header. Must be at least ZIP_LOCAL_HEADER_SIZE long.
+ * @returns Nothing if the bytes aren't a local header
+ */
+std::optional<size_t> zip_local_header_size(std::string_view local) {
+  if( local.size() < ZIP_LOCAL_HEADER_SIZE || le32(local.data()) != SIG_LOCAL )
+    return std::nullopt;
+
+  return ZIP_LOCAL_HEADER_SIZE + le16(local.data() + 26) + le16(local.data() + 28);
+}
+
+/**
+ * @brief Check an entry's sizes before anything is allocated for it
+ *
+ * The sizes come from the archive, and a corrupt or hostile one can claim anything up to 2^64
+ * bytes. Stored entries are as large as their data, and deflate can't do better than about
+ * ZIP_MAX_DEFLATE_RATIO to 1, so a larger claim can't be right. Entries over
+ * ZIP_MAX_ENTRY_SIZE are refused too.
+ *
+ * @returns False, after saying why, if the entry shouldn't be read
+ */
+bool zip_entry_size_ok(const zipentry& ent) {
+  uint64_t most = ent.method == 0 ? ent.compressed_size : ent.compressed_size * ZIP_MAX_DEFLATE_RATIO + 64;
+  if( ent.compressed_size > ZIP_MAX_ENTRY_SIZE || ent.uncompressed_size > ZIP_MAX_ENTRY_SIZE || ent.uncompressed_size > most ){
+    std::cerr << "Zip entry " << ent.name << " claims an impossible size of " << ent.uncompressed_size << " bytes" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Decompress an entry's data
+ *
+ * @param ent The entry, as found in the central directory
+ * @param data The compressed bytes. Must be exactly ent.compressed_size long.
+ * @returns Nothing on an unsupported compression method, corrupt data or CRC mismatch
+ */
+std::optional<string> zip_inflate(const zipentry& ent, std::string_view data) {
+  if( data.size() != ent.compressed_size ){
+    std::cerr << "Zip entry " << ent.name << " is truncated" << std::endl;
+    return std::nullopt;
+  }
+  if( !zip_entry_size_ok(ent) )
+    return std::nullopt;
+
+  string out;
+
+  switch( ent.method ){
+    case 0: // Stored
+      out = data;
+      break;
+
+    case 8: { // Deflated
+      out.resize(ent.uncompressed_size);
+
+      z_stream strm;
+      memset(&strm, 0, sizeof(strm));
+      // Negative window bits: raw deflate data without a zlib header
+      if( inflateInit2(&strm, -MAX_WBITS) != Z_OK ) return std::nullopt;
+
+      // avail_in and avail_out are 32 bits, so larger entries go through in pieces
+      constexpr size_t PIECE = UINT32_MAX;
+      size_t in = 0, produced = 0;
+      int ret;
+      strm.next_in = (Bytef*)data.data();
+      strm.next_out = (Bytef*)out.data();
+      while( true ){
+        if( strm.avail_in == 0 && in < data.size() ){
+          strm.avail_in = std::min(PIECE, data.size() - in);
+          in += strm.avail_in;
+        }
+        if( strm.avail_out == 0 && produced < out.size() ){
+          strm.avail_out = std::min(PIECE, out.size() - produced);
+          produced += strm.avail_out;
+        }
+        ret = inflate(&strm, in == data.size() && produced == out.size() ? Z_FINISH : Z_NO_FLUSH);
+        if( ret == Z_OK ) continue;
+        // Only go on if there's another piece to give it
+        if( ret == Z_BUF_ERROR && !(strm.avail_out == 0 && produced == out.size()) && !(strm.avail_in == 0 && in == data.size()) ) continue;
+        break;
+      }
+      inflateEnd(&strm);
+
+      if( ret != Z_STREAM_END || strm.total_out != ent.uncompressed_size ){
+        std::cerr << "Unable to inflate zip entry " << ent.name << std::endl;
+        return std::nullopt;
+      }
+      break;
+    }
+
+    default:
+      std::cerr << "Unsupported compression method " << ent.method << " for zip entry " << ent.name << std::endl;
+      return std::nullopt;
+  }
+
+  if( crc32_z(0L, (const Bytef*)out.data(), out.size()) != ent.crc ){
+    std::cerr << "CRC mismatch in zip entry " << ent.name << std::endl;
+    return std::nullopt;
+  }
+
+  STATS_ADD(BYTES_INFLATED, out.size());
+  return out;
+}
+
+/**
+ * @brief pread() until the whole range is read
+ *
+ * @returns False on error or end of file
+ */
+static bool pread_full(int fd, char* buf, size_t len, uint64_t offset) {
+  while( len > 0 ){
+    ssize_t res = pread(fd, buf, len, offset);
+    if( res < 0 && errno == EINTR ) continue;
+    if( res <= 0 ) return false;
+    buf += res;
+    len -= res;
+    offset += res;
+  }
+  return true;
+}
+
+/**
+ * @brief Open an archive and read its central directory
+ *
+ * The tail of the archive is read first. It holds the End-Of-Central-Directory record and, for
+ * most documents, the whole central directory. On failure the archive is left closed.
+ *
+ * @param file The path to the zip archive
+ */
+ziparchive::ziparchive(const path& file) {
+  fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if( fd < 0 || fstat(fd, &st) < 0 ){
+    std::cerr << "Unable to open " << file << ": " << strerror(errno) << std::endl;
+    if( fd >= 0 ) close(fd);
+    fd = -1;
+    return;
+  }
+  size = st.st_size;
+
+  size_t taillen = std::min<uint64_t>(size, ZIP_EOCD_SEARCH);
+  string tail(taillen, '\0');
+  std::optional<zipeocd> eocd;
+  if( pread_full(fd, tail.data(), taillen, size - taillen) )
+    eocd = zip_find_eocd(tail, size - taillen);
+
+  if( !eocd || eocd->cd_size > size || eocd->cd_offset > size - eocd->cd_size ){
+    std::cerr << file << " is not a valid zip archive" << std::endl;
+    close(fd);
+    fd = -1;
+    return;
+  }
+
+  if( eocd->cd_offset >= size - taillen ){
+    cdir = tail.substr(eocd->cd_offset - (size - taillen), eocd->cd_size);
+  }else{
+    cdir.resize(eocd->cd_size);
+    if( !pread_full(fd, cdir.data(), cdir.size(), eocd->cd_offset) ){
+      std::cerr << "Unable to read the central directory of " << file << std::endl;
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+ziparchive::~ziparchive() {
+  if( fd >= 0 )
+    close(fd);
+}
+
+/**
+ * @brief Read an entry of the archive
+ *
+ * The local header and the entry data are fetched with a single read in the common case.
+ *
+ * @param name The full path of the entry within the archive
+ * @returns Nothing if the entry doesn't exist or can't be read
+ */
+std::optional<string> ziparchive::read(std::string_view name) const {
+  if( fd < 0 ) return std::nullopt;
+
+  STATS_SCOPE(UNZIP);
+
+  auto ent = zip_find_entry(cdir, name);
+  if( !ent || ent->local_offset >= size || !zip_entry_size_ok(*ent) ) return std::nullopt;
+
+  uint64_t len = ZIP_LOCAL_HEADER_SIZE + name.size() + ZIP_LOCAL_SLACK + ent->compressed_size;
+  string buf(std::min(len, size - ent->local_offset), '\0');
+  if( !pread_full(fd, buf.data(), buf.size(), ent->local_offset) ) return std::nullopt;
+
+  auto hdr = zip_local_header_size(buf);
+  if( !hdr || ent->local_offset + *hdr + ent->compressed_size > size ) return std::nullopt;
+
+  size_t have = buf.size();
+  if( *hdr + ent->compressed_size > have ){
+    // The extra field was larger than expected, get the rest of the data
+    buf.resize(*hdr + ent->compressed_size);
+    if( !pread_full(fd, buf.data() + have, buf.size() - have, ent->local_offset + have) )
+      return std::nullopt;
+  }
+
+  return zip_inflate(*ent, std::string_view(buf).substr(*hdr, ent->compressed_size));
+}
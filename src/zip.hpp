@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::filesystem::path;
+
+/**
+ * @brief Location of the central directory, as read from the End-Of-Central-Directory record
+ */
+struct zipeocd {
+  uint64_t cd_offset; ///< Absolute offset of the central directory in the archive
+  uint64_t cd_size;   ///< Size of the central directory in bytes
+  uint64_t entries;   ///< Number of entries in the central directory
+};
+
+/**
+ * @brief A single file entry from the central directory of a zip archive
+ */
+struct zipentry {
+  string name;
+  uint16_t method;            ///< 0 for stored, 8 for deflated
+  uint32_t crc;
+  uint64_t compressed_size;
+  uint64_t uncompressed_size;
+  uint64_t local_offset;      ///< Absolute offset of the entry's local file header
+};
+
+// Size of the fixed part of the End-Of-Central-Directory record
+constexpr size_t ZIP_EOCD_SIZE = 22;
+
+// Largest tail of an archive that can contain the EOCD record (record + max comment length)
+constexpr size_t ZIP_EOCD_SEARCH = ZIP_EOCD_SIZE + 0xFFFF;
+
+// Size of the fixed part of a local file header
+constexpr size_t ZIP_LOCAL_HEADER_SIZE = 30;
+
+// Extra bytes read after a local header's name, in the hope of getting its extra field too
+constexpr size_t ZIP_LOCAL_SLACK = 1024;
+
+// Largest entry that is ever inflated, whatever its header claims
+constexpr uint64_t ZIP_MAX_ENTRY_SIZE = uint64_t(1) << 30;
+
+// Most a deflated byte can inflate to, with some slack for the end of the stream
+constexpr uint64_t ZIP_MAX_DEFLATE_RATIO = 1032;
+
+// Find the End-Of-Central-Directory record in the last bytes of an archive
+std::optional<zipeocd> zip_find_eocd(std::string_view tail, uint64_t tail_offset);
+
+// Find a named entry in a raw central directory
+std::optional<zipentry> zip_find_entry(std::string_view cdir, std::string_view name);
+
+// List the names of every entry in a raw central directory
+std::vector<string> zip_entry_names(std::string_view cdir);
+
+// Get the length of a local file header (fixed part, name and extra field)
+std::optional<size_t> zip_local_header_size(std::string_view local);
+
+// Whether an entry's sizes are ones it could really inflate to, so they're safe to allocate
+bool zip_entry_size_ok(const zipentry&);
+
+// Decompress the data of an entry and check its CRC
+std::optional<string> zip_inflate(const zipentry&, std::string_view data);
+
+/**
+ * @brief A zip archive read with positioned reads
+ *
+ * Only the End-Of-Central-Directory record, the central directory and the byte ranges of the
+ * requested entries are ever read, so the cost of reading an entry doesn't depend on the size
+ * of the rest of the archive.
+ */
+class ziparchive {
+  int fd = -1;
+  uint64_t size = 0;
+  string cdir;
+
+  public:
+    explicit ziparchive(const path&);
+    ~ziparchive();
+
+    ziparchive(const ziparchive&) = delete;
+    ziparchive& operator=(const ziparchive&) = delete;
+
+    // Whether the archive was opened and its central directory read
+    bool is_open() const {
+      return fd >= 0;
+    }
+
+    // Read and decompress a single entry
+    std::optional<string> read(std::string_view) const;
+
+    // The central directory entry of an entry, if the archive has it
+    std::optional<zipentry> entry(std::string_view name) const {
+      return zip_find_entry(cdir, name);
+    }
+
+    // Whether the archive has an entry
+    bool contains(std::string_view name) const {
+      return zip_find_entry(cdir, name).has_value();
+    }
+
+    // The names of every entry
+    std::vector<string> entries() const {
+      return zip_entry_names(cdir);
+    }
+};